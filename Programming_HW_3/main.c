@@ -2,384 +2,6210 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 // Added this header for ssize_t
 #include <unistd.h>
 
-#define BUFSIZE 256
+// Headers for memory-mapping the dictionary file
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-typedef struct Node
+// Header for locking the journal of added words
+#include <sys/file.h>
+
+// Headers for the spell-check server and its client
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+
+// Header for the peak RSS "bench" mode reports
+#include <sys/resource.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The tokenizer has SSE2 and AVX2 versions on x86-64, chosen at runtime; other targets use the scalar one.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_TOKENIZER
+#include <immintrin.h>
+#endif
+
+// The table never lets more than 4 out of 5 slots fill up before it doubles.
+#define MAX_LOAD_NUMERATOR 4
+#define MAX_LOAD_DENOMINATOR 5
+
+// Marks a slot that holds no word.
+#define EMPTY_SLOT 0xFFFFFFFFu
+
+// Blocked Bloom filter (--bloom): each word sets one bit in each of the eight 32-bit words of a 256-bit block.
+#define BLOOM_BLOCK_BITS 256
+#define BLOOM_WORDS_PER_BLOCK 8
+#define BLOOM_DEFAULT_BITS_PER_WORD 12
+
+// Minimal perfect hash (--mph): each level has MPH_GAMMA bits per word that reaches it, and the words still
+// colliding after MPH_MAX_LEVELS levels go into a small fallback table.
+// The bits are kept in cache-line blocks of MPH_BLOCK_WORDS words: a count of the bits set before the block, then the bits.
+#define MPH_GAMMA 2
+#define MPH_MAX_LEVELS 8
+#define MPH_BLOCK_WORDS 8
+#define MPH_BLOCK_BITS ((MPH_BLOCK_WORDS - 1) * 64)
+
+// Passes of the perfect hash build, each run on every build thread.
+#define MPH_PASS_MARK 0
+#define MPH_PASS_COUNT 1
+#define MPH_PASS_MOVE 2
+#define MPH_PASS_ENTRIES 3
+
+// Front-coded dictionary (--front-coded): words per bucket. Only the first word of a bucket is stored whole.
+#define FRONT_CODED_BUCKET_WORDS 16
+
+// Used to guess the number of words in a dictionary file from its size (words.txt averages about 10.4 bytes per line).
+#define AVERAGE_DICTIONARY_LINE 10
+
+// Number of words hashed ahead of their insertion when loading the dictionary in bulk.
+#define BULK_INSERT_BATCH 16
+
+// Hash function used when --hash is not given, and the probe distances --stats shows one by one (longer ones are added up in the last line).
+#define DEFAULT_HASH_FUNCTION "wyhash"
+#define HEALTH_HISTOGRAM_BUCKETS 16
+
+// Binary dictionary snapshots ("compile" mode). Bump SNAPSHOT_VERSION whenever the layout below changes.
+// The header also records the id of the hash function, so a snapshot built with another one is rejected instead of misread.
+// Version 2 added the optional minimal perfect hash after the arena.
+#define SNAPSHOT_MAGIC "SPELLDB"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_EXTENSION ".snap"
+#define SNAPSHOT_ALIGNMENT 128
+
+// Symmetric delete (SymSpell) suggestions. Deletes are generated from the first SYMSPELL_PREFIX_LENGTH
+// letters of each word only, which keeps the index small without losing any candidate.
+#define SYMSPELL_PREFIX_LENGTH 7
+#define SYMSPELL_MAX_DISTANCE 3
+#define SYMSPELL_DEFAULT_DISTANCE 2
+#define SYMSPELL_MAX_DELETES 64         // 1 + 7 + 21 + 35 strings for a 7-letter prefix and distance 3
+#define SYMSPELL_DIRECTORY_BITS 20      // the index finds the entries for a hash through a directory over its top bits
+
+// Longest word editDistance compares; longer words never get edit-distance suggestions.
+#define MAX_WORD_LENGTH 64
+
+// Trie suggestions ("--suggest=trie"). No trie path deeper than the longest query plus the largest distance is ever needed.
+#define NO_TRIE_NODE 0xFFFFFFFFu
+#define TRIE_MAX_DEPTH (MAX_WORD_LENGTH + SYMSPELL_MAX_DISTANCE)
+
+// Number of misspellings "bench-suggest" times each method on by default.
+#define BENCHMARK_DEFAULT_WORDS 2000
+
+// "bench" mode: default corpus size, share of misspelled words and seed, and words per line of the corpus.
+#define BENCHMARK_CORPUS_WORDS 1000000
+#define BENCHMARK_TYPO_PERCENT 5
+#define BENCHMARK_SEED 0x2545F4914F6CDD1Dull
+#define BENCHMARK_WORDS_PER_LINE 12
+
+// The input is checked in chunks of about this many bytes; each chunk ends on a delimiter.
+#define CHECK_CHUNK_SIZE (1 << 20)
+// With --threads, workers run at most this many chunks per thread ahead of the output.
+#define MAX_CHUNKS_IN_FLIGHT_PER_THREAD 4
+// In parallel add mode, a misspelling whose suggestions missed more than this many newly learned words gets a new report.
+#define SETTLE_MAX_NEW_WORDS 32
+
+// The tokenizer classifies this many input bytes at a time (one bit each in a 64-bit mask).
+#define TOKENIZER_BLOCK 64
+// Number of word spans checkChunk asks the tokenizer for at a time.
+#define CHECK_SPAN_BATCH 256
+
+// lookupWordSlots hashes and prefetches this many words before it resolves any of them.
+#define LOOKUP_BATCH_SIZE 16
+
+// The three checks try len - 1 swaps plus 26 + 26 insertions and 2 deletions for a word of len letters.
+#define CLASSIC_EXTRA_CANDIDATES 53
+// Their letters take about len * len bytes, so longer tokens get no suggestions from the three checks.
+#define CLASSIC_MAX_WORD_LENGTH 1024
+
+// Suggestion cache of each checking thread: this many sets of this many entries (a power of two sets).
+#define SUGGESTION_CACHE_SETS 1024
+#define SUGGESTION_CACHE_WAYS 8
+
+// "serve" and "client" modes. The socket sits next to the dictionary unless --socket names another one.
+#define SOCKET_EXTENSION ".sock"
+// How long the server waits before accepting again when it has run out of file descriptors or memory.
+#define ACCEPT_RETRY_MILLISECONDS 100
+
+// Journal of added words (--journal): kept next to the dictionary by default, synced every JOURNAL_SYNC_WORDS
+// words, and folded into the dictionary at the end of a run once it holds JOURNAL_COMPACT_WORDS words.
+#define JOURNAL_EXTENSION ".journal"
+#define JOURNAL_SYNC_WORDS 256
+#define JOURNAL_COMPACT_WORDS 4096
+#define MAX_MESSAGE_PAYLOAD (16 << 20)
+// The client sends the input in requests of this many words and keeps this many requests in flight.
+#define CLIENT_BATCH_WORDS 1024
+#define CLIENT_REQUESTS_IN_FLIGHT 8
+// Request flag: learn every misspelled word for the rest of the connection (add mode).
+#define REQUEST_LEARN 1
+
+// These are the delimiters you are expected to check for. Nothing else is needed here.
+static const bool isDelimiter[256] = {
+    [' '] = true, [','] = true, ['.'] = true, [':'] = true, [';'] = true, ['!'] = true, ['\n'] = true, ['\0'] = true
+};
+
+// Each slot stores the full 32-bit hash of its word next to the word's offset in the arena.
+// The hash doubles as a fingerprint, so almost every mismatch is rejected without touching the string.
+// Empty slots have offset EMPTY_SLOT.
+typedef struct Slot
+{
+    uint32_t hash;
+    uint32_t offset;
+} Slot;
+
+// A hash function --hash can pick, and the id snapshots record for it.
+typedef struct HashFunction
+{
+    const char* name;
+    uint32_t id;
+    uint32_t (*function)(const char* word, size_t len);
+} HashFunction;
+
+// Bloom filter in front of the hash table, so most lookups of words that are not in the dictionary
+// (nearly all of the candidates printSuggestions tries) end after one cache line.
+typedef struct BloomFilter
+{
+    uint32_t* blocks;           // blockCount blocks of BLOOM_WORDS_PER_BLOCK words
+    uint32_t blockCount;
+    int bitsPerWord;
+} BloomFilter;
+
+// Entry of the minimal perfect hash: everything a lookup needs to confirm a word, in one place.
+typedef struct PerfectHashEntry
+{
+    uint32_t hash;
+    uint32_t offset;        // arena offset of the word
+    uint32_t slotIndex;     // its slot in the table, which lookups return; EMPTY_SLOT for an empty fallback entry
+} PerfectHashEntry;
+
+// Start of the minimal perfect hash's image. The bit blocks, entries and fallback entries follow it in that
+// order, so the whole index is one block of memory that a snapshot stores and maps as it is.
+typedef struct PerfectHashImage
+{
+    uint32_t levelCount;
+    uint32_t entryCount;                    // words placed by the levels
+    uint32_t fallbackCapacity;              // power of two, or 0 if every word was placed
+    uint32_t reserved;
+    uint64_t blockCount;                    // MPH_BLOCK_WORDS-word blocks in all the levels together
+    uint64_t levelBits[MPH_MAX_LEVELS];     // bits in each level, a whole number of blocks
+    uint64_t levelStart[MPH_MAX_LEVELS];    // first block of each level
+    uint64_t padding[5];                    // keeps the blocks after it on a cache line boundary
+} PerfectHashImage;
+
+_Static_assert(sizeof(PerfectHashImage) % 64 == 0, "perfect hash blocks must start on a cache line");
+
+// Minimal perfect hash over the words of a finished table (--mph), BBHash style. Level l has a bit for
+// each of about MPH_GAMMA times the words that reached it. A word's bit is set in the first level where no
+// other word shares its position, and the number of set bits before it is its entry. The bits are stored
+// in 64-byte blocks that start with the number of bits set before the block, so finding a word's entry
+// reads one cache line. Words that still collide after the last level go into a small fallback table.
+typedef struct PerfectHash
+{
+    PerfectHashImage* image;
+    size_t imageSize;
+    uint64_t* blocks;           // per block: the set bits before it, then MPH_BLOCK_WORDS - 1 words of bits
+    PerfectHashEntry* entries;
+    PerfectHashEntry* fallback; // open addressing by hash
+    bool isMapped;              // the image points into a mapped snapshot
+} PerfectHash;
+
+// Sorted, front-coded copy of the dictionary (--front-coded). The words are cut into buckets of
+// FRONT_CODED_BUCKET_WORDS. The first word of a bucket is stored whole. Every other word is stored as the
+// number of leading letters it shares with the word before it (a varint), then the rest of its letters.
+// Every word ends with a NUL. A word's rank in sorted order takes the place of its slot index.
+typedef struct FrontCodedDictionary
+{
+    uint32_t count;
+    uint32_t bucketCount;
+    uint32_t* buckets;      // buckets[b] is where bucket b starts in data, buckets[bucketCount] is the end
+    uint64_t* headKeys;     // the first 8 letters of each bucket's first word (see frontCodedKey), so the binary
+                            // search mostly compares numbers in one small array instead of reading the words
+    char* data;
+    size_t dataSize;
+} FrontCodedDictionary;
+
+// Walk over a front-coded dictionary in sorted order, from the first word that starts with prefix.
+typedef struct FrontCodedIterator
+{
+    const FrontCodedDictionary* dictionary;
+    uint32_t rank;          // rank of the word in word, UINT32_MAX before the first one
+    const char* position;   // encoding of the next word
+    const char* prefix;
+    size_t prefixLen;
+    bool advance;           // word has been handed out, so the next call decodes the one after it
+    bool done;
+    char* word;             // the current word, decoded
+    size_t wordCapacity;
+} FrontCodedIterator;
+
+// Flat open-addressing hash table (Robin Hood linear probing). All the words live back to back,
+// NUL-terminated, in one growing arena, so the whole dictionary is three allocations.
+typedef struct openHashTable
+{
+    uint32_t capacity;      // number of slots, always a power of two
+    uint32_t mask;          // capacity - 1, used instead of % size
+    uint32_t count;         // number of words in the table
+    Slot* slots;
+
+    char* arena;            // string storage for every word in the table
+    size_t arenaSize;       // bytes used in the arena
+    size_t arenaCapacity;   // bytes allocated for the arena
+    bool arenaIsMapped;     // true while the arena points into mapping rather than malloc'ed memory
+    bool slotsAreMapped;    // true while the slots point into mapping rather than malloc'ed memory
+    void* mapping;          // memory-mapped dictionary file or snapshot, NULL if there is none
+    size_t mappingLength;
+    BloomFilter* bloom;     // optional, NULL unless --bloom was given
+    uint32_t* frequencies;  // --freq: frequencies[i] is the count of the word in slots[i], NULL without a frequency file.
+                            // It is filled in once the table is complete, and the slots never move after that.
+    PerfectHash* perfect;   // --mph: minimal perfect hash over the finished table, NULL without one. Lookups
+                            // go through it instead of probing. Inserting a word drops it.
+    FrontCodedDictionary* frontCoded;   // --front-coded: the words once the slots and the arena are gone, NULL
+                                        // otherwise. Slot indexes are then ranks in sorted order.
+} openHashTable;
+
+// Counters for the lookups made while checking (--stats).
+typedef struct LookupStats
+{
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t bloomRejected;         // misses the Bloom filter answered without touching the table
+    uint64_t bloomFalsePositives;   // misses that got past the Bloom filter
+    uint64_t cacheHits;             // misspellings whose suggestions came from the suggestion cache
+    uint64_t cacheMisses;
+} LookupStats;
+
+static _Thread_local LookupStats threadLookupStats;
+static LookupStats totalLookupStats;
+static pthread_mutex_t totalLookupStatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Server state: set by the SIGINT/SIGTERM handler, the pipe the handler writes to so that it wakes the
+// accept loop's poll, and the number of connections being served.
+static volatile sig_atomic_t serverStopping = 0;
+static int serverWakeFds[2] = {-1, -1};
+static int activeConnections = 0;
+static pthread_mutex_t serverLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Header at the start of a snapshot file. Everything after it is addressed by offsets from the start
+// of the file, so a mapped snapshot can be used wherever the kernel happens to place it.
+typedef struct SnapshotHeader
+{
+    char magic[8];              // SNAPSHOT_MAGIC
+    uint32_t version;           // SNAPSHOT_VERSION
+    uint32_t hashVersion;       // id of the hash function that placed the slots
+    uint64_t sourceSize;        // size and modification time of the text dictionary the snapshot was built from
+    int64_t sourceMtimeSeconds;
+    int64_t sourceMtimeNanoseconds;
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t slotsOffset;
+    uint64_t arenaOffset;
+    uint64_t arenaSize;
+    uint64_t perfectHashOffset; // image of the minimal perfect hash (compile --mph), on a cache line boundary
+    uint64_t perfectHashSize;   // 0 if the snapshot has none
+    uint64_t payloadChecksum;   // checksum of the slots, the arena and the perfect hash
+    uint64_t headerChecksum;    // checksum of every field above
+} SnapshotHeader;
+
+_Static_assert(sizeof(SnapshotHeader) <= SNAPSHOT_ALIGNMENT, "snapshot header must fit before the slots");
+
+// One string obtained by deleting letters from a dictionary word, identified by its hash.
+typedef struct DeleteEntry
+{
+    uint32_t deleteHash;
+    uint32_t wordOffset;    // arena offset of the dictionary word it came from
+} DeleteEntry;
+
+// Symmetric delete index: the deletes of every dictionary word, sorted by hash.
+typedef struct DeleteIndex
+{
+    int maxDistance;
+    size_t entryCount;
+    DeleteEntry* entries;
+    uint32_t* directory;    // entries with top hash bits b are entries[directory[b]] .. entries[directory[b + 1] - 1]
+} DeleteIndex;
+
+typedef struct RankedSuggestion
+{
+    const char* word;
+    int distance;
+    uint32_t frequency;     // from the --freq file, 0 without one
+} RankedSuggestion;
+
+// Suggestions being collected for one word (see addSuggestion).
+typedef struct SuggestionCollector
+{
+    RankedSuggestion* items;    // a heap with the worst suggestion at the root when ranked
+    int count;
+    int capacity;
+    int limit;                  // keep at most this many, 0 for no limit
+    bool ranked;                // rank by compareSuggestions instead of keeping the order they are found in
+    bool copyWords;             // the words are only borrowed (a front-coded dictionary has no copies to point at),
+                                // so they are compared by their letters and copied out by finishSuggestions
+} SuggestionCollector;
+
+// Trie over the dictionary. Children are kept as sorted sibling lists, so a depth-first walk is alphabetical.
+typedef struct TrieNode
+{
+    uint32_t firstChild;
+    uint32_t nextSibling;
+    uint32_t wordOffset;    // arena offset of the word ending here, EMPTY_SLOT if none does
+    char letter;
+} TrieNode;
+
+typedef struct Trie
+{
+    TrieNode* nodes;        // nodes[0] is the root
+    uint32_t nodeCount;
+    uint32_t nodeCapacity;
+} Trie;
+
+// State of one bounded edit-distance walk over the trie: one Damerau-Levenshtein DP row per depth.
+typedef struct TrieSearch
+{
+    const char* query;
+    int queryLen;
+    int maxDistance;
+    int limit;                              // keep only the best `limit` words, 0 to keep all of them
+    bool ranksByFrequency;                  // the dictionary has a frequency table
+    RankedSuggestion* results;              // sorted by compareSuggestions
+    int count;
+    int capacity;
+    char path[TRIE_MAX_DEPTH + 1];          // path[d] is the letter of the node at depth d
+    int rows[TRIE_MAX_DEPTH + 1][MAX_WORD_LENGTH + 1];
+} TrieSearch;
+
+// How printSuggestions finds candidates: the original three checks, the deletion index, or the trie walk.
+typedef enum SuggestionMethod
+{
+    SUGGEST_CLASSIC,
+    SUGGEST_SYMSPELL,
+    SUGGEST_TRIE
+} SuggestionMethod;
+
+// Optional flags given after add|ignore.
+typedef struct CheckOptions
+{
+    SuggestionMethod method;    // --suggest=classic|symspell|trie
+    int maxDistance;            // --max-distance=N, for symspell and trie
+    int limit;                  // --top=N: print only the N best suggestions (0 prints all)
+    int threadCount;            // --threads=N: number of workers checking the input, 0 for one per CPU
+    const char* tokenizer;      // --tokenizer=auto|avx2|sse2|scalar
+    int bloomBitsPerWord;       // --bloom[=N]: put a Bloom filter with N bits per word in front of the table, 0 for none
+    bool printStats;            // --stats: print lookup counters and the hash table's health to stderr
+    const char* hashName;       // --hash=poly101|fnv1a|murmur3|wyhash
+    bool perfectHash;           // --mph: look words up through a minimal perfect hash, built with --threads threads
+    bool frontCoded;            // --front-coded: keep the dictionary as a sorted front-coded array (classic suggestions only)
+    bool useJournal;            // --journal[=path]: replay the journal of added words, and append to it in add mode
+    const char* journalFile;    // NULL for the dictionary path followed by JOURNAL_EXTENSION
+    const char* frequencyFile;  // --freq=path: word counts that rank the suggestions, NULL for none
+    const char* socketPath;     // --socket=path, for serve and client: NULL for the dictionary path followed by SOCKET_EXTENSION
+} CheckOptions;
+
+// Settings of "bench" mode that are not check options.
+typedef struct BenchmarkSettings
+{
+    size_t wordCount;           // --words=N: words in the generated corpus
+    int typoPercent;            // --typo-rate=P: percentage of them that get one typo
+    uint64_t seed;              // --seed=N: the same seed always generates the same corpus
+    bool json;                  // --json: print the results as one JSON object
+} BenchmarkSettings;
+
+// A word in the input: where it starts and how long it is. The input itself is never modified.
+typedef struct WordSpan
+{
+    const char* start;
+    size_t len;
+} WordSpan;
+
+// Reentrant tokenizer state (see nextWords).
+typedef struct Tokenizer
+{
+    const char* position;       // start of the next block to classify
+    const char* end;
+    const char* wordStart;      // start of a word that continues into the next block, NULL between words
+} Tokenizer;
+
+// Growable buffer the report is written into before it goes to stdout.
+typedef struct OutputBuffer
+{
+    char* data;
+    size_t size;
+    size_t capacity;
+} OutputBuffer;
+
+// A slot of the learned-word table. The word index is written last, with release order, so a reader that
+// sees it also sees the hash and the word's letters.
+typedef struct LearnedSlot
+{
+    uint32_t hash;
+    _Atomic uint32_t word;      // index of the word in its generation's offsets, EMPTY_SLOT while free
+} LearnedSlot;
+
+// One generation of the learned-word table. Its slots, offsets and arena never move or shrink; when it
+// fills up, the writer copies it into a generation twice the size and publishes that one instead.
+typedef struct LearnedGeneration
+{
+    uint32_t capacity;
+    uint32_t mask;
+    LearnedSlot* slots;
+    uint32_t* offsets;          // offsets[i] is the arena offset of the i-th word learned
+    uint32_t maxWords;          // half the slots, so probes stay short without moving entries
+    char* arena;
+    size_t arenaSize;
+    size_t arenaCapacity;
+    struct LearnedGeneration* retired;  // the generation this one replaced
+} LearnedGeneration;
+
+// Words learned in add mode, kept apart from the dictionary so that it is never written after loading.
+// One thread adds words while any number of threads read them without locks: slots only ever go from
+// free to full, and a full generation is replaced by publishing a copy with one atomic pointer store.
+// Retired generations are freed with the table, when no reader can still be inside them.
+typedef struct LearnedWords
+{
+    _Atomic(LearnedGeneration*) current;
+    _Atomic uint32_t count;     // words published so far, in the order they were learned
+} LearnedWords;
+
+// Append-only file of the words learned in add mode (--journal), one per line. Words are buffered and
+// written with one fdatasync per batch.
+typedef struct Journal
+{
+    int fd;
+    char* path;
+    OutputBuffer pending;       // words learned since the last sync, not written yet
+    uint32_t pendingWords;
+    uint32_t wordCount;         // words in the journal, written or pending
+    bool failed;                // a write failed; nothing more is written
+} Journal;
+
+// A misspelled word and its suggestion list, in the suggestion cache.
+typedef struct CachedSuggestions
+{
+    char* word;                 // NULL for an empty entry
+    uint32_t hash;
+    uint32_t learnedCount;      // learned words there were when the list was made
+    RankedSuggestion* suggestions;
+    int count;
+    bool referenced;            // used since the CLOCK hand last passed it
+} CachedSuggestions;
+
+// Per-thread cache of suggestion lists: SUGGESTION_CACHE_SETS sets of SUGGESTION_CACHE_WAYS entries,
+// each set with its own CLOCK hand.
+typedef struct SuggestionCache
+{
+    CachedSuggestions* entries;
+    uint8_t* hands;
+} SuggestionCache;
+
+// Each thread that reports misspellings keeps its own suggestion cache, so looking a typo up takes no lock.
+// In add mode, where nothing is cached, the thread keeps only the last list it found.
+static _Thread_local SuggestionCache* threadSuggestionCache = NULL;
+static _Thread_local RankedSuggestion* threadUncachedSuggestions = NULL;
+
+// Everything needed to check words: the dictionary, the suggestion engine and the options.
+typedef struct SpellChecker
+{
+    openHashTable* dictionary;
+    DeleteIndex* deleteIndex;   // only for --suggest=symspell
+    Trie* trie;                 // only for --suggest=trie
+    LearnedWords* learned;      // words learned in add mode, NULL outside it
+    CheckOptions options;
+    bool learnMisspellings;     // add mode
+    Journal* journal;           // --journal in add mode: learned words are also appended to it, NULL otherwise
+} SpellChecker;
+
+// A misspelling a worker found in parallel add mode, which still has to be confirmed in input order.
+typedef struct PendingMisspelling
+{
+    const char* word;
+    size_t len;
+    uint32_t learnedSeen;       // number of learned words its suggestions were computed with
+    size_t reportStart;         // its report is the chunk's output from reportStart to reportEnd
+    size_t reportEnd;
+} PendingMisspelling;
+
+// A piece of the input that is checked as a unit, with the report for its misspelled words.
+typedef struct CheckChunk
+{
+    const char* start;
+    const char* end;
+    OutputBuffer output;
+    bool foundTypo;
+    bool done;
+
+    // Parallel add mode: the chunk is checked before the chunks in front of it have learned their
+    // misspellings, so its misspellings are only candidates until settleChunk confirms them.
+    bool speculative;
+    PendingMisspelling* pending;
+    size_t pendingCount;
+    size_t pendingCapacity;
+    openHashTable* pendingWords;    // the pending words, each recorded once
+} CheckChunk;
+
+// State shared by the worker threads of a parallel check.
+typedef struct ParallelCheck
+{
+    SpellChecker* checker;
+    CheckChunk* chunks;
+    size_t chunkCount;
+    size_t nextChunk;           // next chunk a worker will take
+    size_t nextToWrite;         // next chunk the main thread will write
+    size_t window;              // how far ahead of nextToWrite the workers may go
+    pthread_mutex_t lock;
+    pthread_cond_t chunkDone;
+    pthread_cond_t chunkWritten;
+} ParallelCheck;
+
+// Header of every message between "serve" and "client", in host byte order (the socket is local).
+// A request's type is a RequestType, a response's a ResponseStatus; payloadLength bytes follow the header.
+typedef struct MessageHeader
+{
+    uint32_t payloadLength;
+    uint8_t type;
+    uint8_t flags;              // REQUEST_LEARN
+    uint16_t reserved;
+    uint32_t wordCount;
+} MessageHeader;
+
+_Static_assert(sizeof(MessageHeader) == 12, "message header must have no padding");
+
+// What a request asks for each of its words. Request payload: per word, a uint16 length and the letters.
+// Response payload: per word, one byte that is 1 if the word is misspelled; for REQUEST_SUGGEST a misspelled
+// word is followed by a uint16 suggestion count and the suggestions, each as a uint16 length and the letters.
+typedef enum RequestType
+{
+    REQUEST_CHECK = 1,
+    REQUEST_SUGGEST = 2
+} RequestType;
+
+typedef enum ResponseStatus
+{
+    RESPONSE_OK = 0,
+    RESPONSE_BAD_REQUEST = 1
+} ResponseStatus;
+
+// One client of the server. The session shares the server's dictionary and suggestion engine but has
+// its own learned words, so add mode on one connection never changes the answers another one gets.
+typedef struct ServerConnection
+{
+    int fd;
+    SpellChecker session;
+} ServerConnection;
+
+// Words the client has sent in one request and not yet printed the answer for.
+typedef struct ClientBatch
+{
+    WordSpan spans[CLIENT_BATCH_WORDS];
+    size_t count;
+} ClientBatch;
+
+// State shared by the client's sending thread and its receiving thread.
+typedef struct ClientPipeline
+{
+    int fd;
+    ClientBatch* batches;       // ring of CLIENT_REQUESTS_IN_FLIGHT batches; batch i is batches[i % CLIENT_REQUESTS_IN_FLIGHT]
+    size_t sent;
+    size_t received;
+    bool sendingDone;
+    bool failed;
+    bool foundTypo;
+    pthread_mutex_t lock;
+    pthread_cond_t batchSent;
+    pthread_cond_t batchReceived;
+} ClientPipeline;
+
+
+// Legacy polynomial hash: the ASCII value of each character, multiplied by 101 (a prime number) after each one.
+// The table masks the hash with a power of two, so the last few lines mix the high bits into the low ones.
+uint32_t hashPoly101(const char *word, size_t len) {
+    uint32_t total = 0;
+    for (size_t i = 0; i < len; i++) {
+        total = total + (unsigned char)word[i];
+        total = total * 101;                        // Multiply the total by 101 (a prime number)
+    }
+    total ^= total >> 16;
+    total *= 0x85ebca6b;
+    total ^= total >> 13;
+    total *= 0xc2b2ae35;
+    total ^= total >> 16;
+    return total;
+}
+
+// 32-bit FNV-1a, one byte at a time. Its low bits only depend on the low bits of the letters.
+uint32_t hashFNV1a(const char *word, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)word[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline uint32_t rotateLeft32(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// 32-bit MurmurHash3 (seed 0), four bytes at a time.
+uint32_t hashMurmur3(const char *word, size_t len)
+{
+    const unsigned char* bytes = (const unsigned char*)word;
+    uint32_t hash = 0;
+    size_t blocks = len / 4;
+
+    for (size_t i = 0; i < blocks; i++)
+    {
+        uint32_t k;
+        memcpy(&k, bytes + i * 4, 4);
+        k *= 0xcc9e2d51;
+        k = rotateLeft32(k, 15);
+        k *= 0x1b873593;
+        hash ^= k;
+        hash = rotateLeft32(hash, 13);
+        hash = hash * 5 + 0xe6546b64;
+    }
+
+    const unsigned char* tail = bytes + blocks * 4;
+    uint32_t k = 0;
+    switch (len & 3)
+    {
+        case 3:
+            k ^= tail[2] << 16;
+            // fall through
+        case 2:
+            k ^= tail[1] << 8;
+            // fall through
+        case 1:
+            k ^= tail[0];
+            k *= 0xcc9e2d51;
+            k = rotateLeft32(k, 15);
+            k *= 0x1b873593;
+            hash ^= k;
+    }
+
+    hash ^= (uint32_t)len;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// Function to multiply two 64-bit numbers and fold the 128-bit product into 64 bits (wyhash's mixing step).
+static inline uint64_t wyMix(uint64_t a, uint64_t b)
+{
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t wyRead8(const unsigned char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+static inline uint64_t wyRead4(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+// wyhash (final version 4, seed 0, default secret), folded to 32 bits. Words of up to 16 bytes, which
+// is nearly all of them, are read as two overlapping pairs of 4-byte loads and mixed by one multiply.
+uint32_t hashWyhash(const char *word, size_t len)
+{
+    static const uint64_t secret[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+    };
+    const unsigned char* p = (const unsigned char*)word;
+    uint64_t seed = wyMix(secret[0], secret[1]);
+    uint64_t a, b;
+
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            size_t middle = (len >> 3) << 2;
+            a = (wyRead4(p) << 32) | wyRead4(p + middle);
+            b = (wyRead4(p + len - 4) << 32) | wyRead4(p + len - 4 - middle);
+        } else if (len > 0)
+        {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else
+        {
+            a = b = 0;
+        }
+    } else
+    {
+        size_t remaining = len;
+        if (remaining > 48)
+        {
+            uint64_t seed1 = seed, seed2 = seed;
+            do
+            {
+                seed = wyMix(wyRead8(p) ^ secret[1], wyRead8(p + 8) ^ seed);
+                seed1 = wyMix(wyRead8(p + 16) ^ secret[2], wyRead8(p + 24) ^ seed1);
+                seed2 = wyMix(wyRead8(p + 32) ^ secret[3], wyRead8(p + 40) ^ seed2);
+                p += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (remaining > 16)
+        {
+            seed = wyMix(wyRead8(p) ^ secret[1], wyRead8(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        a = wyRead8(p + remaining - 16);
+        b = wyRead8(p + remaining - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    __uint128_t product = (__uint128_t)a * b;
+    a = (uint64_t)product;
+    b = (uint64_t)(product >> 64);
+    uint64_t hash = wyMix(a ^ secret[0] ^ len, b ^ secret[1]);
+    return (uint32_t)hash ^ (uint32_t)(hash >> 32);
+}
+
+// The hash functions --hash can pick. A snapshot records the id of the one that placed its slots, so an id
+// must never be reused, and a function that changes needs a new one.
+static const HashFunction hashFunctions[] = {
+    { "poly101", 1, hashPoly101 },
+    { "fnv1a", 2, hashFNV1a },
+    { "murmur3", 3, hashMurmur3 },
+    { "wyhash", 4, hashWyhash },
+};
+
+// Hash function of every table, picked once by selectHashFunction before anything is hashed.
+static const HashFunction* activeHash = &hashFunctions[0];
+
+// Function to pick the hash function by name. Returns false if there is none with that name.
+bool selectHashFunction(const char* name)
+{
+    for (size_t i = 0; i < sizeof(hashFunctions) / sizeof(hashFunctions[0]); i++)
+    {
+        if (strcmp(hashFunctions[i].name, name) == 0)
+        {
+            activeHash = &hashFunctions[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hash function to compute hash value for a given word, with the selected hash function.
+static inline uint32_t hashFunction(const char *word, size_t len)
+{
+    return activeHash->function(word, len);
+}
+
+// How far a slot is from the slot its hash wants to be in.
+static inline uint32_t probeDistance(openHashTable* hashTable, uint32_t hash, uint32_t slotIndex)
+{
+    return (slotIndex - (hash & hashTable->mask)) & hashTable->mask;
+}
+
+// Function to allocate a slot array with every slot empty.
+Slot* allocateSlots(uint32_t capacity)
+{
+    Slot* slots = malloc(sizeof(Slot) * capacity);
+    memset(slots, 0xFF, sizeof(Slot) * capacity);
+
+    return slots;
+}
+
+// Function to create an empty hash table big enough to hold expectedWords words without growing.
+openHashTable* createHashTable(size_t expectedWords)
+{
+    uint32_t capacity = 16;
+    while ((size_t)capacity * MAX_LOAD_NUMERATOR < expectedWords * MAX_LOAD_DENOMINATOR)
+    {
+        capacity *= 2;
+    }
+
+    openHashTable* hashTable = malloc(sizeof(openHashTable));
+    hashTable->capacity = capacity;
+    hashTable->mask = capacity - 1;
+    hashTable->count = 0;
+    hashTable->slots = allocateSlots(capacity);
+
+    hashTable->arenaCapacity = 1 << 16;
+    hashTable->arena = malloc(hashTable->arenaCapacity);
+    hashTable->arenaSize = 0;
+    hashTable->arenaIsMapped = false;
+    hashTable->slotsAreMapped = false;
+    hashTable->mapping = NULL;
+    hashTable->mappingLength = 0;
+    hashTable->bloom = NULL;
+    hashTable->frequencies = NULL;
+    hashTable->perfect = NULL;
+    hashTable->frontCoded = NULL;
+
+    return hashTable;
+}
+
+// Function to unmap the dictionary file or snapshot once neither the slots nor the arena point into it.
+void releaseUnusedMapping(openHashTable* hashTable)
+{
+    if (hashTable->mapping != NULL && !hashTable->arenaIsMapped && !hashTable->slotsAreMapped
+        && (hashTable->perfect == NULL || !hashTable->perfect->isMapped))
+    {
+        munmap(hashTable->mapping, hashTable->mappingLength);
+        hashTable->mapping = NULL;
+    }
+}
+
+// Function to copy a word to the end of the arena. Returns the word's offset.
+uint32_t appendToArena(openHashTable* hashTable, const char* word, size_t len)
+{
+    if (hashTable->arenaSize + len + 1 > hashTable->arenaCapacity)
+    {
+        while (hashTable->arenaSize + len + 1 > hashTable->arenaCapacity)
+        {
+            hashTable->arenaCapacity *= 2;
+        }
+
+        if (hashTable->arenaIsMapped)
+        {
+            // The mapped file cannot grow, so the first word added after loading moves the arena to the heap.
+            char* heapArena = malloc(hashTable->arenaCapacity);
+            memcpy(heapArena, hashTable->arena, hashTable->arenaSize);
+            hashTable->arena = heapArena;
+            hashTable->arenaIsMapped = false;
+            releaseUnusedMapping(hashTable);
+        } else
+        {
+            hashTable->arena = realloc(hashTable->arena, hashTable->arenaCapacity);
+        }
+    }
+
+    uint32_t offset = (uint32_t)hashTable->arenaSize;
+    memcpy(hashTable->arena + offset, word, len);
+    hashTable->arena[offset + len] = '\0';
+    hashTable->arenaSize += len + 1;
+
+    return offset;
+}
+
+// Function to place a slot that is known not to be in the table yet, starting the probe at slotIndex.
+// Robin Hood rule: whoever is further from home keeps the slot, the other one moves on.
+void placeSlot(openHashTable* hashTable, Slot slot, uint32_t slotIndex)
+{
+    uint32_t distance = probeDistance(hashTable, slot.hash, slotIndex);
+
+    while (hashTable->slots[slotIndex].offset != EMPTY_SLOT)
+    {
+        uint32_t residentDistance = probeDistance(hashTable, hashTable->slots[slotIndex].hash, slotIndex);
+        if (residentDistance < distance)
+        {
+            Slot temp = hashTable->slots[slotIndex];
+            hashTable->slots[slotIndex] = slot;
+            slot = temp;
+            distance = residentDistance;
+        }
+        slotIndex = (slotIndex + 1) & hashTable->mask;
+        distance++;
+    }
+
+    hashTable->slots[slotIndex] = slot;
+}
+
+// Function to double the number of slots. The arena is untouched, only the slots are re-placed.
+void growHashTable(openHashTable* hashTable)
+{
+    Slot* oldSlots = hashTable->slots;
+    uint32_t oldCapacity = hashTable->capacity;
+
+    hashTable->capacity *= 2;
+    hashTable->mask = hashTable->capacity - 1;
+    hashTable->slots = allocateSlots(hashTable->capacity);
+
+    for (uint32_t i = 0; i < oldCapacity; i++)
+    {
+        if (oldSlots[i].offset != EMPTY_SLOT)
+        {
+            placeSlot(hashTable, oldSlots[i], oldSlots[i].hash & hashTable->mask);
+        }
+    }
+
+    if (hashTable->slotsAreMapped)
+    {
+        hashTable->slotsAreMapped = false;
+        releaseUnusedMapping(hashTable);
+    } else
+    {
+        free(oldSlots);
+    }
+}
+
+// Function to print Hash Table for debugging purpose.
+void printHashTable(openHashTable* hashTable) 
+{
+    for (uint32_t i = 0; i < hashTable->capacity; i++) 
+    {
+        Slot slot = hashTable->slots[i];
+
+        if (slot.offset != EMPTY_SLOT)
+        {
+            printf("Slot %u: %s (hash %08x, probe distance %u)\n", i, hashTable->arena + slot.offset, slot.hash, probeDistance(hashTable, slot.hash, i));
+        } else 
+        {
+            printf("Slot %u: EMPTY\n", i);
+        }
+    }
+}
+
+// Function to print how well the hash spreads the words over the table (--stats), to stderr: the load factor,
+// the number of empty slots, a histogram of probe distances and the probes a lookup needs on average.
+// A hit probes from its home slot to the word; a miss probes until Robin Hood lets it stop, which is
+// counted for a miss starting at each slot in turn.
+void printHashTableHealth(openHashTable* hashTable)
+{
+    // A front-coded dictionary has no slots left to look at, only its size.
+    FrontCodedDictionary* frontCoded = hashTable->frontCoded;
+    if (frontCoded != NULL)
+    {
+        size_t size = frontCoded->dataSize + (sizeof(uint32_t) + sizeof(uint64_t)) * (frontCoded->bucketCount + 1);
+        fprintf(stderr, "Front-coded dictionary: %u words in %u buckets, %.1f KiB (%.2f bytes per word)\n",
+                frontCoded->count, frontCoded->bucketCount, size / 1024.0, frontCoded->count ? (double)size / frontCoded->count : 0.0);
+        return;
+    }
+
+    uint64_t histogram[HEALTH_HISTOGRAM_BUCKETS] = { 0 };
+    uint64_t hitProbes = 0;
+    uint64_t missProbes = 0;
+    uint32_t longestProbe = 0;
+    uint32_t emptySlots = 0;
+
+    for (uint32_t i = 0; i < hashTable->capacity; i++)
+    {
+        Slot slot = hashTable->slots[i];
+        if (slot.offset == EMPTY_SLOT)
+        {
+            emptySlots++;
+        } else
+        {
+            uint32_t distance = probeDistance(hashTable, slot.hash, i);
+            histogram[distance < HEALTH_HISTOGRAM_BUCKETS - 1 ? distance : HEALTH_HISTOGRAM_BUCKETS - 1]++;
+            hitProbes += distance + 1;
+            if (distance > longestProbe)
+            {
+                longestProbe = distance;
+            }
+        }
+
+        // Same stopping rule as findHashedSlot, for a word whose home slot is i.
+        uint32_t distance = 0;
+        uint32_t slotIndex = i;
+        while (hashTable->slots[slotIndex].offset != EMPTY_SLOT
+               && probeDistance(hashTable, hashTable->slots[slotIndex].hash, slotIndex) >= distance)
+        {
+            distance++;
+            slotIndex = (slotIndex + 1) & hashTable->mask;
+        }
+        missProbes += distance + 1;
+    }
+
+    fprintf(stderr, "Hash table: %u words in %u slots, hash %s, load factor %.3f\n",
+            hashTable->count, hashTable->capacity, activeHash->name, (double)hashTable->count / hashTable->capacity);
+    fprintf(stderr, "  empty slots: %u (%.1f%%)\n", emptySlots, 100.0 * emptySlots / hashTable->capacity);
+    fprintf(stderr, "  longest probe distance: %u\n", longestProbe);
+    fprintf(stderr, "  average probes per hit: %.3f, per miss: %.3f\n",
+            hashTable->count ? (double)hitProbes / hashTable->count : 0.0, (double)missProbes / hashTable->capacity);
+    fprintf(stderr, "  probe distance histogram:\n");
+    for (int d = 0; d < HEALTH_HISTOGRAM_BUCKETS && d <= (int)longestProbe; d++)
+    {
+        if (histogram[d] == 0)
+        {
+            continue;
+        }
+        fprintf(stderr, "    %3d%s %10llu (%5.2f%%)\n", d, d == HEALTH_HISTOGRAM_BUCKETS - 1 ? "+" : " ",
+                (unsigned long long)histogram[d], 100.0 * histogram[d] / hashTable->count);
+    }
+
+    PerfectHash* perfect = hashTable->perfect;
+    if (perfect != NULL)
+    {
+        fprintf(stderr, "Perfect hash: %u levels, %.2f bits per word (%.2f with ranks), %u words in the fallback table, %.1f KiB\n",
+                perfect->image->levelCount, (double)MPH_BLOCK_BITS * perfect->image->blockCount / hashTable->count,
+                512.0 * perfect->image->blockCount / hashTable->count, hashTable->count - perfect->image->entryCount,
+                perfect->imageSize / 1024.0);
+    }
+}
+
+// Orders arena offsets by the words they point to (qsort_r would need a context argument).
+static const char* sortingArena;
+int compareArenaWords(const void* a, const void* b)
+{
+    return strcmp(sortingArena + *(const uint32_t*)a, sortingArena + *(const uint32_t*)b);
+}
+
+// Function to read a varint (7 bits per byte, low bits first) and move past it.
+static inline uint32_t readVarint(const char** position)
+{
+    uint32_t value = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        uint8_t byte = (uint8_t)*(*position)++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (byte < 0x80)
+        {
+            return value;
+        }
+    }
+}
+
+// Function to write a varint. Returns the number of bytes written (at most 5).
+size_t writeVarint(char* destination, uint32_t value)
+{
+    size_t size = 0;
+    while (value >= 0x80)
+    {
+        destination[size++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    destination[size++] = (char)value;
+    return size;
+}
+
+// Function to compare a word of len letters (not NUL-terminated) with a stored, NUL-terminated word, like strcmp.
+static inline int compareWithStoredWord(const char* word, size_t len, const char* stored)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (stored[i] != word[i])
+        {
+            return (unsigned char)word[i] - (unsigned char)stored[i];
+        }
+    }
+    return stored[len] == '\0' ? 0 : -1;
+}
+
+// Function to find the first word of a bucket of a front-coded dictionary.
+static inline const char* frontCodedBucketHead(const FrontCodedDictionary* dictionary, uint32_t bucket)
+{
+    return dictionary->data + dictionary->buckets[bucket];
+}
+
+// Function to pack the first 8 letters of a word (padded with zeros) into a number that sorts like the words do.
+static inline uint64_t frontCodedKey(const char* word, size_t len)
+{
+    uint64_t key = 0;
+    for (size_t i = 0; i < 8; i++)
+    {
+        key = (key << 8) | (i < len ? (uint8_t)word[i] : 0);
+    }
+    return key;
+}
+
+// Function to compare a word of len letters, whose key is wordKey, with the first word of a bucket, like strcmp.
+// Only words that agree on their first 8 letters are compared letter by letter.
+static inline int compareWithBucketHead(const FrontCodedDictionary* dictionary, const char* word, size_t len, uint64_t wordKey, uint32_t bucket)
+{
+    uint64_t headKey = dictionary->headKeys[bucket];
+    if (headKey != wordKey)
+    {
+        return wordKey < headKey ? -1 : 1;
+    }
+    return compareWithStoredWord(word, len, frontCodedBucketHead(dictionary, bucket));
+}
+
+// Function to build a front-coded copy of every word in the hash table.
+FrontCodedDictionary* buildFrontCodedDictionary(openHashTable* hashTable)
+{
+    uint32_t* offsets = malloc(sizeof(uint32_t) * (hashTable->count + 1));
+    uint32_t wordCount = 0;
+    size_t maxSize = 0;
+    for (uint32_t i = 0; i < hashTable->capacity; i++)
+    {
+        if (hashTable->slots[i].offset != EMPTY_SLOT)
+        {
+            offsets[wordCount++] = hashTable->slots[i].offset;
+            maxSize += strlen(hashTable->arena + hashTable->slots[i].offset) + 6;   // a varint is at most 5 bytes
+        }
+    }
+    sortingArena = hashTable->arena;
+    qsort(offsets, wordCount, sizeof(uint32_t), compareArenaWords);
+
+    FrontCodedDictionary* dictionary = malloc(sizeof(FrontCodedDictionary));
+    dictionary->count = wordCount;
+    dictionary->bucketCount = (wordCount + FRONT_CODED_BUCKET_WORDS - 1) / FRONT_CODED_BUCKET_WORDS;
+    dictionary->buckets = malloc(sizeof(uint32_t) * (dictionary->bucketCount + 1));
+    dictionary->headKeys = malloc(sizeof(uint64_t) * (dictionary->bucketCount + 1));
+    dictionary->data = malloc(maxSize + 1);
+
+    size_t size = 0;
+    const char* previous = "";
+    for (uint32_t w = 0; w < wordCount; w++)
+    {
+        const char* word = hashTable->arena + offsets[w];
+        size_t shared = 0;
+        if (w % FRONT_CODED_BUCKET_WORDS == 0)
+        {
+            dictionary->buckets[w / FRONT_CODED_BUCKET_WORDS] = (uint32_t)size;
+            dictionary->headKeys[w / FRONT_CODED_BUCKET_WORDS] = frontCodedKey(word, strlen(word));
+        } else
+        {
+            while (word[shared] != '\0' && word[shared] == previous[shared])
+            {
+                shared++;
+            }
+            size += writeVarint(dictionary->data + size, (uint32_t)shared);
+        }
+        size_t rest = strlen(word + shared) + 1;
+        memcpy(dictionary->data + size, word + shared, rest);
+        size += rest;
+        previous = word;
+    }
+    dictionary->buckets[dictionary->bucketCount] = (uint32_t)size;
+    dictionary->dataSize = size;
+    dictionary->data = realloc(dictionary->data, size + 1);
+
+    free(offsets);
+    return dictionary;
+}
+
+// Function to find a word in a front-coded dictionary. A binary search over the first words of the buckets
+// picks the only bucket that can hold it, and the bucket is read in order without decoding any word: it is
+// enough to know how many letters the word shares with the last word read. Returns the word's rank, or
+// EMPTY_SLOT if it is not there.
+uint32_t findFrontCodedSlot(const FrontCodedDictionary* dictionary, const char* word, size_t len)
+{
+    if (dictionary->count == 0)
+    {
+        return EMPTY_SLOT;
+    }
+
+    uint64_t key = frontCodedKey(word, len);
+    uint32_t low = 0;
+    uint32_t high = dictionary->bucketCount;
+    while (high - low > 1)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (compareWithBucketHead(dictionary, word, len, key, middle) >= 0)
+        {
+            low = middle;
+        } else
+        {
+            high = middle;
+        }
+    }
+
+    const char* head = frontCodedBucketHead(dictionary, low);
+    int order = compareWithStoredWord(word, len, head);
+    if (order <= 0)
+    {
+        return order == 0 ? low * FRONT_CODED_BUCKET_WORDS : EMPTY_SLOT;
+    }
+
+    // matched is the number of letters the word shares with the last word read, which sorts before it.
+    size_t matched = 0;
+    while (matched < len && head[matched] == word[matched])
+    {
+        matched++;
+    }
+    const char* position = head + strlen(head) + 1;
+    uint32_t first = low * FRONT_CODED_BUCKET_WORDS;
+    uint32_t last = dictionary->count - first < FRONT_CODED_BUCKET_WORDS ? dictionary->count : first + FRONT_CODED_BUCKET_WORDS;
+
+    for (uint32_t rank = first + 1; rank < last; rank++)
+    {
+        size_t shared = readVarint(&position);
+        const char* rest = position;
+
+        // Sharing fewer letters with the last word than the word does puts this one after the word;
+        // sharing more puts it before, like the last word.
+        if (shared < matched)
+        {
+            return EMPTY_SLOT;
+        }
+        if (shared == matched)
+        {
+            size_t same = 0;
+            while (rest[same] != '\0' && matched + same < len && rest[same] == word[matched + same])
+            {
+                same++;
+            }
+            if (rest[same] == '\0' && matched + same == len)
+            {
+                return rank;
+            }
+            if (rest[same] != '\0' && (matched + same == len || (unsigned char)rest[same] > (unsigned char)word[matched + same]))
+            {
+                return EMPTY_SLOT;
+            }
+            matched += same;
+        }
+        position = rest + strlen(rest) + 1;
+    }
+    return EMPTY_SLOT;
+}
+
+// Function to decode the next word of an iterator. Returns false at the end of the dictionary.
+bool decodeFrontCodedWord(FrontCodedIterator* iterator)
+{
+    const FrontCodedDictionary* dictionary = iterator->dictionary;
+    uint32_t rank = iterator->rank + 1;
+    if (rank >= dictionary->count)
+    {
+        return false;
+    }
+
+    size_t shared = rank % FRONT_CODED_BUCKET_WORDS == 0 ? 0 : readVarint(&iterator->position);
+    size_t rest = strlen(iterator->position) + 1;
+    if (shared + rest > iterator->wordCapacity)
+    {
+        iterator->wordCapacity = (shared + rest) * 2;
+        iterator->word = realloc(iterator->word, iterator->wordCapacity);
+    }
+    memcpy(iterator->word + shared, iterator->position, rest);
+    iterator->position += rest;
+    iterator->rank = rank;
+    return true;
+}
+
+// Function to start an iterator at the word of the given rank, which must be in the dictionary.
+// Returns the word, which stays valid until the iterator moves.
+const char* seekFrontCodedRank(FrontCodedIterator* iterator, uint32_t rank)
+{
+    uint32_t bucket = rank / FRONT_CODED_BUCKET_WORDS;
+    iterator->rank = bucket * FRONT_CODED_BUCKET_WORDS - 1;
+    iterator->position = frontCodedBucketHead(iterator->dictionary, bucket);
+    while (iterator->rank + 1 <= rank)
+    {
+        decodeFrontCodedWord(iterator);
+    }
+    return iterator->word;
+}
+
+// Function to start an iterator over the words that start with the prefix (every word for an empty prefix).
+void initFrontCodedIterator(FrontCodedIterator* iterator, const FrontCodedDictionary* dictionary, const char* prefix, size_t prefixLen)
+{
+    iterator->dictionary = dictionary;
+    iterator->prefix = prefix;
+    iterator->prefixLen = prefixLen;
+    iterator->wordCapacity = MAX_WORD_LENGTH + 2;
+    iterator->word = malloc(iterator->wordCapacity);
+    iterator->advance = false;
+    iterator->done = dictionary->count == 0;
+    if (iterator->done)
+    {
+        return;
+    }
+
+    // Start from the last bucket whose first word sorts before the prefix, and skip to the first word that does not.
+    uint64_t key = frontCodedKey(prefix, prefixLen);
+    uint32_t low = 0;
+    uint32_t high = dictionary->bucketCount;
+    while (high - low > 1)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (compareWithBucketHead(dictionary, prefix, prefixLen, key, middle) > 0)
+        {
+            low = middle;
+        } else
+        {
+            high = middle;
+        }
+    }
+    iterator->rank = low * FRONT_CODED_BUCKET_WORDS - 1;
+    iterator->position = frontCodedBucketHead(dictionary, low);
+    do
+    {
+        if (!decodeFrontCodedWord(iterator))
+        {
+            iterator->done = true;
+            return;
+        }
+    } while (compareWithStoredWord(prefix, prefixLen, iterator->word) > 0);
+}
+
+// Function to get the next word of an iterator, in sorted order. Returns NULL once the words with the
+// prefix are used up. The word stays valid until the next call.
+const char* nextFrontCodedWord(FrontCodedIterator* iterator)
+{
+    if (iterator->done || (iterator->advance && !decodeFrontCodedWord(iterator))
+        || strncmp(iterator->word, iterator->prefix, iterator->prefixLen) != 0)
+    {
+        iterator->done = true;
+        return NULL;
+    }
+    iterator->advance = true;
+    return iterator->word;
+}
+
+// Function to free what an iterator allocated.
+void freeFrontCodedIterator(FrontCodedIterator* iterator)
+{
+    free(iterator->word);
+}
+
+// Function to free a front-coded dictionary.
+void freeFrontCodedDictionary(FrontCodedDictionary* dictionary)
+{
+    free(dictionary->buckets);
+    free(dictionary->headKeys);
+    free(dictionary->data);
+    free(dictionary);
+}
+
+// Function to compute the eight bits a hash sets in a Bloom filter block, one in each 32-bit word.
+static inline void bloomBlockMask(uint32_t hash, uint32_t mask[BLOOM_WORDS_PER_BLOCK])
+{
+    static const uint32_t salts[BLOOM_WORDS_PER_BLOCK] = {
+        0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du, 0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+    };
+    for (int i = 0; i < BLOOM_WORDS_PER_BLOCK; i++)
+    {
+        mask[i] = 1u << ((hash * salts[i]) >> 27);
+    }
+}
+
+// Function to pick the Bloom filter block of a hash. The block comes from the high bits of a remix of
+// the hash, so it does not follow the hash's low bits the way the table's slot index does.
+static inline uint32_t bloomBlockIndex(BloomFilter* bloom, uint32_t hash)
+{
+    uint32_t remixed = (uint32_t)(((uint64_t)hash * 0x9E3779B97F4A7C15ull) >> 32);
+    return (uint32_t)(((uint64_t)remixed * bloom->blockCount) >> 32);
+}
+
+// Function to add a word (by its hash) to the Bloom filter.
+void bloomAdd(BloomFilter* bloom, uint32_t hash)
+{
+    uint32_t mask[BLOOM_WORDS_PER_BLOCK];
+    bloomBlockMask(hash, mask);
+
+    uint32_t* block = bloom->blocks + (size_t)bloomBlockIndex(bloom, hash) * BLOOM_WORDS_PER_BLOCK;
+    for (int i = 0; i < BLOOM_WORDS_PER_BLOCK; i++)
+    {
+        block[i] |= mask[i];
+    }
+}
+
+// Function to test whether a word (by its hash) may be in the filter. False means it is definitely not.
+// All eight bits are in one 32-byte block, so the test touches a single cache line.
+static inline bool bloomMayContain(BloomFilter* bloom, uint32_t hash)
+{
+    uint32_t mask[BLOOM_WORDS_PER_BLOCK];
+    bloomBlockMask(hash, mask);
+
+    const uint32_t* block = bloom->blocks + (size_t)bloomBlockIndex(bloom, hash) * BLOOM_WORDS_PER_BLOCK;
+    uint32_t missing = 0;
+    for (int i = 0; i < BLOOM_WORDS_PER_BLOCK; i++)
+    {
+        missing |= mask[i] & ~block[i];
+    }
+    return missing == 0;
+}
+
+// Function to build a Bloom filter over every word in the hash table with about bitsPerWord bits per word.
+// The slots already store each word's hash, so nothing is rehashed, except in a front-coded dictionary,
+// which keeps no hashes. Words inserted later are added by insertArenaWord.
+void buildBloomFilter(openHashTable* hashTable, int bitsPerWord)
+{
+    BloomFilter* bloom = malloc(sizeof(BloomFilter));
+    bloom->bitsPerWord = bitsPerWord;
+    bloom->blockCount = (uint32_t)(((uint64_t)hashTable->count * bitsPerWord + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS);
+    if (bloom->blockCount == 0)
+    {
+        bloom->blockCount = 1;
+    }
+
+    size_t size = (size_t)bloom->blockCount * BLOOM_WORDS_PER_BLOCK * sizeof(uint32_t);
+    bloom->blocks = aligned_alloc(BLOOM_BLOCK_BITS / 8, size);
+    memset(bloom->blocks, 0, size);
+
+    if (hashTable->frontCoded != NULL)
+    {
+        FrontCodedIterator iterator;
+        initFrontCodedIterator(&iterator, hashTable->frontCoded, "", 0);
+        for (const char* word = nextFrontCodedWord(&iterator); word != NULL; word = nextFrontCodedWord(&iterator))
+        {
+            bloomAdd(bloom, hashFunction(word, strlen(word)));
+        }
+        freeFrontCodedIterator(&iterator);
+    } else
+    {
+        for (uint32_t i = 0; i < hashTable->capacity; i++)
+        {
+            if (hashTable->slots[i].offset != EMPTY_SLOT)
+            {
+                bloomAdd(bloom, hashTable->slots[i].hash);
+            }
+        }
+    }
+
+    hashTable->bloom = bloom;
+}
+
+// Function to add the calling thread's lookup counters to the totals. Every thread that looked words up
+// calls it once when it is done, so the hot path only ever touches thread-local counters.
+void mergeLookupStats()
+{
+    pthread_mutex_lock(&totalLookupStatsLock);
+    totalLookupStats.lookups += threadLookupStats.lookups;
+    totalLookupStats.hits += threadLookupStats.hits;
+    totalLookupStats.bloomRejected += threadLookupStats.bloomRejected;
+    totalLookupStats.bloomFalsePositives += threadLookupStats.bloomFalsePositives;
+    totalLookupStats.cacheHits += threadLookupStats.cacheHits;
+    totalLookupStats.cacheMisses += threadLookupStats.cacheMisses;
+    pthread_mutex_unlock(&totalLookupStatsLock);
+
+    memset(&threadLookupStats, 0, sizeof(LookupStats));
+}
+
+// Function to print the lookup counters (--stats) to stderr, so they never mix with the report.
+void printLookupStats(openHashTable* hashTable)
+{
+    LookupStats* stats = &totalLookupStats;
+    uint64_t misses = stats->lookups - stats->hits;
+
+    printHashTableHealth(hashTable);
+
+    fprintf(stderr, "Lookups: %llu (%llu hits, %llu misses)\n",
+            (unsigned long long)stats->lookups, (unsigned long long)stats->hits, (unsigned long long)misses);
+
+    BloomFilter* bloom = hashTable->bloom;
+    if (bloom != NULL)
+    {
+        // Every miss either was rejected by the filter or got past it as a false positive.
+        fprintf(stderr, "Bloom filter: %u blocks, %.1f KiB, %d bits per word\n",
+                bloom->blockCount, bloom->blockCount * (BLOOM_BLOCK_BITS / 8) / 1024.0, bloom->bitsPerWord);
+        fprintf(stderr, "  probes saved: %llu (%.2f%% of lookups)\n",
+                (unsigned long long)stats->bloomRejected, stats->lookups ? 100.0 * stats->bloomRejected / stats->lookups : 0.0);
+        fprintf(stderr, "  false positive rate: %.3f%% (%llu of %llu misses got past the filter)\n",
+                misses ? 100.0 * stats->bloomFalsePositives / misses : 0.0,
+                (unsigned long long)stats->bloomFalsePositives, (unsigned long long)misses);
+    }
+
+    uint64_t cacheLookups = stats->cacheHits + stats->cacheMisses;
+    if (cacheLookups > 0)
+    {
+        fprintf(stderr, "Suggestion cache: %llu hits, %llu misses (%.2f%% hit rate)\n",
+                (unsigned long long)stats->cacheHits, (unsigned long long)stats->cacheMisses, 100.0 * stats->cacheHits / cacheLookups);
+    }
+}
+
+// Function to find a word's bit in one level of the minimal perfect hash. Each level remixes the word's
+// hash with its own constant, so words that collide in one level are spread differently in the next.
+// A miss walks several levels, so the remix is kept to two multiplies.
+static inline uint64_t perfectHashPosition(const PerfectHashImage* image, uint32_t level, uint32_t hash)
+{
+    uint64_t mixed = (hash ^ ((level + 1) * 0x9E3779B97F4A7C15ull)) * 0xbf58476d1ce4e5b9ull;
+    mixed ^= mixed >> 32;
+    mixed *= 0x94d049bb133111ebull;
+    return image->levelStart[level] * MPH_BLOCK_BITS + (uint64_t)(((__uint128_t)mixed * image->levelBits[level]) >> 64);
+}
+
+// Function to find the 64-bit word that holds a bit of the minimal perfect hash.
+static inline uint64_t* perfectHashBitWord(uint64_t* blocks, uint64_t position)
+{
+    return blocks + (position / MPH_BLOCK_BITS) * MPH_BLOCK_WORDS + 1 + (position % MPH_BLOCK_BITS) / 64;
+}
+
+// Function to count the set bits before a bit of the minimal perfect hash: the count stored at the start
+// of its block plus the bits before it inside the block.
+static inline uint64_t perfectHashRank(const uint64_t* blocks, uint64_t position)
+{
+    const uint64_t* block = blocks + (position / MPH_BLOCK_BITS) * MPH_BLOCK_WORDS;
+    uint64_t within = position % MPH_BLOCK_BITS;
+    uint64_t rank = block[0];
+    for (uint64_t w = 0; w < within / 64; w++)
+    {
+        rank += __builtin_popcountll(block[1 + w]);
+    }
+    return rank + __builtin_popcountll(block[1 + within / 64] & ((1ull << (within % 64)) - 1));
+}
+
+// Function to point a minimal perfect hash's arrays into its image.
+void attachPerfectHash(PerfectHash* perfect, PerfectHashImage* image, size_t imageSize, bool isMapped)
+{
+    perfect->image = image;
+    perfect->imageSize = imageSize;
+    perfect->blocks = (uint64_t*)(image + 1);
+    perfect->entries = (PerfectHashEntry*)(perfect->blocks + image->blockCount * MPH_BLOCK_WORDS);
+    perfect->fallback = perfect->entries + image->entryCount;
+    perfect->isMapped = isMapped;
+}
+
+// Function to compute the size of an image with these counts.
+size_t perfectHashImageSize(uint64_t blockCount, uint32_t entryCount, uint32_t fallbackCapacity)
+{
+    return sizeof(PerfectHashImage) + blockCount * MPH_BLOCK_WORDS * sizeof(uint64_t)
+         + ((size_t)entryCount + fallbackCapacity) * sizeof(PerfectHashEntry);
+}
+
+// Function to check whether an entry of the minimal perfect hash holds this word.
+static inline bool perfectEntryMatches(const openHashTable* hashTable, const PerfectHashEntry* entry, const char* word, size_t len, uint32_t hash)
+{
+    return entry->hash == hash && memcmp(hashTable->arena + entry->offset, word, len) == 0 && hashTable->arena[entry->offset + len] == '\0';
+}
+
+// Function to find the entry a word would have in the minimal perfect hash: the entry of the first level
+// where its bit is set. Returns NULL if no level has its bit set, in which case the word is either in the
+// fallback table or not in the table at all. A word that is in the table can only be in this entry, but
+// any other word can land on it too, so the caller still compares the word.
+static inline const PerfectHashEntry* findPerfectEntry(const PerfectHash* perfect, uint32_t hash)
+{
+    const PerfectHashImage* image = perfect->image;
+    for (uint32_t level = 0; level < image->levelCount; level++)
+    {
+        uint64_t position = perfectHashPosition(image, level, hash);
+        if (*perfectHashBitWord(perfect->blocks, position) & (1ull << (position % 64)))
+        {
+            return &perfect->entries[perfectHashRank(perfect->blocks, position)];
+        }
+    }
+    return NULL;
+}
+
+// Function to finish a lookup through the minimal perfect hash once findPerfectEntry has found the word's
+// entry (or NULL). The fallback also holds the words that share their whole hash with another word, so it
+// compares the words and not just their hashes. Returns EMPTY_SLOT if the word is not there.
+static inline uint32_t resolvePerfectSlot(openHashTable* hashTable, const PerfectHashEntry* entry, const char* word, size_t len, uint32_t hash)
+{
+    if (entry != NULL)
+    {
+        return perfectEntryMatches(hashTable, entry, word, len, hash) ? entry->slotIndex : EMPTY_SLOT;
+    }
+
+    const PerfectHash* perfect = hashTable->perfect;
+    uint32_t mask = perfect->image->fallbackCapacity - 1;
+    for (uint32_t i = hash & mask; perfect->image->fallbackCapacity != 0 && perfect->fallback[i].slotIndex != EMPTY_SLOT; i = (i + 1) & mask)
+    {
+        if (perfectEntryMatches(hashTable, &perfect->fallback[i], word, len, hash))
+        {
+            return perfect->fallback[i].slotIndex;
+        }
+    }
+    return EMPTY_SLOT;
+}
+
+// Function to find the slot of a word through the minimal perfect hash when its hash is already known.
+// There is no probing: the levels give the one entry the word can have, so a lookup reads a block of bits
+// per level it walks and one entry.
+uint32_t findPerfectSlot(openHashTable* hashTable, const char* word, size_t len, uint32_t hash)
+{
+    return resolvePerfectSlot(hashTable, findPerfectEntry(hashTable->perfect, hash), word, len, hash);
+}
+
+// Shared state of the threads building the minimal perfect hash.
+typedef struct PerfectHashBuild
+{
+    openHashTable* hashTable;
+    PerfectHash* perfect;               // levelStart and levelBits of the current level are set
+    uint32_t level;
+    uint32_t* keys;                     // slot indexes of the words that reached this level
+    size_t keyCount;
+    _Atomic uint64_t* seen;             // positions in this level taken by at least one word
+    _Atomic uint64_t* collided;         // positions taken by more than one
+    size_t* leftovers;                  // words each thread could not place, then where they go in nextKeys
+    uint32_t* nextKeys;
+    int threadCount;
+    int pass;
+} PerfectHashBuild;
+
+// Argument of one build thread.
+typedef struct PerfectHashWorker
+{
+    PerfectHashBuild* build;
+    int thread;
+} PerfectHashWorker;
+
+// Function to run one pass of the build on one thread's share of the keys (or, for the entries, of the slots).
+void* perfectHashWorker(void* argument)
+{
+    PerfectHashWorker* worker = argument;
+    PerfectHashBuild* build = worker->build;
+    openHashTable* hashTable = build->hashTable;
+    PerfectHash* perfect = build->perfect;
+    size_t count = build->pass == MPH_PASS_ENTRIES ? hashTable->capacity : build->keyCount;
+    size_t first = count * worker->thread / build->threadCount;
+    size_t last = count * (worker->thread + 1) / build->threadCount;
+
+    if (build->pass == MPH_PASS_MARK)
+    {
+        // Mark every word's position, and the positions more than one word wants.
+        uint64_t levelStart = perfect->image->levelStart[build->level] * MPH_BLOCK_BITS;
+        for (size_t k = first; k < last; k++)
+        {
+            uint64_t position = perfectHashPosition(perfect->image, build->level, hashTable->slots[build->keys[k]].hash) - levelStart;
+            uint64_t bit = 1ull << (position % 64);
+            if (atomic_fetch_or_explicit(&build->seen[position / 64], bit, memory_order_relaxed) & bit)
+            {
+                atomic_fetch_or_explicit(&build->collided[position / 64], bit, memory_order_relaxed);
+            }
+        }
+    } else if (build->pass == MPH_PASS_COUNT || build->pass == MPH_PASS_MOVE)
+    {
+        // Words whose position is shared go on to the next level: count them, then copy them in order.
+        size_t next = build->pass == MPH_PASS_MOVE ? build->leftovers[worker->thread] : 0;
+        for (size_t k = first; k < last; k++)
+        {
+            uint64_t position = perfectHashPosition(perfect->image, build->level, hashTable->slots[build->keys[k]].hash);
+            if (!(*perfectHashBitWord(perfect->blocks, position) & (1ull << (position % 64))))
+            {
+                if (build->pass == MPH_PASS_MOVE)
+                {
+                    build->nextKeys[next] = build->keys[k];
+                }
+                next++;
+            }
+        }
+        if (build->pass == MPH_PASS_COUNT)
+        {
+            build->leftovers[worker->thread] = next;
+        }
+    } else
+    {
+        // Every level is done: write each placed word's entry.
+        for (size_t s = first; s < last; s++)
+        {
+            Slot slot = hashTable->slots[s];
+            if (slot.offset == EMPTY_SLOT)
+            {
+                continue;
+            }
+            for (uint32_t level = 0; level < perfect->image->levelCount; level++)
+            {
+                uint64_t position = perfectHashPosition(perfect->image, level, slot.hash);
+                if (*perfectHashBitWord(perfect->blocks, position) & (1ull << (position % 64)))
+                {
+                    PerfectHashEntry* entry = &perfect->entries[perfectHashRank(perfect->blocks, position)];
+                    entry->hash = slot.hash;
+                    entry->offset = slot.offset;
+                    entry->slotIndex = (uint32_t)s;
+                    break;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// Function to run one pass of the build on every thread and wait for all of them.
+void runPerfectHashPass(PerfectHashBuild* build, int pass)
+{
+    build->pass = pass;
+    pthread_t* threads = malloc(sizeof(pthread_t) * build->threadCount);
+    PerfectHashWorker* workers = malloc(sizeof(PerfectHashWorker) * build->threadCount);
+    for (int t = 0; t < build->threadCount; t++)
+    {
+        workers[t].build = build;
+        workers[t].thread = t;
+        pthread_create(&threads[t], NULL, perfectHashWorker, &workers[t]);
+    }
+    for (int t = 0; t < build->threadCount; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    free(workers);
+}
+
+// Function to build a minimal perfect hash over every word in a finished table with threadCount threads.
+// The words are placed level by level. Each level only sees the words that collided in the one before,
+// and the words left after MPH_MAX_LEVELS levels go into the fallback table. The bits are built in a
+// scratch image as large as the levels could get, and copied into the final one once the counts are known.
+PerfectHash* buildPerfectHash(openHashTable* hashTable, int threadCount)
+{
+    PerfectHashBuild build;
+    build.hashTable = hashTable;
+    build.threadCount = threadCount > 0 ? threadCount : 1;
+    build.leftovers = malloc(sizeof(size_t) * build.threadCount);
+    build.keys = malloc(sizeof(uint32_t) * (hashTable->count + 1));
+    build.nextKeys = malloc(sizeof(uint32_t) * (hashTable->count + 1));
+    build.keyCount = 0;
+    for (uint32_t s = 0; s < hashTable->capacity; s++)
+    {
+        if (hashTable->slots[s].offset != EMPTY_SLOT)
+        {
+            build.keys[build.keyCount++] = s;
+        }
+    }
+
+    // Every level has at most MPH_GAMMA bits per remaining word plus one block, and at most 2/3 of them go on.
+    uint64_t maxBlocks = (uint64_t)hashTable->count * MPH_GAMMA * 3 / MPH_BLOCK_BITS + MPH_MAX_LEVELS + 1;
+    PerfectHash scratch;
+    PerfectHashImage* scratchImage = aligned_alloc(64, perfectHashImageSize(maxBlocks, 0, 0));
+    memset(scratchImage, 0, perfectHashImageSize(maxBlocks, 0, 0));
+    scratchImage->blockCount = maxBlocks;
+    attachPerfectHash(&scratch, scratchImage, 0, false);
+    scratchImage->blockCount = 0;
+    build.perfect = &scratch;
+
+    while (build.keyCount > 0 && scratchImage->levelCount < MPH_MAX_LEVELS)
+    {
+        uint32_t level = scratchImage->levelCount++;
+        uint64_t blocks = (build.keyCount * MPH_GAMMA + MPH_BLOCK_BITS - 1) / MPH_BLOCK_BITS;
+        scratchImage->levelStart[level] = scratchImage->blockCount;
+        scratchImage->levelBits[level] = blocks * MPH_BLOCK_BITS;
+        scratchImage->blockCount += blocks;
+        build.level = level;
+
+        uint64_t words = blocks * (MPH_BLOCK_WORDS - 1);
+        build.seen = calloc(words, sizeof(uint64_t));
+        build.collided = calloc(words, sizeof(uint64_t));
+        runPerfectHashPass(&build, MPH_PASS_MARK);
+
+        // The level's bits are the positions exactly one word wants.
+        for (uint64_t w = 0; w < words; w++)
+        {
+            *perfectHashBitWord(scratch.blocks, scratchImage->levelStart[level] * MPH_BLOCK_BITS + w * 64)
+                = atomic_load_explicit(&build.seen[w], memory_order_relaxed) & ~atomic_load_explicit(&build.collided[w], memory_order_relaxed);
+        }
+        free((void*)build.seen);
+        free((void*)build.collided);
+
+        runPerfectHashPass(&build, MPH_PASS_COUNT);
+        size_t leftover = 0;
+        for (int t = 0; t < build.threadCount; t++)
+        {
+            size_t count = build.leftovers[t];
+            build.leftovers[t] = leftover;
+            leftover += count;
+        }
+        runPerfectHashPass(&build, MPH_PASS_MOVE);
+
+        uint32_t* placed = build.keys;
+        build.keys = build.nextKeys;
+        build.nextKeys = placed;
+        build.keyCount = leftover;
+    }
+
+    uint32_t fallbackCapacity = 0;
+    if (build.keyCount > 0)
+    {
+        fallbackCapacity = 16;
+        while (fallbackCapacity < build.keyCount * 2)
+        {
+            fallbackCapacity *= 2;
+        }
+    }
+    scratchImage->entryCount = hashTable->count - build.keyCount;
+    scratchImage->fallbackCapacity = fallbackCapacity;
+
+    size_t imageSize = perfectHashImageSize(scratchImage->blockCount, scratchImage->entryCount, fallbackCapacity);
+    PerfectHashImage* image = aligned_alloc(64, (imageSize + 63) / 64 * 64);
+    memcpy(image, scratchImage, sizeof(PerfectHashImage) + scratchImage->blockCount * MPH_BLOCK_WORDS * sizeof(uint64_t));
+    free(scratchImage);
+    PerfectHash* perfect = malloc(sizeof(PerfectHash));
+    attachPerfectHash(perfect, image, imageSize, false);
+
+    uint64_t rank = 0;
+    for (uint64_t b = 0; b < image->blockCount; b++)
+    {
+        uint64_t* block = perfect->blocks + b * MPH_BLOCK_WORDS;
+        block[0] = rank;
+        for (int w = 1; w < MPH_BLOCK_WORDS; w++)
+        {
+            rank += __builtin_popcountll(block[w]);
+        }
+    }
+
+    for (uint32_t i = 0; i < fallbackCapacity; i++)
+    {
+        perfect->fallback[i].slotIndex = EMPTY_SLOT;
+    }
+    for (size_t k = 0; k < build.keyCount; k++)
+    {
+        Slot slot = hashTable->slots[build.keys[k]];
+        uint32_t i = slot.hash & (fallbackCapacity - 1);
+        while (perfect->fallback[i].slotIndex != EMPTY_SLOT)
+        {
+            i = (i + 1) & (fallbackCapacity - 1);
+        }
+        perfect->fallback[i].hash = slot.hash;
+        perfect->fallback[i].offset = slot.offset;
+        perfect->fallback[i].slotIndex = build.keys[k];
+    }
+
+    build.perfect = perfect;
+    runPerfectHashPass(&build, MPH_PASS_ENTRIES);
+
+    free(build.keys);
+    free(build.nextKeys);
+    free(build.leftovers);
+
+    return perfect;
+}
+
+// Function to free a minimal perfect hash. A mapped image belongs to the snapshot mapping.
+void freePerfectHash(PerfectHash* perfect)
+{
+    if (!perfect->isMapped)
+    {
+        free(perfect->image);
+    }
+    free(perfect);
+}
+
+// Function to replace the slots and the arena of a finished table with a front-coded copy of its words
+// (--front-coded). From then on the table is read-only, and a word's rank is its slot index, so the
+// frequency table and the lookups work as before.
+void convertToFrontCoded(openHashTable* hashTable)
+{
+    hashTable->frontCoded = buildFrontCodedDictionary(hashTable);
+
+    // A perfect hash that came with a snapshot points at the slots and the arena, which are about to go.
+    if (hashTable->perfect != NULL)
+    {
+        freePerfectHash(hashTable->perfect);
+        hashTable->perfect = NULL;
+    }
+    if (!hashTable->slotsAreMapped)
+    {
+        free(hashTable->slots);
+    }
+    if (!hashTable->arenaIsMapped)
+    {
+        free(hashTable->arena);
+    }
+    hashTable->slots = NULL;
+    hashTable->arena = NULL;
+    hashTable->arenaSize = 0;
+    hashTable->arenaCapacity = 0;
+    hashTable->slotsAreMapped = false;
+    hashTable->arenaIsMapped = false;
+    hashTable->capacity = hashTable->count;
+    hashTable->mask = 0;
+    releaseUnusedMapping(hashTable);
+}
+
+// Function to find the slot of a word when its hash is already known. Returns its index, or EMPTY_SLOT if it is not in the table.
+uint32_t findHashedSlot(openHashTable* hashTable, const char* word, size_t len, uint32_t hash)
+{
+    if (hashTable->perfect != NULL)
+    {
+        return findPerfectSlot(hashTable, word, len, hash);
+    }
+    if (hashTable->frontCoded != NULL)
+    {
+        return findFrontCodedSlot(hashTable->frontCoded, word, len);
+    }
+    uint32_t slotIndex = hash & hashTable->mask;
+
+    // Robin Hood invariant: once we reach a slot closer to home than we are, the word cannot be further along.
+    for (uint32_t distance = 0; ; distance++)
+    {
+        Slot slot = hashTable->slots[slotIndex];
+        if (slot.offset == EMPTY_SLOT || probeDistance(hashTable, slot.hash, slotIndex) < distance)
+        {
+            return EMPTY_SLOT;
+        }
+        if (slot.hash == hash && memcmp(hashTable->arena + slot.offset, word, len) == 0 && hashTable->arena[slot.offset + len] == '\0')
+        {
+            return slotIndex;
+        }
+        slotIndex = (slotIndex + 1) & hashTable->mask;
+    }
+}
+
+// Function to find a word when its hash is already known. Returns its arena offset, or EMPTY_SLOT if it is not in the table.
+uint32_t findHashedWord(openHashTable* hashTable, const char* word, size_t len, uint32_t hash)
+{
+    uint32_t slotIndex = findHashedSlot(hashTable, word, len, hash);
+    return slotIndex == EMPTY_SLOT ? EMPTY_SLOT : hashTable->slots[slotIndex].offset;
+}
+
+// Function to look a word up when its hash is already known.
+bool lookupHashedWord(openHashTable* hashTable, const char* word, size_t len, uint32_t hash)
+{
+    return findHashedWord(hashTable, word, len, hash) != EMPTY_SLOT;
+}
+
+// Function to look a word of the given length up in the hash table, through the Bloom filter and counting
+// it in the lookup statistics. Returns its slot index, or EMPTY_SLOT if it is not in the table.
+uint32_t lookupWordSlot(openHashTable* hashTable, const char* word, size_t len)
+{
+    uint32_t hash = hashFunction(word, len);
+    threadLookupStats.lookups++;
+
+    if (hashTable->bloom != NULL && !bloomMayContain(hashTable->bloom, hash))
+    {
+        threadLookupStats.bloomRejected++;
+        return EMPTY_SLOT;
+    }
+
+    uint32_t slotIndex = findHashedSlot(hashTable, word, len, hash);
+    if (slotIndex != EMPTY_SLOT)
+    {
+        threadLookupStats.hits++;
+    } else if (hashTable->bloom != NULL)
+    {
+        threadLookupStats.bloomFalsePositives++;
+    }
+    return slotIndex;
+}
+
+// Function to look a word of the given length up in the hash table. The word does not have to be NUL-terminated.
+bool lookupWord(openHashTable* hashTable, const char* word, size_t len)
+{
+    return lookupWordSlot(hashTable, word, len) != EMPTY_SLOT;
+}
+
+// Function to prefetch the first thing a lookup of this hash reads: its home slot, or with a perfect hash
+// its bit in the first level. A front-coded dictionary is searched by the word, so there is nothing to prefetch.
+static inline void prefetchHomeSlot(openHashTable* hashTable, uint32_t hash)
+{
+    if (hashTable->frontCoded != NULL)
+    {
+        return;
+    } else if (hashTable->perfect != NULL)
+    {
+        __builtin_prefetch(perfectHashBitWord(hashTable->perfect->blocks, perfectHashPosition(hashTable->perfect->image, 0, hash)));
+    } else
+    {
+        __builtin_prefetch(&hashTable->slots[hash & hashTable->mask]);
+    }
+}
+
+// Function to look up a batch of words at once. The words are hashed and their home slots prefetched
+// (behind the Bloom filter, when there is one) before any of them is resolved, so the cache misses of up
+// to LOOKUP_BATCH_SIZE lookups overlap instead of waiting on one another. Stores the hash of each word in
+// hashes and its slot index, or EMPTY_SLOT if it is not in the table, in slotIndexes. The lookups are
+// counted in the lookup statistics like those of lookupWordSlot.
+void lookupWordSlots(openHashTable* hashTable, const WordSpan* words, size_t count, uint32_t* hashes, uint32_t* slotIndexes)
+{
+    BloomFilter* bloom = hashTable->bloom;
+    threadLookupStats.lookups += count;
+
+    for (size_t first = 0; first < count; first += LOOKUP_BATCH_SIZE)
+    {
+        size_t last = count - first > LOOKUP_BATCH_SIZE ? first + LOOKUP_BATCH_SIZE : count;
+
+        for (size_t i = first; i < last; i++)
+        {
+            hashes[i] = hashFunction(words[i].start, words[i].len);
+            if (bloom != NULL)
+            {
+                __builtin_prefetch(bloom->blocks + (size_t)bloomBlockIndex(bloom, hashes[i]) * BLOOM_WORDS_PER_BLOCK);
+            } else
+            {
+                prefetchHomeSlot(hashTable, hashes[i]);
+            }
+        }
+
+        // With a Bloom filter, only the words that get past it have their slots fetched. The others are marked done.
+        if (bloom != NULL)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                if (bloomMayContain(bloom, hashes[i]))
+                {
+                    slotIndexes[i] = 0;
+                    prefetchHomeSlot(hashTable, hashes[i]);
+                } else
+                {
+                    slotIndexes[i] = EMPTY_SLOT;
+                    threadLookupStats.bloomRejected++;
+                }
+            }
+        }
+
+        // With a perfect hash, the levels (which are small enough to stay cached) give each word's entry
+        // first, so the entries of the whole batch are fetched together rather than one after another.
+        const PerfectHashEntry* entries[LOOKUP_BATCH_SIZE];
+        if (hashTable->perfect != NULL)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                if (bloom == NULL || slotIndexes[i] != EMPTY_SLOT)
+                {
+                    entries[i - first] = findPerfectEntry(hashTable->perfect, hashes[i]);
+                    __builtin_prefetch(entries[i - first]);
+                }
+            }
+        }
+
+        for (size_t i = first; i < last; i++)
+        {
+            if (bloom != NULL && slotIndexes[i] == EMPTY_SLOT)
+            {
+                continue;
+            }
+            if (hashTable->perfect != NULL)
+            {
+                slotIndexes[i] = resolvePerfectSlot(hashTable, entries[i - first], words[i].start, words[i].len, hashes[i]);
+            } else
+            {
+                slotIndexes[i] = findHashedSlot(hashTable, words[i].start, words[i].len, hashes[i]);
+            }
+            if (slotIndexes[i] != EMPTY_SLOT)
+            {
+                threadLookupStats.hits++;
+            } else if (bloom != NULL)
+            {
+                threadLookupStats.bloomFalsePositives++;
+            }
+        }
+    }
+}
+
+
+// Function to read a word's count from the frequency table. Words it does not list, and every word when
+// there is no frequency file, count 0.
+uint32_t wordFrequency(openHashTable* hashTable, const char* word, size_t len)
+{
+    if (hashTable->frequencies == NULL)
+    {
+        return 0;
+    }
+    uint32_t slotIndex = findHashedSlot(hashTable, word, len, hashFunction(word, len));
+    return slotIndex == EMPTY_SLOT ? 0 : hashTable->frequencies[slotIndex];
+}
+
+// Function to add a slot for a word that is already in the arena and not yet in the table.
+void insertArenaWord(openHashTable* hashTable, uint32_t offset, uint32_t hash)
+{
+    // The perfect hash only knows the words it was built over, and growing moves the slots it points at.
+    if (hashTable->perfect != NULL)
+    {
+        freePerfectHash(hashTable->perfect);
+        hashTable->perfect = NULL;
+    }
+    if ((size_t)(hashTable->count + 1) * MAX_LOAD_DENOMINATOR > (size_t)hashTable->capacity * MAX_LOAD_NUMERATOR)
+    {
+        growHashTable(hashTable);
+    }
+
+    Slot slot;
+    slot.hash = hash;
+    slot.offset = offset;
+
+    placeSlot(hashTable, slot, slot.hash & hashTable->mask);
+    hashTable->count++;
+
+    if (hashTable->bloom != NULL)
+    {
+        bloomAdd(hashTable->bloom, hash);
+    }
+}
+
+// Function to insert the dictionary words to hash table
+void insertToHashTable(openHashTable* hashTable, char* wrd)
+{
+    size_t len = strlen(wrd);
+    uint32_t hash = hashFunction(wrd, len);
+
+    // Words that are already in the dictionary are not added twice.
+    if (lookupHashedWord(hashTable, wrd, len, hash))
+    {
+        return;
+    }
+
+    insertArenaWord(hashTable, appendToArena(hashTable, wrd, len), hash);
+}
+
+
+// Function to check for misspelled words
+bool isMisspelled(openHashTable* hashTable, char* word)
+{
+    return !lookupWord(hashTable, word, strlen(word));
+}
+
+// Function to allocate an empty generation of the learned-word table.
+LearnedGeneration* createLearnedGeneration(uint32_t capacity, size_t arenaCapacity)
+{
+    LearnedGeneration* generation = malloc(sizeof(LearnedGeneration));
+    generation->capacity = capacity;
+    generation->mask = capacity - 1;
+    generation->slots = malloc(sizeof(LearnedSlot) * capacity);
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        generation->slots[i].hash = 0;
+        atomic_init(&generation->slots[i].word, EMPTY_SLOT);
+    }
+    generation->maxWords = capacity / 2;
+    generation->offsets = malloc(sizeof(uint32_t) * generation->maxWords);
+    generation->arenaCapacity = arenaCapacity;
+    generation->arena = malloc(arenaCapacity);
+    generation->arenaSize = 0;
+    generation->retired = NULL;
+
+    return generation;
+}
+
+// Function to create an empty learned-word table.
+LearnedWords* createLearnedWords()
+{
+    LearnedWords* learned = malloc(sizeof(LearnedWords));
+    atomic_init(&learned->current, createLearnedGeneration(64, 1 << 10));
+    atomic_init(&learned->count, 0);
+
+    return learned;
+}
+
+// Function to read how many words have been learned. The generation loaded after it holds at least that many.
+uint32_t learnedWordCount(LearnedWords* learned)
+{
+    return atomic_load_explicit(&learned->count, memory_order_acquire);
+}
+
+LearnedGeneration* currentLearnedGeneration(LearnedWords* learned)
+{
+    return atomic_load_explicit(&learned->current, memory_order_acquire);
+}
+
+// Function to find a word in the learned-word table. Returns the table's copy of it, or NULL if it has not
+// been learned. Never blocks, even while a word is being added.
+const char* findLearnedWord(LearnedWords* learned, const char* word, size_t len, uint32_t hash)
+{
+    LearnedGeneration* generation = currentLearnedGeneration(learned);
+    uint32_t slotIndex = hash & generation->mask;
+    while (true)
+    {
+        LearnedSlot* slot = &generation->slots[slotIndex];
+        uint32_t index = atomic_load_explicit(&slot->word, memory_order_acquire);
+        if (index == EMPTY_SLOT)
+        {
+            return NULL;
+        }
+
+        const char* candidate = generation->arena + generation->offsets[index];
+        if (slot->hash == hash && memcmp(candidate, word, len) == 0 && candidate[len] == '\0')
+        {
+            return candidate;
+        }
+        slotIndex = (slotIndex + 1) & generation->mask;
+    }
+}
+
+// Function to look a word up in the learned-word table.
+bool learnedWordsContain(LearnedWords* learned, const char* word, size_t len, uint32_t hash)
+{
+    return findLearnedWord(learned, word, len, hash) != NULL;
+}
+
+// Function to publish a word in a slot of a generation, after its hash.
+void placeLearnedSlot(LearnedGeneration* generation, uint32_t hash, uint32_t index)
+{
+    uint32_t slotIndex = hash & generation->mask;
+    while (atomic_load_explicit(&generation->slots[slotIndex].word, memory_order_relaxed) != EMPTY_SLOT)
+    {
+        slotIndex = (slotIndex + 1) & generation->mask;
+    }
+    generation->slots[slotIndex].hash = hash;
+    atomic_store_explicit(&generation->slots[slotIndex].word, index, memory_order_release);
+}
+
+// Function to add a word that is not in the learned-word table yet. Only one thread may add words to a
+// table, but others may read it meanwhile: the word's letters and slot are written before it is counted.
+void addLearnedWord(LearnedWords* learned, const char* word, size_t len)
+{
+    LearnedGeneration* generation = atomic_load_explicit(&learned->current, memory_order_relaxed);
+    uint32_t count = atomic_load_explicit(&learned->count, memory_order_relaxed);
+
+    if (count == generation->maxWords || generation->arenaSize + len + 1 > generation->arenaCapacity)
+    {
+        // Copy everything into a generation twice the size; readers still inside the old one see a consistent table.
+        size_t arenaCapacity = generation->arenaCapacity * 2;
+        while (generation->arenaSize + len + 1 > arenaCapacity)
+        {
+            arenaCapacity *= 2;
+        }
+        uint32_t capacity = count == generation->maxWords ? generation->capacity * 2 : generation->capacity;
+        LearnedGeneration* larger = createLearnedGeneration(capacity, arenaCapacity);
+
+        memcpy(larger->arena, generation->arena, generation->arenaSize);
+        larger->arenaSize = generation->arenaSize;
+        memcpy(larger->offsets, generation->offsets, sizeof(uint32_t) * count);
+        for (uint32_t i = 0; i < generation->capacity; i++)
+        {
+            uint32_t index = atomic_load_explicit(&generation->slots[i].word, memory_order_relaxed);
+            if (index != EMPTY_SLOT)
+            {
+                placeLearnedSlot(larger, generation->slots[i].hash, index);
+            }
+        }
+        larger->retired = generation;
+
+        atomic_store_explicit(&learned->current, larger, memory_order_release);
+        generation = larger;
+    }
+
+    uint32_t offset = generation->arenaSize;
+    memcpy(generation->arena + offset, word, len);
+    generation->arena[offset + len] = '\0';
+    generation->arenaSize += len + 1;
+    generation->offsets[count] = offset;
+
+    placeLearnedSlot(generation, hashFunction(word, len), count);
+    atomic_store_explicit(&learned->count, count + 1, memory_order_release);
+}
+
+// Function to free the learned-word table with every generation it retired.
+void freeLearnedWords(LearnedWords* learned)
+{
+    LearnedGeneration* generation = atomic_load_explicit(&learned->current, memory_order_relaxed);
+    while (generation != NULL)
+    {
+        LearnedGeneration* retired = generation->retired;
+        free(generation->slots);
+        free(generation->offsets);
+        free(generation->arena);
+        free(generation);
+        generation = retired;
+    }
+    free(learned);
+}
+
+// Function to look a word up in the dictionary and, if there is one, in the table of words learned in add mode.
+bool isDictionaryWord(openHashTable* hashTable, LearnedWords* learned, const char* word, size_t len)
+{
+    if (lookupWord(hashTable, word, len))
+    {
+        return true;
+    }
+    return learned != NULL && learnedWordCount(learned) > 0 && learnedWordsContain(learned, word, len, hashFunction(word, len));
+}
+
+
+// Function to append bytes to an output buffer, growing it as needed.
+void appendToOutput(OutputBuffer* output, const char* text, size_t len)
+{
+    if (output->size + len > output->capacity)
+    {
+        output->capacity = output->capacity == 0 ? 4096 : output->capacity;
+        while (output->size + len > output->capacity)
+        {
+            output->capacity *= 2;
+        }
+        output->data = realloc(output->data, output->capacity);
+    }
+
+    memcpy(output->data + output->size, text, len);
+    output->size += len;
+}
+
+// Function to append a NUL-terminated string to an output buffer.
+void appendStringToOutput(OutputBuffer* output, const char* text)
+{
+    appendToOutput(output, text, strlen(text));
+}
+
+// Function to classify 64 input bytes one at a time: bit i of the result is set if block[i] is a delimiter.
+uint64_t delimiterMaskScalar(const char* block)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; i++)
+    {
+        mask |= (uint64_t)isDelimiter[(unsigned char)block[i]] << i;
+    }
+    return mask;
+}
+
+#ifdef SIMD_TOKENIZER
+// Same as delimiterMaskScalar, 16 bytes at a time with SSE2: one byte compare per delimiter, OR-ed together.
+uint64_t delimiterMaskSSE2(const char* block)
+{
+    uint64_t mask = 0;
+    for (int part = 0; part < 4; part++)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(block + part * 16));
+        __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(','))),
+                         _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('.')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8(':')))),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(';')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('!'))),
+                         _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(bytes, _mm_setzero_si128()))));
+        mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(hits) << (part * 16);
+    }
+    return mask;
+}
+
+// Same as delimiterMaskScalar, 32 bytes at a time with AVX2. Each byte's high and low nibble are looked up
+// in two 16-entry tables (vpshufb); a byte is a delimiter when the two lookups share a bit. The delimiters
+// fall in three high-nibble groups: bit 0 is 0x0_ ('\0', '\n'), bit 1 is 0x2_ (' ', '!', ',', '.')
+// and bit 2 is 0x3_ (':', ';').
+__attribute__((target("avx2")))
+uint64_t delimiterMaskAVX2(const char* block)
+{
+    const __m256i highTable = _mm256_setr_epi8(1, 0, 2, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               1, 0, 2, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i lowTable = _mm256_setr_epi8(3, 2, 0, 0, 0, 0, 0, 0, 0, 0, 5, 4, 2, 0, 2, 0,
+                                              3, 2, 0, 0, 0, 0, 0, 0, 0, 0, 5, 4, 2, 0, 2, 0);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+
+    uint64_t mask = 0;
+    for (int part = 0; part < 2; part++)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(block + part * 32));
+        __m256i high = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), lowNibble));
+        __m256i low = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(bytes, lowNibble));
+        __m256i notDelimiter = _mm256_cmpeq_epi8(_mm256_and_si256(high, low), _mm256_setzero_si256());
+        mask |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(notDelimiter) << (part * 32);
+    }
+    return mask;
+}
+#endif
+
+// Delimiter classifier used by the tokenizer, picked once by selectTokenizer.
+static uint64_t (*delimiterMask)(const char* block) = delimiterMaskScalar;
+
+// Function to pick the delimiter classifier: "avx2", "sse2", "scalar", or "auto" for the fastest one
+// this CPU supports. Returns false if the requested one is not available.
+bool selectTokenizer(const char* name)
+{
+    bool automatic = strcmp(name, "auto") == 0;
+
+#ifdef SIMD_TOKENIZER
+    __builtin_cpu_init();
+    if ((automatic || strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2"))
+    {
+        delimiterMask = delimiterMaskAVX2;
+        return true;
+    }
+    if (automatic || strcmp(name, "sse2") == 0)
+    {
+        delimiterMask = delimiterMaskSSE2;
+        return true;
+    }
+#endif
+    if (automatic || strcmp(name, "scalar") == 0)
+    {
+        delimiterMask = delimiterMaskScalar;
+        return true;
+    }
+    return false;
+}
+
+// Function to start tokenizing the bytes from start to end.
+void initTokenizer(Tokenizer* tokenizer, const char* start, const char* end)
+{
+    tokenizer->position = start;
+    tokenizer->end = end;
+    tokenizer->wordStart = NULL;
+}
+
+// Function to find the next words and store them as (pointer, length) spans. This replaces strtok: it keeps
+// its state in the tokenizer and does not modify the input, so several threads can tokenize at once.
+// The input is classified 64 bytes at a time; in the delimiter mask of a block, a word starts where a
+// non-delimiter follows a delimiter and ends where a delimiter follows a non-delimiter.
+// Returns the number of spans stored (at most maxSpans, which must be at least TOKENIZER_BLOCK), 0 at the end.
+size_t nextWords(Tokenizer* tokenizer, WordSpan* spans, size_t maxSpans)
+{
+    size_t count = 0;
+
+    // A block holds at most TOKENIZER_BLOCK / 2 word ends, plus one for a word cut by the end of the input.
+    while (tokenizer->position < tokenizer->end && count + TOKENIZER_BLOCK / 2 + 1 <= maxSpans)
+    {
+        const char* block = tokenizer->position;
+        uint64_t delimiters;
+        size_t remaining = tokenizer->end - block;
+
+        if (remaining >= TOKENIZER_BLOCK)
+        {
+            delimiters = delimiterMask(block);
+        } else
+        {
+            // The last block is padded with delimiters so that the classifier can read a whole block.
+            char padded[TOKENIZER_BLOCK];
+            memset(padded, ' ', TOKENIZER_BLOCK);
+            memcpy(padded, block, remaining);
+            delimiters = delimiterMask(padded);
+        }
+
+        uint64_t previousIsDelimiter = (delimiters << 1) | (tokenizer->wordStart == NULL ? 1 : 0);
+        uint64_t starts = ~delimiters & previousIsDelimiter;
+        uint64_t ends = delimiters & ~previousIsDelimiter;
+        uint64_t boundaries = starts | ends;
+
+        // Starts and ends alternate, so walking the boundaries in order pairs each start with its end.
+        while (boundaries != 0)
+        {
+            int bit = __builtin_ctzll(boundaries);
+            boundaries &= boundaries - 1;
+
+            if (tokenizer->wordStart == NULL)
+            {
+                tokenizer->wordStart = block + bit;
+            } else
+            {
+                spans[count].start = tokenizer->wordStart;
+                spans[count].len = block + bit - tokenizer->wordStart;
+                count++;
+                tokenizer->wordStart = NULL;
+            }
+        }
+
+        tokenizer->position = remaining >= TOKENIZER_BLOCK ? block + TOKENIZER_BLOCK : tokenizer->end;
+    }
+
+    // A word that runs up to the end of the input has no delimiter after it.
+    if (tokenizer->position == tokenizer->end && tokenizer->wordStart != NULL && count < maxSpans)
+    {
+        spans[count].start = tokenizer->wordStart;
+        spans[count].len = tokenizer->end - tokenizer->wordStart;
+        count++;
+        tokenizer->wordStart = NULL;
+    }
+
+    return count;
+}
+
+void swap(char *a, char *b)
+{
+    char temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+
+// Orders suggestions by edit distance, then most frequent first (--freq), then alphabetically.
+int compareSuggestions(const void* a, const void* b)
+{
+    const RankedSuggestion* first = a;
+    const RankedSuggestion* second = b;
+
+    if (first->distance != second->distance)
+    {
+        return first->distance - second->distance;
+    }
+    if (first->frequency != second->frequency)
+    {
+        return first->frequency > second->frequency ? -1 : 1;
+    }
+    return strcmp(first->word, second->word);
+}
+
+// Function to start collecting suggestions. Ranked suggestions are kept in a heap of at most `limit`
+// entries (any number when limit is 0); the others stay in the order they are found, the first `limit` of them.
+void initSuggestionCollector(SuggestionCollector* collector, int limit, bool ranked)
+{
+    collector->limit = limit;
+    collector->ranked = ranked;
+    collector->copyWords = false;
+    collector->count = 0;
+    collector->capacity = limit > 0 ? limit : 8;
+    collector->items = malloc(sizeof(RankedSuggestion) * collector->capacity);
+}
+
+// Function to restore the heap order (root = worst suggestion) from an entry down.
+void siftSuggestionDown(SuggestionCollector* collector, int position)
+{
+    RankedSuggestion* items = collector->items;
+    while (true)
+    {
+        int worst = position;
+        int left = 2 * position + 1;
+        int right = left + 1;
+        if (left < collector->count && compareSuggestions(&items[left], &items[worst]) > 0)
+        {
+            worst = left;
+        }
+        if (right < collector->count && compareSuggestions(&items[right], &items[worst]) > 0)
+        {
+            worst = right;
+        }
+        if (worst == position)
+        {
+            return;
+        }
+        RankedSuggestion swapped = items[position];
+        items[position] = items[worst];
+        items[worst] = swapped;
+        position = worst;
+    }
+}
+
+// Function to offer a suggestion. Once `limit` ranked suggestions are kept, a new one only gets in by
+// replacing the worst of them, so nothing is allocated per candidate.
+void addSuggestion(SuggestionCollector* collector, const char* word, int distance, uint32_t frequency)
+{
+    RankedSuggestion suggestion;
+    suggestion.word = word;
+    suggestion.distance = distance;
+    suggestion.frequency = frequency;
+
+    if (collector->limit > 0 && collector->count == collector->limit)
+    {
+        if (!collector->ranked || compareSuggestions(&suggestion, &collector->items[0]) >= 0)
+        {
+            return;
+        }
+        collector->items[0] = suggestion;
+        siftSuggestionDown(collector, 0);
+        return;
+    }
+
+    if (collector->count == collector->capacity)
+    {
+        collector->capacity *= 2;
+        collector->items = realloc(collector->items, sizeof(RankedSuggestion) * collector->capacity);
+    }
+    int position = collector->count++;
+    while (collector->ranked && position > 0 && compareSuggestions(&suggestion, &collector->items[(position - 1) / 2]) > 0)
+    {
+        collector->items[position] = collector->items[(position - 1) / 2];
+        position = (position - 1) / 2;
+    }
+    collector->items[position] = suggestion;
+}
+
+// Function to tell whether a word was already collected (the three checks can reach one word twice).
+bool suggestionCollected(SuggestionCollector* collector, const char* word)
+{
+    for (int i = 0; i < collector->count; i++)
+    {
+        if (collector->items[i].word == word || (collector->copyWords && strcmp(collector->items[i].word, word) == 0))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to hand the collected suggestions over, best first if they are ranked. Returns their number;
+// *suggestions must be freed by the caller (the words themselves belong to the dictionary, or with
+// copyWords come in the same block after the suggestions).
+int finishSuggestions(SuggestionCollector* collector, RankedSuggestion** suggestions)
+{
+    if (collector->ranked)
+    {
+        qsort(collector->items, collector->count, sizeof(RankedSuggestion), compareSuggestions);
+    }
+    if (collector->copyWords)
+    {
+        size_t size = sizeof(RankedSuggestion) * collector->count;
+        for (int i = 0; i < collector->count; i++)
+        {
+            size += strlen(collector->items[i].word) + 1;
+        }
+        RankedSuggestion* copied = malloc(size > 0 ? size : 1);
+        char* letters = (char*)(copied + collector->count);
+        for (int i = 0; i < collector->count; i++)
+        {
+            size_t len = strlen(collector->items[i].word);
+            copied[i] = collector->items[i];
+            copied[i].word = memcpy(letters, collector->items[i].word, len + 1);
+            letters += len + 1;
+        }
+        free(collector->items);
+        collector->items = copied;
+    }
+    *suggestions = collector->items;
+    return collector->count;
+}
+
+// Function to write the candidates of the three checks for a word of len letters, in the order the checks
+// try them, into letters (len + 2 bytes for each one) and record them in candidates. There are at most
+// len + CLASSIC_EXTRA_CANDIDATES of them. Returns how many there are.
+size_t generateCandidates(const char* originalWord, size_t len, char* letters, WordSpan* candidates)
+{
+    size_t count = 0;
+    size_t stride = len + 2;
+
+    //////////////////////////////////
+    // Step 1: Inverted adjacent pairs
+    //////////////////////////////////
+
+    for (size_t i = 0; i + 1 < len; i++)
+    {
+        char* word = letters + count * stride;
+        memcpy(word, originalWord, len + 1);
+        swap(&word[i], &word[i+1]);   // Swap the adjacent pair
+        candidates[count].start = word;
+        candidates[count++].len = len;
+    }
+
+    //////////////////////////////////////////////////////
+    // Step 2: Missing letters at the beginning or the end
+    //////////////////////////////////////////////////////
+
+    // Let's add character from 'a' to 'z' in the front.
+    for (char c = 'a'; c <= 'z'; c++)
+    {
+        char* word = letters + count * stride;
+        word[0] = c;   // Put the character in the front
+        memcpy(word + 1, originalWord, len + 1);
+        candidates[count].start = word;
+        candidates[count++].len = len + 1;
+    }
+
+    // Now, let's add characters 'a' to 'z' at the end.
+    for (char c = 'a'; c <= 'z'; c++)
+    {
+        char* word = letters + count * stride;
+        memcpy(word, originalWord, len);
+        word[len] = c;
+        word[len + 1] = '\0';
+        candidates[count].start = word;
+        candidates[count++].len = len + 1;
+    }
+
+    /////////////////////////////////////////////////////
+    // Step 3: Extra letters at the beginning or the end
+    ////////////////////////////////////////////////////
+
+    // Remove the first character, then the last one.
+    if (len > 0)
+    {
+        char* word = letters + count * stride;
+        memcpy(word, originalWord + 1, len);
+        candidates[count].start = word;
+        candidates[count++].len = len - 1;
+
+        word = letters + count * stride;
+        memcpy(word, originalWord, len - 1);
+        word[len - 1] = '\0';
+        candidates[count].start = word;
+        candidates[count++].len = len - 1;
+    }
+
+    return count;
+}
+
+// Function to collect the suggestions of the three checks: in the order they are found, or with a frequency
+// table, most frequent first. With limit > 0 only the first `limit` of them are kept. All the candidates
+// are generated first and looked up as one batch, so their cache misses overlap. A word longer than
+// CLASSIC_MAX_WORD_LENGTH, or one whose candidates cannot be allocated, gets no suggestions.
+// Returns their number; *suggestions must be freed by the caller.
+int findSuggestions(openHashTable* hashTable, LearnedWords* learned, char* originalWord, int limit, RankedSuggestion** suggestions)
+{
+    // The suggestions point at the dictionary's own copies of the words, so none of them is copied.
+    // A front-coded dictionary has none, so its words are copied from the candidates at the end.
+    SuggestionCollector collector;
+    initSuggestionCollector(&collector, limit, hashTable->frequencies != NULL);
+    collector.copyWords = hashTable->frontCoded != NULL;
+
+    size_t len = strlen(originalWord);
+    if (len > CLASSIC_MAX_WORD_LENGTH)
+    {
+        return finishSuggestions(&collector, suggestions);
+    }
+    size_t maxCandidates = len + CLASSIC_EXTRA_CANDIDATES;
+    char* letters = malloc(maxCandidates * (len + 2));
+    WordSpan* candidates = malloc(sizeof(WordSpan) * maxCandidates);
+    uint32_t* hashes = malloc(sizeof(uint32_t) * maxCandidates);
+    uint32_t* slotIndexes = malloc(sizeof(uint32_t) * maxCandidates);
+    if (letters == NULL || candidates == NULL || hashes == NULL || slotIndexes == NULL)
+    {
+        free(letters);
+        free(candidates);
+        free(hashes);
+        free(slotIndexes);
+        return finishSuggestions(&collector, suggestions);
+    }
+
+    size_t count = generateCandidates(originalWord, len, letters, candidates);
+    lookupWordSlots(hashTable, candidates, count, hashes, slotIndexes);
+
+    bool checkLearned = learned != NULL && learnedWordCount(learned) > 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const char* found = NULL;
+        uint32_t frequency = 0;
+        if (slotIndexes[i] != EMPTY_SLOT)
+        {
+            found = hashTable->frontCoded != NULL ? candidates[i].start : hashTable->arena + hashTable->slots[slotIndexes[i]].offset;
+            frequency = hashTable->frequencies != NULL ? hashTable->frequencies[slotIndexes[i]] : 0;
+        } else if (checkLearned)
+        {
+            found = findLearnedWord(learned, candidates[i].start, candidates[i].len, hashes[i]);
+        }
+
+        // Ranked suggestions list each word once, however many checks reach it.
+        if (found != NULL && !(collector.ranked && suggestionCollected(&collector, found)))
+        {
+            addSuggestion(&collector, found, 1, frequency);
+        }
+    }
+
+    // With copyWords the suggestions still point into letters until they are handed over.
+    int suggestionCount = finishSuggestions(&collector, suggestions);
+    free(letters);
+    free(candidates);
+    free(hashes);
+    free(slotIndexes);
+
+    return suggestionCount;
+}
+
+// Function to compute the Damerau-Levenshtein distance (optimal string alignment: insertions, deletions,
+// substitutions and swaps of adjacent letters) between two words. Gives up and returns maxDistance + 1
+// as soon as the distance is known to be larger than maxDistance.
+int editDistance(const char* a, size_t aLen, const char* b, size_t bLen, int maxDistance)
+{
+    if (aLen > MAX_WORD_LENGTH || bLen > MAX_WORD_LENGTH || (aLen > bLen ? aLen - bLen : bLen - aLen) > (size_t)maxDistance)
+    {
+        return maxDistance + 1;
+    }
+
+    // Three rolling rows of the DP table: two rows back (for swaps), the previous row and the current one.
+    int rows[3][MAX_WORD_LENGTH + 1];
+    int* twoBack = rows[0];
+    int* previous = rows[1];
+    int* current = rows[2];
+
+    for (size_t j = 0; j <= bLen; j++)
+    {
+        previous[j] = j;
+    }
+
+    for (size_t i = 1; i <= aLen; i++)
+    {
+        current[0] = i;
+        int rowMinimum = current[0];
+
+        for (size_t j = 1; j <= bLen; j++)
+        {
+            int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+            int best = previous[j - 1] + cost;                           // substitution (or match)
+            if (previous[j] + 1 < best) best = previous[j] + 1;          // deletion
+            if (current[j - 1] + 1 < best) best = current[j - 1] + 1;    // insertion
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] && twoBack[j - 2] + 1 < best)
+            {
+                best = twoBack[j - 2] + 1;                               // swap of adjacent letters
+            }
+            current[j] = best;
+
+            if (best < rowMinimum)
+            {
+                rowMinimum = best;
+            }
+        }
+
+        // Every later row is at least as large as this row's minimum.
+        if (rowMinimum > maxDistance)
+        {
+            return maxDistance + 1;
+        }
+
+        int* recycled = twoBack;
+        twoBack = previous;
+        previous = current;
+        current = recycled;
+    }
+
+    return previous[bLen] <= maxDistance ? previous[bLen] : maxDistance + 1;
+}
+
+// Function to hash every distinct string made by deleting up to maxDistance letters from the first
+// SYMSPELL_PREFIX_LENGTH letters of a word (the prefix itself included). Returns the number of hashes.
+int generateDeleteHashes(const char* word, size_t len, int maxDistance, uint32_t* hashes)
+{
+    char deletes[SYMSPELL_MAX_DELETES][SYMSPELL_PREFIX_LENGTH];
+    int lengths[SYMSPELL_MAX_DELETES];
+
+    int prefixLen = len < SYMSPELL_PREFIX_LENGTH ? (int)len : SYMSPELL_PREFIX_LENGTH;
+    memcpy(deletes[0], word, prefixLen);
+    lengths[0] = prefixLen;
+    hashes[0] = hashFunction(word, prefixLen);
+    int count = 1;
+
+    // Each level deletes one more letter from every string of the level before it.
+    int levelStart = 0;
+    int levelEnd = 1;
+    for (int distance = 1; distance <= maxDistance; distance++)
+    {
+        for (int i = levelStart; i < levelEnd; i++)
+        {
+            for (int position = 0; position < lengths[i]; position++)
+            {
+                // Deleting either letter of a doubled pair gives the same string.
+                if (position > 0 && deletes[i][position] == deletes[i][position - 1])
+                {
+                    continue;
+                }
+
+                char* candidate = deletes[count];
+                memcpy(candidate, deletes[i], position);
+                memcpy(candidate + position, deletes[i] + position + 1, lengths[i] - position - 1);
+                int candidateLen = lengths[i] - 1;
+                uint32_t candidateHash = hashFunction(candidate, candidateLen);
+
+                bool duplicate = false;
+                for (int k = levelEnd; k < count && !duplicate; k++)
+                {
+                    duplicate = hashes[k] == candidateHash && memcmp(deletes[k], candidate, candidateLen) == 0;
+                }
+                if (!duplicate)
+                {
+                    lengths[count] = candidateLen;
+                    hashes[count] = candidateHash;
+                    count++;
+                }
+            }
+        }
+        levelStart = levelEnd;
+        levelEnd = count;
+    }
+
+    return count;
+}
+
+// Function to sort the deletion index entries by hash (LSD radix sort, two 16-bit passes).
+void sortDeleteEntries(DeleteEntry* entries, size_t count)
+{
+    DeleteEntry* buffer = malloc(sizeof(DeleteEntry) * count);
+    size_t* counts = malloc(sizeof(size_t) * 65536);
+
+    DeleteEntry* source = entries;
+    DeleteEntry* destination = buffer;
+    for (int shift = 0; shift < 32; shift += 16)
+    {
+        memset(counts, 0, sizeof(size_t) * 65536);
+        for (size_t i = 0; i < count; i++)
+        {
+            counts[(source[i].deleteHash >> shift) & 0xFFFF]++;
+        }
+
+        size_t position = 0;
+        for (int digit = 0; digit < 65536; digit++)
+        {
+            size_t digitCount = counts[digit];
+            counts[digit] = position;
+            position += digitCount;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            destination[counts[(source[i].deleteHash >> shift) & 0xFFFF]++] = source[i];
+        }
+
+        DeleteEntry* temp = source;
+        source = destination;
+        destination = temp;
+    }
+
+    // After an even number of passes the sorted entries are back in the original array.
+    free(buffer);
+    free(counts);
+}
+
+// Function to build the symmetric delete index over every word in the hash table.
+DeleteIndex* buildDeleteIndex(openHashTable* hashTable, int maxDistance)
+{
+    DeleteIndex* index = malloc(sizeof(DeleteIndex));
+    index->maxDistance = maxDistance;
+    index->entryCount = 0;
+    size_t entryCapacity = (size_t)hashTable->count * 8 + 16;
+    index->entries = malloc(sizeof(DeleteEntry) * entryCapacity);
+
+    uint32_t hashes[SYMSPELL_MAX_DELETES];
+    for (uint32_t i = 0; i < hashTable->capacity; i++)
+    {
+        Slot slot = hashTable->slots[i];
+        if (slot.offset == EMPTY_SLOT)
+        {
+            continue;
+        }
+
+        const char* word = hashTable->arena + slot.offset;
+        int deleteCount = generateDeleteHashes(word, strlen(word), maxDistance, hashes);
+
+        if (index->entryCount + deleteCount > entryCapacity)
+        {
+            entryCapacity *= 2;
+            index->entries = realloc(index->entries, sizeof(DeleteEntry) * entryCapacity);
+        }
+        for (int k = 0; k < deleteCount; k++)
+        {
+            index->entries[index->entryCount].deleteHash = hashes[k];
+            index->entries[index->entryCount].wordOffset = slot.offset;
+            index->entryCount++;
+        }
+    }
+
+    sortDeleteEntries(index->entries, index->entryCount);
+
+    // directory[b] is the first entry whose hash has b as its top SYMSPELL_DIRECTORY_BITS bits.
+    size_t directorySize = ((size_t)1 << SYMSPELL_DIRECTORY_BITS) + 1;
+    index->directory = malloc(sizeof(uint32_t) * directorySize);
+    size_t entry = 0;
+    for (size_t bucket = 0; bucket < directorySize; bucket++)
+    {
+        while (entry < index->entryCount && (index->entries[entry].deleteHash >> (32 - SYMSPELL_DIRECTORY_BITS)) < bucket)
+        {
+            entry++;
+        }
+        index->directory[bucket] = (uint32_t)entry;
+    }
+
+    return index;
+}
+
+// Orders candidate offsets so that duplicates end up next to each other.
+int compareOffsets(const void* a, const void* b)
+{
+    uint32_t first = *(const uint32_t*)a;
+    uint32_t second = *(const uint32_t*)b;
+
+    return (first > second) - (first < second);
+}
+
+// Function to offer the learned words within maxDistance of a word as suggestions.
+// Learned words are few, so they are compared directly.
+void addLearnedSuggestions(LearnedWords* learned, const char* word, size_t len, int maxDistance, SuggestionCollector* collector)
+{
+    uint32_t learnedCount = learned != NULL ? learnedWordCount(learned) : 0;
+    if (learnedCount == 0)
+    {
+        return;
+    }
+
+    // Retired generations stay allocated, so the suggestions may point into this one after it is replaced.
+    LearnedGeneration* generation = currentLearnedGeneration(learned);
+    for (uint32_t i = 0; i < learnedCount; i++)
+    {
+        const char* candidate = generation->arena + generation->offsets[i];
+        int distance = editDistance(word, len, candidate, strlen(candidate), maxDistance);
+        if (distance <= maxDistance)
+        {
+            addSuggestion(collector, candidate, distance, 0);
+        }
+    }
+}
+
+// Function to find the dictionary words within maxDistance of a word through the deletion index, closest
+// first. With limit > 0 only the best `limit` are returned. *suggestions must be freed by the caller.
+int findSymSpellSuggestions(DeleteIndex* index, openHashTable* hashTable, LearnedWords* learned, const char* word, size_t len, int limit, RankedSuggestion** suggestions)
+{
+    int maxDistance = index->maxDistance;
+    uint32_t hashes[SYMSPELL_MAX_DELETES];
+    int deleteCount = generateDeleteHashes(word, len, maxDistance, hashes);
+
+    // Every dictionary word sharing a delete with the word is a candidate.
+    size_t candidateCount = 0;
+    size_t candidateCapacity = 64;
+    uint32_t* candidates = malloc(sizeof(uint32_t) * candidateCapacity);
+
+    for (int k = 0; k < deleteCount; k++)
+    {
+        uint32_t bucket = hashes[k] >> (32 - SYMSPELL_DIRECTORY_BITS);
+        for (uint32_t e = index->directory[bucket]; e < index->directory[bucket + 1]; e++)
+        {
+            if (index->entries[e].deleteHash != hashes[k])
+            {
+                continue;
+            }
+            if (candidateCount == candidateCapacity)
+            {
+                candidateCapacity *= 2;
+                candidates = realloc(candidates, sizeof(uint32_t) * candidateCapacity);
+            }
+            candidates[candidateCount++] = index->entries[e].wordOffset;
+        }
+    }
+    qsort(candidates, candidateCount, sizeof(uint32_t), compareOffsets);
+
+    // Keep the candidates that really are within maxDistance (shared deletes of the prefix are only a filter).
+    SuggestionCollector collector;
+    initSuggestionCollector(&collector, limit, true);
+    for (size_t c = 0; c < candidateCount; c++)
+    {
+        if (c > 0 && candidates[c] == candidates[c - 1])
+        {
+            continue;
+        }
+
+        const char* candidate = hashTable->arena + candidates[c];
+        size_t candidateLen = strlen(candidate);
+        int distance = editDistance(word, len, candidate, candidateLen, maxDistance);
+        if (distance <= maxDistance)
+        {
+            addSuggestion(&collector, candidate, distance, wordFrequency(hashTable, candidate, candidateLen));
+        }
+    }
+    free(candidates);
+    addLearnedSuggestions(learned, word, len, maxDistance, &collector);
+
+    return finishSuggestions(&collector, suggestions);
+}
+
+// Function to free the deletion index.
+void freeDeleteIndex(DeleteIndex* index)
+{
+    free(index->directory);
+    free(index->entries);
+    free(index);
+}
+
+// Function to add a node to the trie. Returns its index.
+uint32_t newTrieNode(Trie* trie, char letter)
+{
+    if (trie->nodeCount == trie->nodeCapacity)
+    {
+        trie->nodeCapacity *= 2;
+        trie->nodes = realloc(trie->nodes, sizeof(TrieNode) * trie->nodeCapacity);
+    }
+
+    TrieNode* node = &trie->nodes[trie->nodeCount];
+    node->firstChild = NO_TRIE_NODE;
+    node->nextSibling = NO_TRIE_NODE;
+    node->wordOffset = EMPTY_SLOT;
+    node->letter = letter;
+
+    return trie->nodeCount++;
+}
+
+// Function to build a trie over every word in the hash table. The words are inserted in sorted order,
+// so each new word only shares the path of the previous one and every child list comes out sorted.
+Trie* buildTrie(openHashTable* hashTable)
+{
+    uint32_t* offsets = malloc(sizeof(uint32_t) * (hashTable->count + 1));
+    uint32_t wordCount = 0;
+    for (uint32_t i = 0; i < hashTable->capacity; i++)
+    {
+        if (hashTable->slots[i].offset != EMPTY_SLOT)
+        {
+            offsets[wordCount++] = hashTable->slots[i].offset;
+        }
+    }
+    sortingArena = hashTable->arena;
+    qsort(offsets, wordCount, sizeof(uint32_t), compareArenaWords);
+
+    Trie* trie = malloc(sizeof(Trie));
+    trie->nodeCapacity = 1024;
+    trie->nodeCount = 0;
+    trie->nodes = malloc(sizeof(TrieNode) * trie->nodeCapacity);
+    newTrieNode(trie, '\0');
+
+    // path[d] is the node for the first d letters of the previous word.
+    uint32_t* path = malloc(sizeof(uint32_t) * (MAX_WORD_LENGTH + 1));
+    size_t pathCapacity = MAX_WORD_LENGTH + 1;
+    const char* previous = "";
+    size_t previousLen = 0;
+    path[0] = 0;
+
+    for (uint32_t w = 0; w < wordCount; w++)
+    {
+        const char* word = hashTable->arena + offsets[w];
+        size_t len = strlen(word);
+        if (len + 1 > pathCapacity)
+        {
+            pathCapacity = len + 1;
+            path = realloc(path, sizeof(uint32_t) * pathCapacity);
+        }
+
+        size_t common = 0;
+        while (common < len && common < previousLen && word[common] == previous[common])
+        {
+            common++;
+        }
+
+        for (size_t depth = common; depth < len; depth++)
+        {
+            uint32_t child = newTrieNode(trie, word[depth]);
+            if (depth == common && common < previousLen)
+            {
+                trie->nodes[path[depth + 1]].nextSibling = child;   // the previous word's node is the last child so far
+            } else
+            {
+                trie->nodes[path[depth]].firstChild = child;
+            }
+            path[depth + 1] = child;
+        }
+        trie->nodes[path[len]].wordOffset = offsets[w];
+
+        previous = word;
+        previousLen = len;
+    }
+
+    free(path);
+    free(offsets);
+
+    return trie;
+}
+
+// Function to record a word found by the trie walk. With a limit, only the best `limit` words are kept:
+// closest first and, because the walk is alphabetical, the earlier word wins a tie.
+void addTrieResult(TrieSearch* search, const char* word, int distance, uint32_t frequency)
+{
+    RankedSuggestion result;
+    result.word = word;
+    result.distance = distance;
+    result.frequency = frequency;
+
+    // Words come in alphabetical order, so without frequencies a word as close as the worst one kept is worse.
+    if (search->limit > 0 && search->count == search->limit)
+    {
+        if (compareSuggestions(&result, &search->results[search->count - 1]) >= 0)
+        {
+            return;
+        }
+        search->count--;
+    }
+
+    if (search->count == search->capacity)
+    {
+        search->capacity *= 2;
+        search->results = realloc(search->results, sizeof(RankedSuggestion) * search->capacity);
+    }
+
+    int position = search->count;
+    while (position > 0 && compareSuggestions(&search->results[position - 1], &result) > 0)
+    {
+        search->results[position] = search->results[position - 1];
+        position--;
+    }
+    search->results[position] = result;
+    search->count++;
+}
+
+// The walk only needs words within this distance: the maximum, or less once the top-k are all closer.
+// With frequencies, a word as close as the worst one kept can still replace it if it is more frequent.
+static inline int trieSearchBound(TrieSearch* search)
+{
+    if (search->limit > 0 && search->count == search->limit)
+    {
+        return search->results[search->count - 1].distance - (search->ranksByFrequency ? 0 : 1);
+    }
+    return search->maxDistance;
+}
+
+// Function to visit the children of a node at the given depth. rows[depth] already holds the DP row
+// (edit distances from the query's prefixes to the node's path) of the node itself.
+void searchTrieChildren(Trie* trie, openHashTable* hashTable, TrieSearch* search, uint32_t node, int depth)
+{
+    const char* query = search->query;
+    int queryLen = search->queryLen;
+    int maxDistance = search->maxDistance;
+    int* previous = search->rows[depth];
+    int* current = search->rows[depth + 1];
+
+    // Cells further than maxDistance from the diagonal can never be within maxDistance, so only the band
+    // low..high is computed and the cells just outside it are set to maxDistance + 1.
+    int row = depth + 1;
+    int low = row - maxDistance > 1 ? row - maxDistance : 1;
+    int high = row + maxDistance < queryLen ? row + maxDistance : queryLen;
+
+    for (uint32_t child = trie->nodes[node].firstChild; child != NO_TRIE_NODE; child = trie->nodes[child].nextSibling)
+    {
+        char letter = trie->nodes[child].letter;
+        search->path[depth + 1] = letter;
+
+        current[low - 1] = low == 1 ? row : maxDistance + 1;
+        if (high < queryLen)
+        {
+            current[high + 1] = maxDistance + 1;
+        }
+        int rowMinimum = low == 1 ? row : maxDistance + 1;
+        for (int j = low; j <= high; j++)
+        {
+            int cost = query[j - 1] == letter ? 0 : 1;
+            int best = previous[j - 1] + cost;
+            if (previous[j] + 1 < best) best = previous[j] + 1;
+            if (current[j - 1] + 1 < best) best = current[j - 1] + 1;
+            if (depth >= 1 && j > 1 && letter == query[j - 2] && search->path[depth] == query[j - 1] && search->rows[depth - 1][j - 2] + 1 < best)
+            {
+                best = search->rows[depth - 1][j - 2] + 1;
+            }
+            current[j] = best;
+            if (best < rowMinimum)
+            {
+                rowMinimum = best;
+            }
+        }
+
+        if (trie->nodes[child].wordOffset != EMPTY_SLOT && high == queryLen && low <= queryLen + 1 && current[queryLen] <= trieSearchBound(search))
+        {
+            const char* found = hashTable->arena + trie->nodes[child].wordOffset;
+            addTrieResult(search, found, current[queryLen], search->ranksByFrequency ? wordFrequency(hashTable, found, depth + 1) : 0);
+        }
+
+        // No cell of a deeper row can be smaller than the smallest cell of this one, so the whole subtree is skipped.
+        if (rowMinimum <= trieSearchBound(search) && depth + 1 < TRIE_MAX_DEPTH)
+        {
+            searchTrieChildren(trie, hashTable, search, child, depth + 1);
+        }
+    }
+}
+
+// Function to find the dictionary words within maxDistance of a word by walking the trie, closest first.
+// With limit > 0 only the best `limit` words are returned. *suggestions must be freed by the caller.
+int findTrieSuggestions(Trie* trie, openHashTable* hashTable, LearnedWords* learned, const char* word, size_t len, int maxDistance, int limit, RankedSuggestion** suggestions)
+{
+    *suggestions = NULL;
+    if (len > MAX_WORD_LENGTH)
+    {
+        return 0;
+    }
+
+    TrieSearch* search = malloc(sizeof(TrieSearch));
+    search->query = word;
+    search->queryLen = len;
+    search->maxDistance = maxDistance;
+    search->limit = limit;
+    search->ranksByFrequency = hashTable->frequencies != NULL;
+    search->count = 0;
+    search->capacity = limit > 0 ? limit : 16;
+    search->results = malloc(sizeof(RankedSuggestion) * search->capacity);
+
+    for (size_t j = 0; j <= len; j++)
+    {
+        search->rows[0][j] = j;
+    }
+    searchTrieChildren(trie, hashTable, search, 0, 0);
+
+    int count = search->count;
+    *suggestions = search->results;
+    free(search);
+
+    // The walk kept the best `limit` dictionary words, so the best of those and the learned words are the best overall.
+    if (learned != NULL && learnedWordCount(learned) > 0)
+    {
+        SuggestionCollector collector;
+        initSuggestionCollector(&collector, limit, true);
+        for (int i = 0; i < count; i++)
+        {
+            addSuggestion(&collector, (*suggestions)[i].word, (*suggestions)[i].distance, (*suggestions)[i].frequency);
+        }
+        addLearnedSuggestions(learned, word, len, maxDistance, &collector);
+        free(*suggestions);
+        count = finishSuggestions(&collector, suggestions);
+    }
+    return count;
+}
+
+// Function to free the trie.
+void freeTrie(Trie* trie)
+{
+    free(trie->nodes);
+    free(trie);
+}
+
+// Function to free the hash table. The words live in the arena, so this is three frees no matter how many words there are.
+void freeHashTable(openHashTable* hashTable) {
+    if (!hashTable->slotsAreMapped)
+    {
+        free(hashTable->slots);
+    }
+    if (!hashTable->arenaIsMapped)
+    {
+        free(hashTable->arena);
+    }
+    if (hashTable->mapping != NULL)
+    {
+        munmap(hashTable->mapping, hashTable->mappingLength);
+    }
+    if (hashTable->bloom != NULL)
+    {
+        free(hashTable->bloom->blocks);
+        free(hashTable->bloom);
+    }
+    free(hashTable->frequencies);
+    if (hashTable->perfect != NULL)
+    {
+        freePerfectHash(hashTable->perfect);
+    }
+    if (hashTable->frontCoded != NULL)
+    {
+        freeFrontCodedDictionary(hashTable->frontCoded);
+    }
+    free(hashTable);
+}
+
+
+// Function to find the next '\n' at or after start, or return end if there is none.
+// With SSE2 it compares 16 bytes at a time and only looks at single bytes around a hit.
+const char* findNewline(const char* start, const char* end)
+{
+#ifdef __SSE2__
+    const __m128i newlines = _mm_set1_epi8('\n');
+    while (end - start >= 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)start);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+        if (mask != 0)
+        {
+            return start + __builtin_ctz(mask);
+        }
+        start += 16;
+    }
+#endif
+    const char* newline = memchr(start, '\n', end - start);
+    return newline != NULL ? newline : end;
+}
+
+// Function to insert a batch of words that already sit in the arena. All the hashes are computed and
+// their home slots prefetched before the first insertion, so the cache misses of the batch overlap.
+void insertArenaWordsBulk(openHashTable* hashTable, const uint32_t* offsets, const uint32_t* lengths, int count)
+{
+    uint32_t hashes[BULK_INSERT_BATCH];
+
+    // Growing in the middle of the batch would make the prefetches useless, so make room first.
+    while ((size_t)(hashTable->count + count) * MAX_LOAD_DENOMINATOR > (size_t)hashTable->capacity * MAX_LOAD_NUMERATOR)
+    {
+        growHashTable(hashTable);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        hashes[i] = hashFunction(hashTable->arena + offsets[i], lengths[i]);
+        __builtin_prefetch(&hashTable->slots[hashes[i] & hashTable->mask]);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        // Dictionary files can list a word twice.
+        if (!lookupHashedWord(hashTable, hashTable->arena + offsets[i], lengths[i], hashes[i]))
+        {
+            insertArenaWord(hashTable, offsets[i], hashes[i]);
+        }
+    }
+}
+
+// Function to check for the blanks that separate dictionary words, the same ones fscanf's "%s" skips.
+bool isDictionaryBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Function to load a dictionary file (usually one word per line) into a new hash table in a single pass.
+// The file is memory-mapped privately and becomes the table's arena: the blank or line end after each word
+// is overwritten with '\0' in place, so no word is ever copied. Like the fscanf loop this replaced, words are
+// split on any whitespace, so leading blanks are skipped and a line can hold several words.
+// Returns NULL if the file cannot be read.
+openHashTable* loadDictionary(const char* dictionaryFilePath)
+{
+    int fd = open(dictionaryFilePath, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+    size_t fileSize = fileInfo.st_size;
+
+    openHashTable* hashTable = createHashTable(fileSize / AVERAGE_DICTIONARY_LINE);
+    if (fileSize == 0)
+    {
+        close(fd);
+        return hashTable;
+    }
+
+    // Reserve one byte past the end of the file (zero-filled anonymous memory) so that the last word
+    // gets its '\0' even when the file does not end with a newline, then map the file over the start.
+    size_t mappedLength = fileSize + 1;
+    char* base = mmap(NULL, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED || mmap(base, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        if (base != MAP_FAILED)
+        {
+            munmap(base, mappedLength);
+        }
+        close(fd);
+        freeHashTable(hashTable);
+        return NULL;
+    }
+    close(fd);
+    madvise(base, fileSize, MADV_SEQUENTIAL);
+
+    free(hashTable->arena);
+    hashTable->arena = base;
+    hashTable->arenaSize = mappedLength;
+    hashTable->arenaCapacity = mappedLength;
+    hashTable->arenaIsMapped = true;
+    hashTable->mapping = base;
+    hashTable->mappingLength = mappedLength;
+
+    uint32_t offsets[BULK_INSERT_BATCH];
+    uint32_t lengths[BULK_INSERT_BATCH];
+    int batchSize = 0;
+
+    const char* end = base + fileSize;
+    char* lineStart = base;
+    while (lineStart < end)
+    {
+        char* lineEnd = (char*)findNewline(lineStart, end);
+        *lineEnd = '\0';
+
+        // Blanks around and between the words of the line, such as '\r' from Windows line endings, are not part of them.
+        char* wordStart = lineStart;
+        while (true)
+        {
+            while (wordStart < lineEnd && isDictionaryBlank(*wordStart))
+            {
+                wordStart++;
+            }
+            if (wordStart == lineEnd)
+            {
+                break;
+            }
+            char* wordEnd = wordStart;
+            while (wordEnd < lineEnd && !isDictionaryBlank(*wordEnd))
+            {
+                wordEnd++;
+            }
+            *wordEnd = '\0';
+
+            offsets[batchSize] = (uint32_t)(wordStart - base);
+            lengths[batchSize] = (uint32_t)(wordEnd - wordStart);
+            batchSize++;
+
+            if (batchSize == BULK_INSERT_BATCH)
+            {
+                insertArenaWordsBulk(hashTable, offsets, lengths, batchSize);
+                batchSize = 0;
+            }
+            wordStart = wordEnd == lineEnd ? lineEnd : wordEnd + 1;
+        }
+        lineStart = lineEnd + 1;
+    }
+    insertArenaWordsBulk(hashTable, offsets, lengths, batchSize);
+
+    return hashTable;
+}
+
+// Function to compute a 64-bit checksum of a block of memory, eight bytes at a time.
+uint64_t checksum64(const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
+    uint64_t checksum = 0x9E3779B97F4A7C15ull ^ size;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        checksum = (checksum ^ word) * 0x100000001B3ull;
+        checksum ^= checksum >> 29;
+    }
+    for (; i < size; i++)
+    {
+        checksum = (checksum ^ bytes[i]) * 0x100000001B3ull;
+    }
+
+    return checksum ^ (checksum >> 32);
+}
+
+// Function to build the path of a file kept next to the dictionary: the dictionary path followed by an extension.
+char* pathWithExtension(const char* dictionaryFilePath, const char* extension)
+{
+    char* path = malloc(strlen(dictionaryFilePath) + strlen(extension) + 1);
+    strcpy(path, dictionaryFilePath);
+    strcat(path, extension);
+
+    return path;
+}
+
+// Function to build the snapshot path for a dictionary: the dictionary path followed by SNAPSHOT_EXTENSION.
+char* snapshotPathFor(const char* dictionaryFilePath)
+{
+    return pathWithExtension(dictionaryFilePath, SNAPSHOT_EXTENSION);
+}
+
+// Function to write the hash table as a snapshot of the dictionary described by sourceInfo.
+// The image is written to a temporary file and renamed, so readers never see half a snapshot.
+// Returns false if the snapshot could not be written.
+bool writeSnapshot(openHashTable* hashTable, const struct stat* sourceInfo, const char* snapshotPath)
+{
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.hashVersion = activeHash->id;
+    header.sourceSize = sourceInfo->st_size;
+    header.sourceMtimeSeconds = sourceInfo->st_mtim.tv_sec;
+    header.sourceMtimeNanoseconds = sourceInfo->st_mtim.tv_nsec;
+    header.capacity = hashTable->capacity;
+    header.count = hashTable->count;
+    header.slotsOffset = SNAPSHOT_ALIGNMENT;
+    header.arenaOffset = header.slotsOffset + sizeof(Slot) * (uint64_t)hashTable->capacity;
+    header.arenaSize = hashTable->arenaSize;
+    if (hashTable->perfect != NULL)
+    {
+        header.perfectHashOffset = (header.arenaOffset + header.arenaSize + 63) / 64 * 64;
+        header.perfectHashSize = hashTable->perfect->imageSize;
+    }
+    header.payloadChecksum = checksum64(hashTable->slots, sizeof(Slot) * (size_t)hashTable->capacity)
+                           ^ checksum64(hashTable->arena, hashTable->arenaSize);
+    if (hashTable->perfect != NULL)
+    {
+        header.payloadChecksum ^= checksum64(hashTable->perfect->image, hashTable->perfect->imageSize);
+    }
+    header.headerChecksum = checksum64(&header, offsetof(SnapshotHeader, headerChecksum));
+
+    char* temporaryPath = malloc(strlen(snapshotPath) + 5);
+    strcpy(temporaryPath, snapshotPath);
+    strcat(temporaryPath, ".tmp");
+
+    FILE* snapshotFile = fopen(temporaryPath, "wb");
+    if (snapshotFile == NULL)
+    {
+        free(temporaryPath);
+        return false;
+    }
+
+    char padding[SNAPSHOT_ALIGNMENT] = {0};
+    bool written = fwrite(&header, sizeof(header), 1, snapshotFile) == 1
+                && fwrite(padding, SNAPSHOT_ALIGNMENT - sizeof(header), 1, snapshotFile) == 1
+                && fwrite(hashTable->slots, sizeof(Slot), hashTable->capacity, snapshotFile) == hashTable->capacity
+                && fwrite(hashTable->arena, 1, hashTable->arenaSize, snapshotFile) == hashTable->arenaSize;
+    if (written && hashTable->perfect != NULL)
+    {
+        size_t gap = header.perfectHashOffset - (header.arenaOffset + header.arenaSize);
+        written = (gap == 0 || fwrite(padding, gap, 1, snapshotFile) == 1)
+               && fwrite(hashTable->perfect->image, hashTable->perfect->imageSize, 1, snapshotFile) == 1;
+    }
+    written = (fclose(snapshotFile) == 0) && written;
+
+    if (written)
+    {
+        written = rename(temporaryPath, snapshotPath) == 0;
+    }
+    if (!written)
+    {
+        remove(temporaryPath);
+    }
+    free(temporaryPath);
+
+    return written;
+}
+
+// Function to map a snapshot and use it as a hash table without parsing or hashing anything.
+// Returns NULL if there is no snapshot, or if it is corrupt, from another version, or older than
+// the dictionary described by sourceInfo. The mapping is private, so add mode can still insert.
+openHashTable* loadSnapshot(const char* snapshotPath, const struct stat* sourceInfo)
+{
+    int fd = open(snapshotPath, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat snapshotInfo;
+    if (fstat(fd, &snapshotInfo) == -1 || (size_t)snapshotInfo.st_size < SNAPSHOT_ALIGNMENT)
+    {
+        close(fd);
+        return NULL;
+    }
+    size_t snapshotSize = snapshotInfo.st_size;
+
+    char* base = mmap(NULL, snapshotSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, base, sizeof(header));
+
+    bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0
+              && header.version == SNAPSHOT_VERSION
+              && header.hashVersion == activeHash->id
+              && header.headerChecksum == checksum64(&header, offsetof(SnapshotHeader, headerChecksum))
+              && header.sourceSize == (uint64_t)sourceInfo->st_size
+              && header.sourceMtimeSeconds == sourceInfo->st_mtim.tv_sec
+              && header.sourceMtimeNanoseconds == sourceInfo->st_mtim.tv_nsec
+              && header.capacity != 0 && (header.capacity & (header.capacity - 1)) == 0
+              && header.slotsOffset + sizeof(Slot) * (uint64_t)header.capacity <= header.arenaOffset
+              && header.arenaOffset + header.arenaSize <= snapshotSize
+              && (header.perfectHashSize == 0
+                  || (header.perfectHashOffset % 64 == 0 && header.perfectHashOffset >= header.arenaOffset + header.arenaSize
+                      && header.perfectHashSize >= sizeof(PerfectHashImage)
+                      && header.perfectHashOffset + header.perfectHashSize <= snapshotSize));
+
+    // The perfect hash's own counts must describe exactly the image that was stored.
+    PerfectHashImage* perfectImage = header.perfectHashSize != 0 ? (PerfectHashImage*)(base + header.perfectHashOffset) : NULL;
+    if (valid && perfectImage != NULL)
+    {
+        valid = perfectImage->levelCount <= MPH_MAX_LEVELS
+             && (perfectImage->fallbackCapacity & (perfectImage->fallbackCapacity - 1)) == 0
+             && perfectImage->blockCount <= header.perfectHashSize
+             && perfectHashImageSize(perfectImage->blockCount, perfectImage->entryCount, perfectImage->fallbackCapacity) == header.perfectHashSize;
+    }
+
+    if (valid)
+    {
+        uint64_t payloadChecksum = checksum64(base + header.slotsOffset, sizeof(Slot) * (size_t)header.capacity)
+                                 ^ checksum64(base + header.arenaOffset, header.arenaSize);
+        if (perfectImage != NULL)
+        {
+            payloadChecksum ^= checksum64(perfectImage, header.perfectHashSize);
+        }
+        valid = payloadChecksum == header.payloadChecksum;
+    }
+    if (!valid)
+    {
+        munmap(base, snapshotSize);
+        return NULL;
+    }
+
+    openHashTable* hashTable = malloc(sizeof(openHashTable));
+    hashTable->capacity = header.capacity;
+    hashTable->mask = header.capacity - 1;
+    hashTable->count = header.count;
+    hashTable->slots = (Slot*)(base + header.slotsOffset);
+    hashTable->arena = base + header.arenaOffset;
+    hashTable->arenaSize = header.arenaSize;
+    hashTable->arenaCapacity = header.arenaSize;
+    hashTable->arenaIsMapped = true;
+    hashTable->slotsAreMapped = true;
+    hashTable->mapping = base;
+    hashTable->mappingLength = snapshotSize;
+    hashTable->bloom = NULL;
+    hashTable->frequencies = NULL;
+    hashTable->perfect = NULL;
+    hashTable->frontCoded = NULL;
+    if (perfectImage != NULL)
+    {
+        hashTable->perfect = malloc(sizeof(PerfectHash));
+        attachPerfectHash(hashTable->perfect, perfectImage, header.perfectHashSize, true);
+    }
+
+    return hashTable;
+}
+
+// Function to open a dictionary for checking. A valid snapshot next to the text file is mapped and
+// used directly; otherwise the table is rebuilt from the text file. Returns NULL if neither works.
+openHashTable* openDictionary(const char* dictionaryFilePath)
+{
+    struct stat sourceInfo;
+    if (stat(dictionaryFilePath, &sourceInfo) == -1)
+    {
+        return NULL;
+    }
+
+    char* snapshotPath = snapshotPathFor(dictionaryFilePath);
+    openHashTable* hashTable = loadSnapshot(snapshotPath, &sourceInfo);
+
+    if (hashTable == NULL && access(snapshotPath, F_OK) == 0)
+    {
+        fprintf(stderr, "Ignoring stale or damaged snapshot %s, rebuilding from %s\n", snapshotPath, dictionaryFilePath);
+    }
+    free(snapshotPath);
+
+    if (hashTable == NULL)
+    {
+        hashTable = loadDictionary(dictionaryFilePath);
+    }
+
+    return hashTable;
+}
+
+// Function to build the table from the text dictionary and write it as a snapshot, with a minimal perfect
+// hash if options->perfectHash is set. Stores the number of words in *wordCount. Returns false, after saying
+// why on stderr, if that did not work.
+bool buildSnapshot(const char* dictionaryFilePath, const char* snapshotPath, const CheckOptions* options, uint32_t* wordCount)
+{
+    struct stat sourceInfo;
+    openHashTable* hashTable = NULL;
+
+    if (stat(dictionaryFilePath, &sourceInfo) == 0)
+    {
+        hashTable = loadDictionary(dictionaryFilePath);
+    }
+    if (hashTable == NULL)
+    {
+        fprintf(stderr, "Error opening file\n");
+        return false;
+    }
+
+    // If the file changed while it was loading, the snapshot would carry the old time and never look stale.
+    struct stat loadedInfo;
+    if (stat(dictionaryFilePath, &loadedInfo) == -1 || loadedInfo.st_size != sourceInfo.st_size
+        || loadedInfo.st_mtim.tv_sec != sourceInfo.st_mtim.tv_sec || loadedInfo.st_mtim.tv_nsec != sourceInfo.st_mtim.tv_nsec)
+    {
+        fprintf(stderr, "%s changed while it was being compiled\n", dictionaryFilePath);
+        freeHashTable(hashTable);
+        return false;
+    }
+
+    if (options->perfectHash)
+    {
+        hashTable->perfect = buildPerfectHash(hashTable, options->threadCount == 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : options->threadCount);
+    }
+    if (!writeSnapshot(hashTable, &sourceInfo, snapshotPath))
+    {
+        fprintf(stderr, "Could not write snapshot %s\n", snapshotPath);
+        freeHashTable(hashTable);
+        return false;
+    }
+
+    *wordCount = hashTable->count;
+    freeHashTable(hashTable);
+
+    return true;
+}
+
+// Function for "compile" mode: build the table from the text dictionary and write it as a snapshot.
+int compileDictionary(const char* dictionaryFilePath, const char* snapshotPath, const CheckOptions* options)
+{
+    uint32_t wordCount;
+    if (!buildSnapshot(dictionaryFilePath, snapshotPath, options, &wordCount))
+    {
+        return 1;
+    }
+
+    printf("Compiled %u words into %s\n", wordCount, snapshotPath);
+    return 0;
+}
+
+// Function for "prefix" mode: print every dictionary word that starts with prefix, one per line, in sorted order.
+int listPrefix(const char* dictionaryFilePath, const char* prefix)
+{
+    openHashTable* hashTable = openDictionary(dictionaryFilePath);
+    if (hashTable == NULL)
+    {
+        fprintf(stderr, "Error opening file\n");
+        return 1;
+    }
+    convertToFrontCoded(hashTable);
+
+    FrontCodedIterator iterator;
+    initFrontCodedIterator(&iterator, hashTable->frontCoded, prefix, strlen(prefix));
+    for (const char* word = nextFrontCodedWord(&iterator); word != NULL; word = nextFrontCodedWord(&iterator))
+    {
+        printf("%s\n", word);
+    }
+    freeFrontCodedIterator(&iterator);
+    freeHashTable(hashTable);
+
+    return 0;
+}
+
+
+// Function to find the suggestions for a misspelled word with the checker's method and options.
+// Returns their number; *suggestions must be freed by the caller.
+int findCheckerSuggestions(SpellChecker* checker, char* word, RankedSuggestion** suggestions)
+{
+    if (checker->deleteIndex != NULL)
+    {
+        return findSymSpellSuggestions(checker->deleteIndex, checker->dictionary, checker->learned, word, strlen(word), checker->options.limit, suggestions);
+    } else if (checker->trie != NULL)
+    {
+        return findTrieSuggestions(checker->trie, checker->dictionary, checker->learned, word, strlen(word),
+                                   checker->options.maxDistance, checker->options.limit, suggestions);
+    }
+    return findSuggestions(checker->dictionary, checker->learned, word, checker->options.limit, suggestions);
+}
+
+// Function to create an empty suggestion cache.
+SuggestionCache* createSuggestionCache()
+{
+    SuggestionCache* cache = malloc(sizeof(SuggestionCache));
+    cache->entries = calloc(SUGGESTION_CACHE_SETS * SUGGESTION_CACHE_WAYS, sizeof(CachedSuggestions));
+    cache->hands = calloc(SUGGESTION_CACHE_SETS, sizeof(uint8_t));
+
+    return cache;
+}
+
+// Function to free the calling thread's suggestion cache, if it has one, and its last uncached list.
+// Threads that check words call it before they exit.
+void freeThreadSuggestionCache()
+{
+    free(threadUncachedSuggestions);
+    threadUncachedSuggestions = NULL;
+
+    SuggestionCache* cache = threadSuggestionCache;
+    if (cache == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < SUGGESTION_CACHE_SETS * SUGGESTION_CACHE_WAYS; i++)
+    {
+        free(cache->entries[i].word);
+        free(cache->entries[i].suggestions);
+    }
+    free(cache->entries);
+    free(cache->hands);
+    free(cache);
+    threadSuggestionCache = NULL;
+}
+
+// Function to get the suggestions for a misspelled word. Each thread keeps the suggestion lists it found
+// in a set-associative cache with CLOCK eviction inside each set, so a typo that comes back costs one
+// lookup instead of a new search. An entry is only used while no word has been learned since it was
+// made. Returns the number of suggestions; *suggestions stays valid until the next call on this thread.
+int lookupSuggestions(SpellChecker* checker, char* word, const RankedSuggestion** suggestions)
+{
+    // In add mode every misspelling is learned right after it is reported, which makes every entry stale.
+    if (checker->learnMisspellings)
+    {
+        free(threadUncachedSuggestions);
+        int count = findCheckerSuggestions(checker, word, &threadUncachedSuggestions);
+        *suggestions = threadUncachedSuggestions;
+        return count;
+    }
+
+    if (threadSuggestionCache == NULL)
+    {
+        threadSuggestionCache = createSuggestionCache();
+    }
+    SuggestionCache* cache = threadSuggestionCache;
+    size_t len = strlen(word);
+    uint32_t hash = hashFunction(word, len);
+    uint32_t learnedCount = checker->learned != NULL ? learnedWordCount(checker->learned) : 0;
+    uint32_t set = hash & (SUGGESTION_CACHE_SETS - 1);
+    CachedSuggestions* ways = &cache->entries[set * SUGGESTION_CACHE_WAYS];
+
+    for (int w = 0; w < SUGGESTION_CACHE_WAYS; w++)
+    {
+        CachedSuggestions* entry = &ways[w];
+        if (entry->word != NULL && entry->hash == hash && entry->learnedCount == learnedCount && strcmp(entry->word, word) == 0)
+        {
+            entry->referenced = true;
+            threadLookupStats.cacheHits++;
+            *suggestions = entry->suggestions;
+            return entry->count;
+        }
+    }
+    threadLookupStats.cacheMisses++;
+
+    // CLOCK: pass over the recently used entries of the set, clearing their bits, and replace the first other one.
+    uint8_t* hand = &cache->hands[set];
+    while (ways[*hand].word != NULL && ways[*hand].referenced)
+    {
+        ways[*hand].referenced = false;
+        *hand = (*hand + 1) % SUGGESTION_CACHE_WAYS;
+    }
+    CachedSuggestions* entry = &ways[*hand];
+    *hand = (*hand + 1) % SUGGESTION_CACHE_WAYS;
+
+    free(entry->word);
+    free(entry->suggestions);
+    entry->word = strdup(word);
+    entry->hash = hash;
+    entry->learnedCount = learnedCount;
+    entry->referenced = false;
+    entry->count = findCheckerSuggestions(checker, word, &entry->suggestions);
+
+    *suggestions = entry->suggestions;
+    return entry->count;
+}
+
+void printSuggestions(SpellChecker* checker, char* originalWord, OutputBuffer* output)
+{
+    const RankedSuggestion* suggestions;
+    int size = lookupSuggestions(checker, originalWord, &suggestions);
+
+    //////////////////////////////////
+    // Finally, print the suggestions
+    //////////////////////////////////
+
+    appendStringToOutput(output, "Suggestions: ");
+    for (int i = 0; i < size; i++)
+    {
+        appendStringToOutput(output, suggestions[i].word);
+        appendStringToOutput(output, " ");
+    }
+}
+
+// Function to set up a spell checker over a loaded dictionary, building the suggestion engine the options ask for.
+void initSpellChecker(SpellChecker* checker, openHashTable* dictionary, CheckOptions* options, bool learnMisspellings)
+{
+    checker->dictionary = dictionary;
+    checker->deleteIndex = NULL;
+    checker->trie = NULL;
+    checker->learned = learnMisspellings ? createLearnedWords() : NULL;
+    checker->options = *options;
+    checker->learnMisspellings = learnMisspellings;
+    checker->journal = NULL;
+    if (options->method == SUGGEST_SYMSPELL)
+    {
+        checker->deleteIndex = buildDeleteIndex(dictionary, options->maxDistance);
+    } else if (options->method == SUGGEST_TRIE)
+    {
+        checker->trie = buildTrie(dictionary);
+    }
+}
+
+// Function to free what initSpellChecker and add mode allocated. The dictionary belongs to the caller.
+void freeSpellChecker(SpellChecker* checker)
+{
+    if (checker->deleteIndex != NULL)
+    {
+        freeDeleteIndex(checker->deleteIndex);
+    }
+    if (checker->trie != NULL)
+    {
+        freeTrie(checker->trie);
+    }
+    if (checker->learned != NULL)
+    {
+        freeLearnedWords(checker->learned);
+    }
+}
+
+// Function to read exactly size bytes from a socket or file. Returns false at end of file or on an error.
+bool readFully(int fd, void* buffer, size_t size)
+{
+    char* position = buffer;
+    while (size > 0)
+    {
+        ssize_t bytesRead = read(fd, position, size);
+        if (bytesRead == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesRead <= 0)
+        {
+            return false;
+        }
+        position += bytesRead;
+        size -= bytesRead;
+    }
+    return true;
+}
+
+// Function to write exactly size bytes to a socket or file. Returns false if the other side is gone or the write fails.
+bool writeFully(int fd, const void* buffer, size_t size)
+{
+    const char* position = buffer;
+    while (size > 0)
+    {
+        ssize_t bytesWritten = write(fd, position, size);
+        if (bytesWritten == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytesWritten <= 0)
+        {
+            return false;
+        }
+        position += bytesWritten;
+        size -= bytesWritten;
+    }
+    return true;
+}
+
+// Function to write the words appended since the last sync to the journal and flush them to disk with one
+// fdatasync. Returns false, and stops journaling, if the journal cannot be written.
+bool syncJournal(Journal* journal)
+{
+    if (journal->failed || journal->pending.size == 0)
+    {
+        return !journal->failed;
+    }
+    if (!writeFully(journal->fd, journal->pending.data, journal->pending.size) || fdatasync(journal->fd) == -1)
+    {
+        fprintf(stderr, "Could not write journal %s: %s; added words are no longer saved\n", journal->path, strerror(errno));
+        journal->failed = true;
+        return false;
+    }
+    journal->pending.size = 0;
+    journal->pendingWords = 0;
+    return true;
+}
+
+// Function to append a learned word to the journal. Words are written and synced JOURNAL_SYNC_WORDS at a time,
+// so a crash loses at most the last batch of them.
+void appendToJournal(Journal* journal, const char* word, size_t len)
+{
+    appendToOutput(&journal->pending, word, len);
+    appendToOutput(&journal->pending, "\n", 1);
+    journal->pendingWords++;
+    journal->wordCount++;
+    if (journal->pendingWords >= JOURNAL_SYNC_WORDS)
+    {
+        syncJournal(journal);
+    }
+}
+
+// Function to sync the last words to the journal, close it and free it.
+void closeJournal(Journal* journal)
+{
+    syncJournal(journal);
+    close(journal->fd);
+    free(journal->pending.data);
+    free(journal->path);
+    free(journal);
+}
+
+// Function to learn a misspelled word in add mode. It goes into the checker's own table of learned words,
+// which every lookup and suggestion engine consults after the dictionary, and into the journal if there is one.
+// Only one thread learns words.
+void learnWord(SpellChecker* checker, const char* word, size_t len)
+{
+    if (checker->learned == NULL)
+    {
+        checker->learned = createLearnedWords();
+    }
+    if (!learnedWordsContain(checker->learned, word, len, hashFunction(word, len)))
+    {
+        addLearnedWord(checker->learned, word, len);
+        if (checker->journal != NULL)
+        {
+            appendToJournal(checker->journal, word, len);
+        }
+    }
+}
+
+// Function to write the report for one misspelled word to a chunk's output.
+// In add mode the word is also learned, so only its first occurrence is reported. A speculative chunk
+// only records the misspelling for settleChunk, which learns it if it really is the first occurrence.
+void reportMisspelling(SpellChecker* checker, CheckChunk* chunk, const char* word, size_t len)
+{
+    // Only misspelled words are copied, so the suggestion engines get a NUL-terminated string.
+    char* misspelled = malloc(len + 1);
+    memcpy(misspelled, word, len);
+    misspelled[len] = '\0';
+
+    if (chunk->speculative)
+    {
+        // Whichever way the first occurrence is settled, the word will be learned by the time a repeat is.
+        if (chunk->pendingWords == NULL)
+        {
+            chunk->pendingWords = createHashTable(0);
+        }
+        if (lookupHashedWord(chunk->pendingWords, misspelled, len, hashFunction(misspelled, len)))
+        {
+            free(misspelled);
+            return;
+        }
+        insertToHashTable(chunk->pendingWords, misspelled);
+
+        if (chunk->pendingCount == chunk->pendingCapacity)
+        {
+            chunk->pendingCapacity = chunk->pendingCapacity == 0 ? 16 : chunk->pendingCapacity * 2;
+            chunk->pending = realloc(chunk->pending, sizeof(PendingMisspelling) * chunk->pendingCapacity);
+        }
+        PendingMisspelling* pending = &chunk->pending[chunk->pendingCount++];
+        pending->word = word;
+        pending->len = len;
+        pending->learnedSeen = learnedWordCount(checker->learned);
+        pending->reportStart = chunk->output.size;
+    }
+
+    chunk->foundTypo = true;
+    appendStringToOutput(&chunk->output, "Misspelled word: ");
+    appendToOutput(&chunk->output, misspelled, len);
+    appendStringToOutput(&chunk->output, "\n");
+
+    printSuggestions(checker, misspelled, &chunk->output);
+    appendStringToOutput(&chunk->output, "\n");
+
+    if (chunk->speculative)
+    {
+        chunk->pending[chunk->pendingCount - 1].reportEnd = chunk->output.size;
+    } else if (checker->learnMisspellings)
+    {
+        learnWord(checker, misspelled, len);
+    }
+    free(misspelled);
+}
+
+// Function to tell whether a word learned after a misspelling's suggestions were computed could be one of
+// them. Ranked suggestions are within the maximum distance, and those of the three checks within 1.
+// After more than SETTLE_MAX_NEW_WORDS new words, comparing them costs more than a new report.
+bool learnedSinceCouldSuggest(SpellChecker* checker, PendingMisspelling* misspelling)
+{
+    int maxDistance = checker->deleteIndex == NULL && checker->trie == NULL ? 1 : checker->options.maxDistance;
+    uint32_t learnedCount = learnedWordCount(checker->learned);
+    LearnedGeneration* generation = currentLearnedGeneration(checker->learned);
+    if (learnedCount - misspelling->learnedSeen > SETTLE_MAX_NEW_WORDS)
+    {
+        return true;
+    }
+
+    for (uint32_t i = misspelling->learnedSeen; i < learnedCount; i++)
+    {
+        const char* learned = generation->arena + generation->offsets[i];
+        size_t learnedLen = strlen(learned);
+        size_t difference = learnedLen > misspelling->len ? learnedLen - misspelling->len : misspelling->len - learnedLen;
+        if (difference > (size_t)maxDistance)
+        {
+            continue;
+        }
+        // editDistance does not compare words this long, so count them as close.
+        if (learnedLen > MAX_WORD_LENGTH || misspelling->len > MAX_WORD_LENGTH
+            || editDistance(misspelling->word, misspelling->len, learned, learnedLen, maxDistance) <= maxDistance)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to confirm the misspellings of a speculative chunk, in input order, on the thread that writes
+// the report. A word learned earlier in the input, possibly in a chunk checked at the same time, is not
+// reported again; every other one is learned now. The worker's report is kept unless a word learned
+// since could change its suggestions, in which case it is written again.
+void settleChunk(SpellChecker* checker, CheckChunk* chunk)
+{
+    CheckChunk settled = *chunk;
+    settled.output.data = NULL;
+    settled.output.size = 0;
+    settled.output.capacity = 0;
+    settled.foundTypo = false;
+    settled.speculative = false;
+
+    for (size_t p = 0; p < chunk->pendingCount; p++)
+    {
+        PendingMisspelling* misspelling = &chunk->pending[p];
+        if (learnedWordsContain(checker->learned, misspelling->word, misspelling->len, hashFunction(misspelling->word, misspelling->len)))
+        {
+            continue;
+        }
+
+        if (learnedSinceCouldSuggest(checker, misspelling))
+        {
+            reportMisspelling(checker, &settled, misspelling->word, misspelling->len);
+        } else
+        {
+            settled.foundTypo = true;
+            appendToOutput(&settled.output, chunk->output.data + misspelling->reportStart, misspelling->reportEnd - misspelling->reportStart);
+            learnWord(checker, misspelling->word, misspelling->len);
+        }
+    }
+
+    free(chunk->output.data);
+    free(chunk->pending);
+    if (chunk->pendingWords != NULL)
+    {
+        freeHashTable(chunk->pendingWords);
+    }
+    chunk->output = settled.output;
+    chunk->foundTypo = settled.foundTypo;
+    chunk->pending = NULL;
+    chunk->pendingCount = 0;
+    chunk->pendingWords = NULL;
+}
+
+// Function to check every word of a chunk. The words are looked up straight from the input as spans,
+// each batch of them in the dictionary at once. Only the dictionary's misses are checked against the
+// learned words, one by one, since add mode can learn a word that comes again later in the same batch.
+void checkChunk(SpellChecker* checker, CheckChunk* chunk)
+{
+    Tokenizer tokenizer;
+    WordSpan spans[CHECK_SPAN_BATCH];
+    uint32_t hashes[CHECK_SPAN_BATCH];
+    uint32_t slotIndexes[CHECK_SPAN_BATCH];
+    size_t spanCount;
+    initTokenizer(&tokenizer, chunk->start, chunk->end);
+
+    while ((spanCount = nextWords(&tokenizer, spans, CHECK_SPAN_BATCH)) > 0)
+    {
+        lookupWordSlots(checker->dictionary, spans, spanCount, hashes, slotIndexes);
+        for (size_t s = 0; s < spanCount; s++)
+        {
+            if (slotIndexes[s] == EMPTY_SLOT
+                && !(checker->learned != NULL && learnedWordCount(checker->learned) > 0
+                     && learnedWordsContain(checker->learned, spans[s].start, spans[s].len, hashes[s])))
+            {
+                reportMisspelling(checker, chunk, spans[s].start, spans[s].len);
+            }
+        }
+    }
+}
+
+// Function to split the input into chunks of about CHECK_CHUNK_SIZE bytes. Each chunk boundary is moved
+// forward to a delimiter, so no word is split between two chunks. Returns the number of chunks.
+size_t splitIntoChunks(const char* input, size_t inputSize, CheckChunk** chunks)
+{
+    size_t capacity = inputSize / CHECK_CHUNK_SIZE + 1;
+    *chunks = malloc(sizeof(CheckChunk) * capacity);
+
+    size_t count = 0;
+    const char* start = input;
+    const char* end = input + inputSize;
+    while (start < end)
+    {
+        const char* chunkEnd = (size_t)(end - start) > CHECK_CHUNK_SIZE ? start + CHECK_CHUNK_SIZE : end;
+        while (chunkEnd < end && !isDelimiter[(unsigned char)*chunkEnd])
+        {
+            chunkEnd++;
+        }
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            *chunks = realloc(*chunks, sizeof(CheckChunk) * capacity);
+        }
+        CheckChunk* chunk = &(*chunks)[count++];
+        chunk->start = start;
+        chunk->end = chunkEnd;
+        chunk->output.data = NULL;
+        chunk->output.size = 0;
+        chunk->output.capacity = 0;
+        chunk->foundTypo = false;
+        chunk->done = false;
+        chunk->speculative = false;
+        chunk->pending = NULL;
+        chunk->pendingCount = 0;
+        chunk->pendingCapacity = 0;
+        chunk->pendingWords = NULL;
+
+        start = chunkEnd;
+    }
+
+    return count;
+}
+
+// Worker thread for parallel checking: takes the next unchecked chunk until there are none left,
+// but never runs more than `window` chunks ahead of the chunk the main thread is writing.
+void* checkWorker(void* argument)
+{
+    ParallelCheck* parallel = argument;
+
+    while (true)
+    {
+        pthread_mutex_lock(&parallel->lock);
+        while (parallel->nextChunk < parallel->chunkCount && parallel->nextChunk >= parallel->nextToWrite + parallel->window)
+        {
+            pthread_cond_wait(&parallel->chunkWritten, &parallel->lock);
+        }
+        if (parallel->nextChunk == parallel->chunkCount)
+        {
+            pthread_mutex_unlock(&parallel->lock);
+            break;
+        }
+        CheckChunk* chunk = &parallel->chunks[parallel->nextChunk++];
+        pthread_mutex_unlock(&parallel->lock);
+
+        checkChunk(parallel->checker, chunk);
+
+        pthread_mutex_lock(&parallel->lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&parallel->chunkDone);
+        pthread_mutex_unlock(&parallel->lock);
+    }
+
+    freeThreadSuggestionCache();
+    mergeLookupStats();
+    return NULL;
+}
+
+// Function to check the whole input and write the report to the report file in input order. With more than one
+// thread the chunks are checked by a worker pool against the shared dictionary, and the main thread
+// writes each chunk's output as soon as it and every chunk before it are done, so the report is
+// byte-identical to the serial one. In add mode the workers only read the learned words; the main thread
+// learns them while it settles each chunk in order. Returns true if any word was misspelled.
+bool checkInput(SpellChecker* checker, const char* input, size_t inputSize, int threadCount, FILE* report)
+{
+    CheckChunk* chunks;
+    size_t chunkCount = splitIntoChunks(input, inputSize, &chunks);
+    bool foundTypo = false;
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        chunks[i].speculative = threadCount > 1 && checker->learnMisspellings;
+    }
+
+    ParallelCheck parallel;
+    pthread_t* workers = NULL;
+    if (threadCount > 1)
+    {
+        parallel.checker = checker;
+        parallel.chunks = chunks;
+        parallel.chunkCount = chunkCount;
+        parallel.nextChunk = 0;
+        parallel.nextToWrite = 0;
+        parallel.window = (size_t)threadCount * MAX_CHUNKS_IN_FLIGHT_PER_THREAD;
+        pthread_mutex_init(&parallel.lock, NULL);
+        pthread_cond_init(&parallel.chunkDone, NULL);
+        pthread_cond_init(&parallel.chunkWritten, NULL);
+
+        workers = malloc(sizeof(pthread_t) * threadCount);
+        for (int t = 0; t < threadCount; t++)
+        {
+            pthread_create(&workers[t], NULL, checkWorker, &parallel);
+        }
+    }
+
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        if (threadCount > 1)
+        {
+            pthread_mutex_lock(&parallel.lock);
+            while (!chunks[i].done)
+            {
+                pthread_cond_wait(&parallel.chunkDone, &parallel.lock);
+            }
+            pthread_mutex_unlock(&parallel.lock);
+        } else
+        {
+            checkChunk(checker, &chunks[i]);
+        }
+
+        if (chunks[i].speculative)
+        {
+            settleChunk(checker, &chunks[i]);
+        }
+        fwrite(chunks[i].output.data, 1, chunks[i].output.size, report);
+        free(chunks[i].output.data);
+        foundTypo = foundTypo || chunks[i].foundTypo;
+
+        if (threadCount > 1)
+        {
+            pthread_mutex_lock(&parallel.lock);
+            parallel.nextToWrite = i + 1;
+            pthread_cond_broadcast(&parallel.chunkWritten);
+            pthread_mutex_unlock(&parallel.lock);
+        }
+    }
+
+    if (threadCount > 1)
+    {
+        for (int t = 0; t < threadCount; t++)
+        {
+            pthread_join(workers[t], NULL);
+        }
+        free(workers);
+        pthread_mutex_destroy(&parallel.lock);
+        pthread_cond_destroy(&parallel.chunkDone);
+        pthread_cond_destroy(&parallel.chunkWritten);
+    }
+    free(chunks);
+
+    return foundTypo;
+}
+
+// Function to map an input file for reading. Files that cannot be mapped (pipes, for example) are read
+// into memory instead. Returns NULL if the file cannot be read; *isMapped tells how to release it.
+char* readInputFile(const char* inputFilePath, size_t* inputSize, bool* isMapped)
+{
+    int fd = open(inputFilePath, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) == 0 && S_ISREG(fileInfo.st_mode) && fileInfo.st_size > 0)
+    {
+        char* input = mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (input != MAP_FAILED)
+        {
+            close(fd);
+            madvise(input, fileInfo.st_size, MADV_SEQUENTIAL);
+            *inputSize = fileInfo.st_size;
+            *isMapped = true;
+            return input;
+        }
+    }
+
+    size_t size = 0;
+    size_t capacity = 1 << 16;
+    char* input = malloc(capacity);
+    ssize_t bytesRead;
+    while ((bytesRead = read(fd, input + size, capacity - size)) > 0)
+    {
+        size += bytesRead;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            input = realloc(input, capacity);
+        }
+    }
+    close(fd);
+
+    if (bytesRead == -1)
+    {
+        free(input);
+        return NULL;
+    }
+    *inputSize = size;
+    *isMapped = false;
+    return input;
+}
+
+// Function to release a file read by readInputFile.
+void freeInputFile(char* input, size_t inputSize, bool isMapped)
+{
+    if (isMapped)
+    {
+        munmap(input, inputSize);
+    } else
+    {
+        free(input);
+    }
+}
+
+// Function to load a frequency file (one "word count" pair per line) into the dictionary's entries.
+// Words that are not in the dictionary are skipped, and a word listed twice keeps its last count.
+// Returns false if the file cannot be read.
+bool loadFrequencies(openHashTable* hashTable, const char* frequencyFilePath)
+{
+    size_t size;
+    bool isMapped;
+    char* text = readInputFile(frequencyFilePath, &size, &isMapped);
+    if (text == NULL)
+    {
+        return false;
+    }
+
+    hashTable->frequencies = calloc(hashTable->capacity, sizeof(uint32_t));
+    const char* position = text;
+    const char* end = text + size;
+    while (position < end)
+    {
+        const char* lineEnd = memchr(position, '\n', end - position);
+        if (lineEnd == NULL)
+        {
+            lineEnd = end;
+        }
+
+        const char* word = position;
+        while (word < lineEnd && (*word == ' ' || *word == '\t'))
+        {
+            word++;
+        }
+        const char* wordEnd = word;
+        while (wordEnd < lineEnd && *wordEnd != ' ' && *wordEnd != '\t' && *wordEnd != '\r')
+        {
+            wordEnd++;
+        }
+
+        uint64_t count = 0;
+        const char* digit = wordEnd;
+        while (digit < lineEnd && (*digit == ' ' || *digit == '\t'))
+        {
+            digit++;
+        }
+        for (; digit < lineEnd && *digit >= '0' && *digit <= '9'; digit++)
+        {
+            count = count * 10 + (*digit - '0');
+            if (count > UINT32_MAX)
+            {
+                count = UINT32_MAX;
+            }
+        }
+
+        uint32_t slotIndex = findHashedSlot(hashTable, word, wordEnd - word, hashFunction(word, wordEnd - word));
+        if (wordEnd > word && slotIndex != EMPTY_SLOT)
+        {
+            hashTable->frequencies[slotIndex] = count;
+        }
+        position = lineEnd + 1;
+    }
+
+    freeInputFile(text, size, isMapped);
+    return true;
+}
+
+// Function to add what the options ask for to a loaded dictionary: the perfect hash or the front-coded form,
+// the Bloom filter and the frequency table. Returns false if the options do not go together or the frequency
+// file cannot be read.
+bool prepareDictionary(openHashTable* hashTable, CheckOptions* options)
+{
+    // The deletion index, the trie and the perfect hash all point into the arena, which --front-coded frees.
+    if (options->frontCoded && (options->method != SUGGEST_CLASSIC || options->perfectHash))
+    {
+        fprintf(stderr, "--front-coded only works with --suggest=classic and without --mph\n");
+        return false;
+    }
+    if (options->frontCoded)
+    {
+        convertToFrontCoded(hashTable);
+    }
+    if (options->perfectHash && hashTable->perfect == NULL)
+    {
+        hashTable->perfect = buildPerfectHash(hashTable, options->threadCount == 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : options->threadCount);
+    }
+    if (options->bloomBitsPerWord > 0)
+    {
+        buildBloomFilter(hashTable, options->bloomBitsPerWord);
+    }
+    if (options->frequencyFile != NULL && !loadFrequencies(hashTable, options->frequencyFile))
+    {
+        fprintf(stderr, "Error opening file %s\n", options->frequencyFile);
+        return false;
+    }
+    return true;
+}
+
+// Function to build the journal path for a dictionary: --journal=path, or the dictionary path followed by JOURNAL_EXTENSION.
+char* journalPathFor(const char* dictionaryFilePath, CheckOptions* options)
+{
+    return options->journalFile != NULL ? strdup(options->journalFile) : pathWithExtension(dictionaryFilePath, JOURNAL_EXTENSION);
+}
+
+// Function to add the words of a journal (one per line) to the dictionary, so the words added by earlier
+// runs are dictionary words again. A missing journal has no words. A last line without its line end was
+// cut short by a crash and is skipped. Stores the number of words read in *wordCount and the length of
+// the journal up to its last complete line in *validSize. Returns false if the journal cannot be read.
+bool replayJournal(openHashTable* hashTable, const char* journalPath, uint32_t* wordCount, off_t* validSize)
+{
+    *wordCount = 0;
+    *validSize = 0;
+    if (access(journalPath, F_OK) == -1)
+    {
+        return errno == ENOENT;
+    }
+
+    size_t size;
+    bool isMapped;
+    char* text = readInputFile(journalPath, &size, &isMapped);
+    if (text == NULL)
+    {
+        return false;
+    }
+
+    const char* position = text;
+    const char* end = text + size;
+    const char* lineEnd;
+    while ((lineEnd = memchr(position, '\n', end - position)) != NULL)
+    {
+        size_t len = lineEnd - position;
+        if (len > 0)
+        {
+            uint32_t hash = hashFunction(position, len);
+            if (!lookupHashedWord(hashTable, position, len, hash))
+            {
+                insertArenaWord(hashTable, appendToArena(hashTable, position, len), hash);
+            }
+            (*wordCount)++;
+        }
+        position = lineEnd + 1;
+    }
+    *validSize = position - text;
+
+    freeInputFile(text, size, isMapped);
+    return true;
+}
+
+// Function to open a journal and take an exclusive flock on it. An add run holds the lock from before it
+// loads the dictionary until it has folded the journal in, and compact mode while it compacts, so no other
+// process appends to the journal, cuts it back or removes it meanwhile. If another run holds the lock, this
+// says so and waits. A journal that was compacted and removed while waiting is opened again, or, without
+// `create`, reported missing. Returns the locked descriptor, or -1 with errno set.
+int lockJournal(const char* journalPath, bool create)
+{
+    for (;;)
+    {
+        int fd = open(journalPath, O_WRONLY | O_APPEND | (create ? O_CREAT : 0), 0644);
+        if (fd == -1)
+        {
+            return -1;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+        {
+            if (errno == EWOULDBLOCK)
+            {
+                fprintf(stderr, "Waiting for another run to release %s\n", journalPath);
+            }
+            if (errno != EWOULDBLOCK || flock(fd, LOCK_EX) == -1)
+            {
+                int savedErrno = errno;
+                close(fd);
+                errno = savedErrno;
+                return -1;
+            }
+        }
+
+        // The lock only counts if it is on the file the path names now.
+        struct stat locked, current;
+        if (fstat(fd, &locked) == 0 && stat(journalPath, &current) == 0
+            && locked.st_dev == current.st_dev && locked.st_ino == current.st_ino)
+        {
+            return fd;
+        }
+        int savedErrno = errno;
+        close(fd);
+        if (!create && savedErrno == ENOENT)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+    }
+}
+
+// Function to start appending the words learned in add mode to a journal that lockJournal opened. The journal
+// is first cut back to validSize, its last complete line, so new words never follow half a word. The journal
+// keeps the descriptor, and its lock, until closeJournal. Returns NULL, after closing fd, if it cannot be cut back.
+Journal* openJournal(int fd, const char* journalPath, off_t validSize, uint32_t wordCount)
+{
+    if (ftruncate(fd, validSize) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    Journal* journal = malloc(sizeof(Journal));
+    journal->fd = fd;
+    journal->path = strdup(journalPath);
+    journal->pending.data = NULL;
+    journal->pending.size = 0;
+    journal->pending.capacity = 0;
+    journal->pendingWords = 0;
+    journal->wordCount = wordCount;
+    journal->failed = false;
+
+    return journal;
+}
+
+// Function to flush a directory entry change (a rename) to disk by syncing the directory that holds path.
+void syncParentDirectory(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    char* directory = slash == NULL ? strdup(".") : strndup(path, slash == path ? 1 : (size_t)(slash - path));
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd != -1)
+    {
+        fsync(fd);
+        close(fd);
+    }
+    free(directory);
+}
+
+// Function to fold a journal into its dictionary: the dictionary file is rewritten with the journal's
+// complete lines after its own, to a temporary file that is synced and renamed over it, and then the journal
+// is removed. A crash in between leaves words that are in both files, which loading simply skips.
+// A snapshot of the dictionary is rebuilt with the given options, since the new file makes it stale.
+// The caller holds the journal's lock (lockJournal). Returns false on an error.
+bool compactJournal(const char* dictionaryFilePath, const char* journalPath, const CheckOptions* options)
+{
+    size_t dictionarySize, journalSize;
+    bool dictionaryIsMapped, journalIsMapped;
+    struct stat dictionaryInfo;
+    if (stat(dictionaryFilePath, &dictionaryInfo) == -1)
+    {
+        return false;
+    }
+    char* dictionary = readInputFile(dictionaryFilePath, &dictionarySize, &dictionaryIsMapped);
+    char* journal = readInputFile(journalPath, &journalSize, &journalIsMapped);
+    bool compacted = false;
+
+    if (dictionary != NULL && journal != NULL)
+    {
+        size_t journalUsed = journalSize;
+        while (journalUsed > 0 && journal[journalUsed - 1] != '\n')
+        {
+            journalUsed--;
+        }
+
+        char* temporaryPath = pathWithExtension(dictionaryFilePath, ".tmp");
+        int fd = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, dictionaryInfo.st_mode & 0777);
+        if (fd != -1)
+        {
+            bool written = writeFully(fd, dictionary, dictionarySize)
+                        && (dictionarySize == 0 || dictionary[dictionarySize - 1] == '\n' || writeFully(fd, "\n", 1))
+                        && writeFully(fd, journal, journalUsed)
+                        && fsync(fd) == 0;
+            written = close(fd) == 0 && written;
+            compacted = written && rename(temporaryPath, dictionaryFilePath) == 0;
+            if (!compacted)
+            {
+                unlink(temporaryPath);
+            }
+        }
+        free(temporaryPath);
+    }
+
+    if (compacted)
+    {
+        syncParentDirectory(dictionaryFilePath);
+        unlink(journalPath);
+        syncParentDirectory(journalPath);
+
+        char* snapshotPath = snapshotPathFor(dictionaryFilePath);
+        if (access(snapshotPath, F_OK) == 0)
+        {
+            uint32_t wordCount;
+            buildSnapshot(dictionaryFilePath, snapshotPath, options, &wordCount);
+        }
+        free(snapshotPath);
+    }
+
+    if (dictionary != NULL)
+    {
+        freeInputFile(dictionary, dictionarySize, dictionaryIsMapped);
+    }
+    if (journal != NULL)
+    {
+        freeInputFile(journal, journalSize, journalIsMapped);
+    }
+    return compacted;
+}
+
+// Function to read one message: its header, then its payload into *payload (grown as needed).
+// Returns false at end of file, on an error, or if the payload is larger than MAX_MESSAGE_PAYLOAD.
+bool readMessage(int fd, MessageHeader* header, char** payload, size_t* payloadCapacity)
+{
+    if (!readFully(fd, header, sizeof(MessageHeader)) || header->payloadLength > MAX_MESSAGE_PAYLOAD)
+    {
+        return false;
+    }
+    if (header->payloadLength > *payloadCapacity)
+    {
+        *payloadCapacity = header->payloadLength;
+        *payload = realloc(*payload, *payloadCapacity);
+    }
+    return readFully(fd, *payload, header->payloadLength);
+}
+
+// Function to append a word to a message as its uint16 length followed by its letters.
+void appendMessageWord(OutputBuffer* message, const char* word, size_t len)
+{
+    uint16_t wordLength = len;
+    appendToOutput(message, (const char*)&wordLength, sizeof(wordLength));
+    appendToOutput(message, word, len);
+}
+
+// Function to read the uint16-length-prefixed word at *position without going past end.
+// Returns false if the message is cut short.
+bool takeMessageWord(const char** position, const char* end, const char** word, size_t* len)
+{
+    uint16_t wordLength;
+    if (end - *position < (ptrdiff_t)sizeof(wordLength))
+    {
+        return false;
+    }
+    memcpy(&wordLength, *position, sizeof(wordLength));
+    *position += sizeof(wordLength);
+    if (end - *position < wordLength)
+    {
+        return false;
+    }
+    *word = *position;
+    *len = wordLength;
+    *position += wordLength;
+    return true;
+}
+
+// Function to append the suggestions for a misspelled word to a response: their count, then the words
+// in the order the local report prints them.
+void appendSuggestions(SpellChecker* checker, char* word, OutputBuffer* response)
+{
+    size_t countPosition = response->size;
+    uint16_t count = 0;
+    appendToOutput(response, (const char*)&count, sizeof(count));
+
+    const RankedSuggestion* suggestions;
+    int size = lookupSuggestions(checker, word, &suggestions);
+    for (int i = 0; i < size && count < UINT16_MAX; i++)
+    {
+        appendMessageWord(response, suggestions[i].word, strlen(suggestions[i].word));
+        count++;
+    }
+
+    memcpy(response->data + countPosition, &count, sizeof(count));
+}
+
+// Function to answer one request of a connection. The words are checked in order, so with REQUEST_LEARN
+// a misspelling learned from one word is already known to the next. A request that is not well formed
+// gets an empty RESPONSE_BAD_REQUEST.
+void handleRequest(SpellChecker* session, const MessageHeader* request, const char* payload, OutputBuffer* response)
+{
+    MessageHeader header;
+    memset(&header, 0, sizeof(header));
+    response->size = 0;
+    appendToOutput(response, (const char*)&header, sizeof(header));   // filled in at the end
+
+    const char* position = payload;
+    const char* end = payload + request->payloadLength;
+    bool valid = request->type == REQUEST_CHECK || request->type == REQUEST_SUGGEST;
+    WordSpan spans[CHECK_SPAN_BATCH];
+    uint32_t hashes[CHECK_SPAN_BATCH];
+    uint32_t slotIndexes[CHECK_SPAN_BATCH];
+    size_t spanCount = 0;
+    size_t nextSpan = 0;
+    for (uint32_t w = 0; valid && w < request->wordCount; w++)
+    {
+        // The words are taken off the payload and looked up in the dictionary CHECK_SPAN_BATCH at a time.
+        if (nextSpan == spanCount)
+        {
+            spanCount = 0;
+            nextSpan = 0;
+            while (valid && spanCount < CHECK_SPAN_BATCH && w + spanCount < request->wordCount)
+            {
+                WordSpan* span = &spans[spanCount];
+                valid = takeMessageWord(&position, end, &span->start, &span->len) && span->len > 0
+                        && memchr(span->start, '\0', span->len) == NULL;
+                spanCount += valid ? 1 : 0;
+            }
+            lookupWordSlots(session->dictionary, spans, spanCount, hashes, slotIndexes);
+            if (spanCount == 0)
+            {
+                break;
+            }
+        }
+        const char* word = spans[nextSpan].start;
+        size_t len = spans[nextSpan].len;
+        uint32_t slotIndex = slotIndexes[nextSpan];
+        uint32_t hash = hashes[nextSpan++];
+
+        char misspelled = slotIndex == EMPTY_SLOT
+                          && !(session->learned != NULL && learnedWordCount(session->learned) > 0
+                               && learnedWordsContain(session->learned, word, len, hash));
+        appendToOutput(response, &misspelled, 1);
+        if (!misspelled)
+        {
+            continue;
+        }
+
+        // Only misspelled words are copied, so the suggestion engines get a NUL-terminated string.
+        char* copy = malloc(len + 1);
+        memcpy(copy, word, len);
+        copy[len] = '\0';
+        if (request->type == REQUEST_SUGGEST)
+        {
+            appendSuggestions(session, copy, response);
+        }
+        if (request->flags & REQUEST_LEARN)
+        {
+            learnWord(session, copy, len);
+        }
+        free(copy);
+    }
+
+    if (!valid || position != end)
+    {
+        response->size = sizeof(header);
+        header.type = RESPONSE_BAD_REQUEST;
+    } else
+    {
+        header.type = RESPONSE_OK;
+        header.wordCount = request->wordCount;
+    }
+    header.payloadLength = response->size - sizeof(header);
+    memcpy(response->data, &header, sizeof(header));
+}
+
+// Thread serving one connection: answers its requests in the order they arrive until the client hangs up.
+// The client may send more requests before reading the answers; they simply wait in the socket.
+void* serveConnection(void* argument)
+{
+    ServerConnection* connection = argument;
+    MessageHeader request;
+    char* payload = NULL;
+    size_t payloadCapacity = 0;
+    OutputBuffer response = {NULL, 0, 0};
+
+    while (readMessage(connection->fd, &request, &payload, &payloadCapacity))
+    {
+        handleRequest(&connection->session, &request, payload, &response);
+        if (!writeFully(connection->fd, response.data, response.size))
+        {
+            break;
+        }
+    }
+
+    close(connection->fd);
+    if (connection->session.learned != NULL)
+    {
+        freeLearnedWords(connection->session.learned);
+    }
+    free(payload);
+    free(response.data);
+    free(connection);
+    freeThreadSuggestionCache();
+    mergeLookupStats();
+
+    pthread_mutex_lock(&serverLock);
+    activeConnections--;
+    pthread_mutex_unlock(&serverLock);
+    return NULL;
+}
+
+// Function to fill in the address of a Unix socket. Returns false if the path is too long for one.
+bool socketAddress(const char* socketPath, struct sockaddr_un* address)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address->sun_path))
+    {
+        return false;
+    }
+    strcpy(address->sun_path, socketPath);
+    return true;
+}
+
+// Function to connect to a running server. Returns the socket, or -1 if nothing is listening on the path.
+int connectToServer(const char* socketPath)
+{
+    struct sockaddr_un address;
+    if (!socketAddress(socketPath, &address))
+    {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Function to create the listening socket. A socket file nobody answers on is left over from a server
+// that did not exit cleanly and is replaced. Returns -1 if the socket cannot be created.
+int listenOnSocket(const char* socketPath)
+{
+    struct sockaddr_un address;
+    if (!socketAddress(socketPath, &address))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", socketPath);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1 && errno == EADDRINUSE)
+    {
+        int running = connectToServer(socketPath);
+        if (running != -1)
+        {
+            fprintf(stderr, "A server is already listening on %s\n", socketPath);
+            close(running);
+            close(fd);
+            return -1;
+        }
+        unlink(socketPath);
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    if (listen(fd, SOMAXCONN) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Signal handler for SIGINT and SIGTERM: makes the server's accept loop stop. The byte written to the wake
+// pipe ends its poll even if the signal came just before the loop started waiting.
+void stopServer(int signalNumber)
+{
+    (void)signalNumber;
+    serverStopping = 1;
+    int savedErrno = errno;
+    if (serverWakeFds[1] != -1)
+    {
+        ssize_t written = write(serverWakeFds[1], "", 1);
+        (void)written;
+    }
+    errno = savedErrno;
+}
+
+// Function for "serve" mode: load the dictionary and build the suggestion engine once, then answer requests
+// on a Unix socket, one thread per connection, until SIGINT or SIGTERM.
+int runServer(const char* dictionaryFilePath, CheckOptions* options)
+{
+    openHashTable* dictionary = openDictionary(dictionaryFilePath);
+    if (dictionary == NULL)
+    {
+        fprintf(stderr, "Error opening file\n");
+        return 1;
+    }
+
+    // The words added by earlier add-mode runs are served as dictionary words. Connections never add to the journal.
+    if (options->useJournal)
+    {
+        char* journalPath = journalPathFor(dictionaryFilePath, options);
+        uint32_t journalWords;
+        off_t journalSize;
+        bool replayed = replayJournal(dictionary, journalPath, &journalWords, &journalSize);
+        if (!replayed)
+        {
+            fprintf(stderr, "Error opening file %s\n", journalPath);
+        }
+        free(journalPath);
+        if (!replayed)
+        {
+            freeHashTable(dictionary);
+            return 1;
+        }
+    }
+    if (!prepareDictionary(dictionary, options))
+    {
+        freeHashTable(dictionary);
+        return 1;
+    }
+    SpellChecker checker;
+    initSpellChecker(&checker, dictionary, options, false);
+
+    char* socketPath = options->socketPath != NULL ? strdup(options->socketPath) : pathWithExtension(dictionaryFilePath, SOCKET_EXTENSION);
+    int listener = listenOnSocket(socketPath);
+    if (listener == -1)
+    {
+        fprintf(stderr, "Could not listen on %s\n", socketPath);
+        freeSpellChecker(&checker);
+        freeHashTable(dictionary);
+        free(socketPath);
+        return 1;
+    }
+
+    // The loop waits in poll on the listener and the wake pipe, and only calls accept once a connection is
+    // waiting; the listener does not block, so a client that gave up in between costs one EAGAIN.
+    if (pipe(serverWakeFds) == -1)
+    {
+        fprintf(stderr, "Could not create the server's wake pipe\n");
+        close(listener);
+        unlink(socketPath);
+        freeSpellChecker(&checker);
+        freeHashTable(dictionary);
+        free(socketPath);
+        return 1;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(serverWakeFds[i], F_SETFL, O_NONBLOCK);
+        fcntl(serverWakeFds[i], F_SETFD, FD_CLOEXEC);
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+
+    // Connection threads block the signals, which makes sure they are delivered to the accepting thread.
+    struct sigaction stopAction;
+    memset(&stopAction, 0, sizeof(stopAction));
+    stopAction.sa_handler = stopServer;
+    sigaction(SIGINT, &stopAction, NULL);
+    sigaction(SIGTERM, &stopAction, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+
+    fprintf(stderr, "Serving %u words on %s\n", dictionary->count, socketPath);
+    int result = 0;
+    int retryDelay = 0;
+    struct pollfd waits[2];
+    waits[1].fd = serverWakeFds[0];
+    waits[1].events = POLLIN;
+    while (!serverStopping)
+    {
+        // Out of descriptors or memory, the loop only watches the wake pipe for a while instead of spinning
+        // on a listener that stays readable.
+        waits[0].fd = retryDelay > 0 ? -1 : listener;
+        waits[0].events = POLLIN;
+        if (poll(waits, 2, retryDelay > 0 ? retryDelay : -1) == -1 && errno != EINTR)
+        {
+            perror("poll");
+            result = 1;
+            break;
+        }
+        if (retryDelay > 0)
+        {
+            retryDelay = 0;
+            continue;
+        }
+        if (serverStopping || !(waits[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        int fd = accept(listener, NULL, NULL);
+        if (fd == -1)
+        {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+            {
+                retryDelay = ACCEPT_RETRY_MILLISECONDS;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+            {
+                perror("accept");
+                result = 1;
+                break;
+            }
+            continue;
+        }
+
+        ServerConnection* connection = malloc(sizeof(ServerConnection));
+        connection->fd = fd;
+        connection->session = checker;
+
+        pthread_mutex_lock(&serverLock);
+        activeConnections++;
+        pthread_mutex_unlock(&serverLock);
+
+        pthread_t thread;
+        sigset_t previousMask;
+        pthread_sigmask(SIG_BLOCK, &stopSignals, &previousMask);
+        if (pthread_create(&thread, NULL, serveConnection, connection) == 0)
+        {
+            pthread_detach(thread);
+        } else
+        {
+            close(fd);
+            free(connection);
+            pthread_mutex_lock(&serverLock);
+            activeConnections--;
+            pthread_mutex_unlock(&serverLock);
+        }
+        pthread_sigmask(SIG_SETMASK, &previousMask, NULL);
+    }
+
+    close(listener);
+    unlink(socketPath);
+    free(socketPath);
+    int wakeWriter = serverWakeFds[1];
+    serverWakeFds[1] = -1;
+    close(wakeWriter);
+    close(serverWakeFds[0]);
+    serverWakeFds[0] = -1;
+
+    mergeLookupStats();
+    if (options->printStats)
+    {
+        printLookupStats(dictionary);
+    }
+
+    // Connections still open at exit keep using the dictionary until the process ends, so it is only freed without them.
+    pthread_mutex_lock(&serverLock);
+    bool idle = activeConnections == 0;
+    pthread_mutex_unlock(&serverLock);
+    if (idle)
+    {
+        freeSpellChecker(&checker);
+        freeHashTable(dictionary);
+    }
+    return result;
+}
+
+// Function to print the report for one answered batch, exactly as the local checker prints it.
+// Returns false if the response does not match the batch.
+bool printBatchResponse(ClientBatch* batch, const MessageHeader* header, const char* payload, OutputBuffer* output, bool* foundTypo)
+{
+    if (header->type != RESPONSE_OK || header->wordCount != batch->count)
+    {
+        return false;
+    }
+
+    const char* position = payload;
+    const char* end = payload + header->payloadLength;
+    for (size_t w = 0; w < batch->count; w++)
+    {
+        if (position == end)
+        {
+            return false;
+        }
+        if (*position++ == 0)
+        {
+            continue;
+        }
+
+        uint16_t count;
+        if (end - position < (ptrdiff_t)sizeof(count))
+        {
+            return false;
+        }
+        memcpy(&count, position, sizeof(count));
+        position += sizeof(count);
+
+        *foundTypo = true;
+        appendStringToOutput(output, "Misspelled word: ");
+        appendToOutput(output, batch->spans[w].start, batch->spans[w].len);
+        appendStringToOutput(output, "\nSuggestions: ");
+        for (uint16_t s = 0; s < count; s++)
+        {
+            const char* suggestion;
+            size_t len;
+            if (!takeMessageWord(&position, end, &suggestion, &len))
+            {
+                return false;
+            }
+            appendToOutput(output, suggestion, len);
+            appendStringToOutput(output, " ");
+        }
+        appendStringToOutput(output, "\n");
+    }
+    return position == end;
+}
+
+// Receiving thread of the client: reads the answers in the order the requests were sent and prints them.
+void* receiveResponses(void* argument)
+{
+    ClientPipeline* pipeline = argument;
+    MessageHeader header;
+    char* payload = NULL;
+    size_t payloadCapacity = 0;
+    OutputBuffer output = {NULL, 0, 0};
+
+    while (true)
+    {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->received == pipeline->sent && !pipeline->sendingDone)
+        {
+            pthread_cond_wait(&pipeline->batchSent, &pipeline->lock);
+        }
+        if (pipeline->received == pipeline->sent)
+        {
+            pthread_mutex_unlock(&pipeline->lock);
+            break;
+        }
+        ClientBatch* batch = &pipeline->batches[pipeline->received % CLIENT_REQUESTS_IN_FLIGHT];
+        pthread_mutex_unlock(&pipeline->lock);
+
+        output.size = 0;
+        bool foundTypo = false;
+        bool answered = readMessage(pipeline->fd, &header, &payload, &payloadCapacity)
+                        && printBatchResponse(batch, &header, payload, &output, &foundTypo);
+        fwrite(output.data, 1, output.size, stdout);
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->foundTypo = pipeline->foundTypo || foundTypo;
+        if (answered)
+        {
+            pipeline->received++;
+        } else
+        {
+            pipeline->failed = true;
+        }
+        pthread_cond_signal(&pipeline->batchReceived);
+        pthread_mutex_unlock(&pipeline->lock);
+        if (!answered)
+        {
+            break;
+        }
+    }
+
+    free(payload);
+    free(output.data);
+    return NULL;
+}
+
+// Function for "client" mode: check an input file against a running server, printing the same report as
+// the local checker. The input is sent in batches of words while the answers to earlier batches are
+// still coming back; in add mode the server learns each misspelling for the rest of this connection.
+int runClient(const char* dictionaryFilePath, const char* inputFilePath, bool learnMisspellings, CheckOptions* options)
 {
-    char* word;
-    struct Node* next;
-}Node;
+    char* socketPath = options->socketPath != NULL ? strdup(options->socketPath) : pathWithExtension(dictionaryFilePath, SOCKET_EXTENSION);
+    int fd = connectToServer(socketPath);
+    if (fd == -1)
+    {
+        fprintf(stderr, "No server is listening on %s\n", socketPath);
+        free(socketPath);
+        return 1;
+    }
+    free(socketPath);
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t inputSize;
+    bool inputIsMapped;
+    char* input = readInputFile(inputFilePath, &inputSize, &inputIsMapped);
+    if (input == NULL)
+    {
+        fprintf(stderr, "Error opening file\n");
+        close(fd);
+        return -1;
+    }
+
+    ClientPipeline pipeline;
+    pipeline.fd = fd;
+    pipeline.batches = malloc(sizeof(ClientBatch) * CLIENT_REQUESTS_IN_FLIGHT);
+    pipeline.sent = 0;
+    pipeline.received = 0;
+    pipeline.sendingDone = false;
+    pipeline.failed = false;
+    pipeline.foundTypo = false;
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.batchSent, NULL);
+    pthread_cond_init(&pipeline.batchReceived, NULL);
+
+    pthread_t receiver;
+    pthread_create(&receiver, NULL, receiveResponses, &pipeline);
+
+    Tokenizer tokenizer;
+    initTokenizer(&tokenizer, input, input + inputSize);
+    OutputBuffer request = {NULL, 0, 0};
+    while (true)
+    {
+        pthread_mutex_lock(&pipeline.lock);
+        while (pipeline.sent - pipeline.received == CLIENT_REQUESTS_IN_FLIGHT && !pipeline.failed)
+        {
+            pthread_cond_wait(&pipeline.batchReceived, &pipeline.lock);
+        }
+        bool failed = pipeline.failed;
+        pthread_mutex_unlock(&pipeline.lock);
+        if (failed)
+        {
+            break;
+        }
+
+        ClientBatch* batch = &pipeline.batches[pipeline.sent % CLIENT_REQUESTS_IN_FLIGHT];
+        batch->count = nextWords(&tokenizer, batch->spans, CLIENT_BATCH_WORDS);
+        if (batch->count == 0)
+        {
+            break;
+        }
+
+        MessageHeader header;
+        memset(&header, 0, sizeof(header));
+        request.size = 0;
+        appendToOutput(&request, (const char*)&header, sizeof(header));   // filled in below
+        bool valid = true;
+        for (size_t w = 0; w < batch->count; w++)
+        {
+            if (batch->spans[w].len > UINT16_MAX)
+            {
+                fprintf(stderr, "Word too long to send to the server: %.20s...\n", batch->spans[w].start);
+                valid = false;
+                break;
+            }
+            appendMessageWord(&request, batch->spans[w].start, batch->spans[w].len);
+        }
+        header.payloadLength = request.size - sizeof(header);
+        header.type = REQUEST_SUGGEST;
+        header.flags = learnMisspellings ? REQUEST_LEARN : 0;
+        header.wordCount = batch->count;
+        memcpy(request.data, &header, sizeof(header));
+
+        if (!valid || header.payloadLength > MAX_MESSAGE_PAYLOAD || !writeFully(fd, request.data, request.size))
+        {
+            pthread_mutex_lock(&pipeline.lock);
+            pipeline.failed = true;
+            pthread_mutex_unlock(&pipeline.lock);
+            break;
+        }
+
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.sent++;
+        pthread_cond_signal(&pipeline.batchSent);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.sendingDone = true;
+    pthread_cond_signal(&pipeline.batchSent);
+    pthread_mutex_unlock(&pipeline.lock);
+    shutdown(fd, SHUT_WR);
+
+    pthread_join(receiver, NULL);
+    close(fd);
+    free(request.data);
+    free(pipeline.batches);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.batchSent);
+    pthread_cond_destroy(&pipeline.batchReceived);
+    freeInputFile(input, inputSize, inputIsMapped);
+
+    if (pipeline.failed)
+    {
+        fprintf(stderr, "The server did not answer every request\n");
+        return 1;
+    }
+    if (!pipeline.foundTypo)
+    {
+        printf("No typo!\n");
+    }
+    return 0;
+}
 
-typedef struct openHashTable
+// Function to read a monotonic clock in seconds.
+double currentSeconds()
 {
-    int size;
-    Node** buckets;
-} openHashTable;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
 
+// Small deterministic random number generator (xorshift64), so every benchmark run uses the same typos.
+uint64_t nextRandom(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
 
-// Hash function to compute hash value for a given word on the ASCII value of its characters.
-unsigned long hashFunction(char *word, int size) {
-    unsigned long total = 0;
-    for (int i = 0; i < strlen(word); i++) {
-        total = total + word[i];
-        total = total * 101;                        // Multiply the total by 101 (a prime number)
+// Function to copy a word of len (at least 2) letters into typo with one random edit anywhere in it: two
+// adjacent letters swapped, or a letter inserted, deleted or substituted. typo needs room for len + 2 bytes.
+void makeTypo(char* typo, const char* original, size_t len, uint64_t* randomState)
+{
+    strcpy(typo, original);
+    size_t position = nextRandom(randomState) % len;
+    char letter = 'a' + nextRandom(randomState) % 26;
+    switch (nextRandom(randomState) % 4)
+    {
+        case 0:     // swap two adjacent letters
+            position = position == len - 1 ? position - 1 : position;
+            swap(&typo[position], &typo[position + 1]);
+            break;
+        case 1:     // insert a letter
+            memmove(typo + position + 1, typo + position, len - position + 1);
+            typo[position] = letter;
+            break;
+        case 2:     // delete a letter
+            memmove(typo + position, typo + position + 1, len - position);
+            break;
+        default:    // substitute a letter
+            typo[position] = letter;
+            break;
     }
-    return total % size;
 }
 
-// Function to print Hash Table for debugging purpose.
-void printHashTable(openHashTable* hashTable) 
+// Function to check that the dictionary has a word the benchmarks can misspell, one of 2 to MAX_WORD_LENGTH - 1
+// letters. They draw random words until they find such a word, so without one they would never stop.
+bool hasBenchmarkWord(openHashTable* hashTable)
 {
-    for (int i = 0; i < hashTable->size; i++) 
+    bool found = false;
+    if (hashTable->frontCoded != NULL)
     {
-        Node* current = hashTable->buckets[i];
-
-        if (current != NULL)
+        FrontCodedIterator iterator;
+        initFrontCodedIterator(&iterator, hashTable->frontCoded, "", 0);
+        const char* word;
+        while (!found && (word = nextFrontCodedWord(&iterator)) != NULL)
         {
-            printf("Bucket %d: ", i);
-            while (current != NULL) 
-            {
-                printf("%s -> ", current->word);
-                current = current->next;
-            }
-            printf("NULL\n");
-        } else 
+            size_t len = strlen(word);
+            found = len >= 2 && len < MAX_WORD_LENGTH;
+        }
+        freeFrontCodedIterator(&iterator);
+        return found;
+    }
+
+    for (size_t i = 0; !found && i <= hashTable->mask; i++)
+    {
+        if (hashTable->slots[i].offset != EMPTY_SLOT)
         {
-            printf("Bucket %d: NULL\n", i);
+            size_t len = strlen(hashTable->arena + hashTable->slots[i].offset);
+            found = len >= 2 && len < MAX_WORD_LENGTH;
         }
     }
+    return found;
 }
 
-
-// Function to insert the dictionary words to hash table
-void insertToHashTable(openHashTable* hashTable, char* wrd)
+// Function for "bench-suggest" mode: make wordCount misspellings of random dictionary words (one swap,
+// insertion, deletion or substitution anywhere in the word) and time each suggestion method on them.
+int benchmarkSuggestions(const char* dictionaryFilePath, int wordCount, CheckOptions* options)
 {
-    // Let's get the hash value of the word first.
-    unsigned long hashValue = hashFunction(wrd, hashTable->size);
-
-    Node* head = hashTable->buckets[hashValue];
-
-    if (head == NULL)
+    double start = currentSeconds();
+    openHashTable* hashTable = openDictionary(dictionaryFilePath);
+    if (hashTable == NULL || hashTable->count == 0)
     {
-        head = malloc(sizeof(Node));
-        head->word = malloc(strlen(wrd) + 1);
-        strcpy(head->word, wrd);
-        head->next = NULL;
-        hashTable->buckets[hashValue] = head;
-    } else
+        fprintf(stderr, "Error opening file\n");
+        return 1;
+    }
+    double loadTime = currentSeconds() - start;
+    if (!prepareDictionary(hashTable, options))
+    {
+        return 1;
+    }
+    if (!hasBenchmarkWord(hashTable))
     {
-        Node* current = head;
-        Node* previous = NULL;
-        bool found = false;
+        fprintf(stderr, "The dictionary has no words of 2 to %d letters to misspell\n", MAX_WORD_LENGTH - 1);
+        freeHashTable(hashTable);
+        return 1;
+    }
 
-        while (current != NULL)
+    char* typos = malloc((size_t)wordCount * (MAX_WORD_LENGTH + 2));
+    uint64_t randomState = 0x2545F4914F6CDD1Dull;
+    for (int i = 0; i < wordCount; )
+    {
+        Slot slot = hashTable->slots[nextRandom(&randomState) & hashTable->mask];
+        if (slot.offset == EMPTY_SLOT)
         {
-            if (strcmp(current->word, wrd) == 0)
-            {
-                found = true;
-                break;
-            }
-            previous = current;
-            current = current->next;   
+            continue;
         }
-        
-        if (found == false)
+        const char* original = hashTable->arena + slot.offset;
+        int len = strlen(original);
+        if (len < 2 || len >= MAX_WORD_LENGTH)
         {
-            Node* newNode = malloc(sizeof(Node));
-            newNode -> word = malloc(strlen(wrd) + 1);
-            strcpy(newNode->word, wrd);
-            newNode -> next = NULL;
+            continue;
+        }
 
-            previous -> next = newNode;
+        char* typo = typos + (size_t)i * (MAX_WORD_LENGTH + 2);
+        makeTypo(typo, original, len, &randomState);
+
+        // Some edits land on another dictionary word; those are not misspellings.
+        if (isMisspelled(hashTable, typo))
+        {
+            i++;
         }
-        
     }
-}
 
+    printf("Dictionary: %u words loaded in %.1f ms (hash %s)\n", hashTable->count, loadTime * 1000, activeHash->name);
+    fflush(stdout);
+    if (options->printStats)
+    {
+        printHashTableHealth(hashTable);
+    }
+    printf("Misspellings: %d, max distance %d, top %d (0 = all)\n", wordCount, options->maxDistance, options->limit);
+    printf("%-10s %12s %12s %14s %14s\n", "method", "build ms", "total ms", "us per word", "suggestions");
 
-// Function to check for misspelled words
-bool isMisspelled(openHashTable* hashTable, char* word)
-{
-    // Let's get the hash value of the input word.
-    unsigned long hashValue = hashFunction(word, hashTable->size);
+    // The existing candidate probes: one isMisspelled per generated candidate.
+    long found = 0;
+    start = currentSeconds();
+    for (int i = 0; i < wordCount; i++)
+    {
+        RankedSuggestion* suggestions;
+        found += findSuggestions(hashTable, NULL, typos + (size_t)i * (MAX_WORD_LENGTH + 2), options->limit, &suggestions);
+        free(suggestions);
+    }
+    double elapsed = currentSeconds() - start;
+    printf("%-10s %12.1f %12.1f %14.2f %14ld\n", "classic", 0.0, elapsed * 1000, elapsed * 1e6 / wordCount, found);
 
-    Node* current = hashTable->buckets[hashValue];
+    start = currentSeconds();
+    Trie* trie = buildTrie(hashTable);
+    double buildTime = currentSeconds() - start;
+    found = 0;
+    start = currentSeconds();
+    for (int i = 0; i < wordCount; i++)
+    {
+        const char* typo = typos + (size_t)i * (MAX_WORD_LENGTH + 2);
+        RankedSuggestion* suggestions;
+        found += findTrieSuggestions(trie, hashTable, NULL, typo, strlen(typo), options->maxDistance, options->limit, &suggestions);
+        free(suggestions);
+    }
+    elapsed = currentSeconds() - start;
+    printf("%-10s %12.1f %12.1f %14.2f %14ld\n", "trie", buildTime * 1000, elapsed * 1000, elapsed * 1e6 / wordCount, found);
+    freeTrie(trie);
 
-    while (current != NULL)
+    start = currentSeconds();
+    DeleteIndex* deleteIndex = buildDeleteIndex(hashTable, options->maxDistance);
+    buildTime = currentSeconds() - start;
+    found = 0;
+    start = currentSeconds();
+    for (int i = 0; i < wordCount; i++)
     {
-        if (strcmp(current->word, word) == 0)
-        {
-            return false;
-        }
-        current = current -> next;
+        const char* typo = typos + (size_t)i * (MAX_WORD_LENGTH + 2);
+        RankedSuggestion* suggestions;
+        found += findSymSpellSuggestions(deleteIndex, hashTable, NULL, typo, strlen(typo), options->limit, &suggestions);
+        free(suggestions);
     }
-    
-    return true;
-}
+    elapsed = currentSeconds() - start;
+    printf("%-10s %12.1f %12.1f %14.2f %14ld\n", "symspell", buildTime * 1000, elapsed * 1000, elapsed * 1e6 / wordCount, found);
+    freeDeleteIndex(deleteIndex);
 
+    free(typos);
+    freeHashTable(hashTable);
 
-void swap(char *a, char *b)
+    return 0;
+}
+
+// Function to compare two latencies for qsort.
+int compareLatencies(const void* a, const void* b)
 {
-    char temp = *a;
-    *a = *b;
-    *b = temp;
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
 }
 
-void shiftRight(char* word)
+// Function to read a percentile (0 to 100) from sorted latencies.
+double latencyPercentile(const double* sorted, size_t count, double percentile)
 {
-    int len = strlen(word);
-    word[len + 1] = '\0';
-    for (int i = len; i > 0; i--)
+    if (count == 0)
     {
-        word[i] = word[i-1];
+        return 0.0;
     }
+    size_t index = (size_t)(percentile / 100.0 * (count - 1) + 0.5);
+    return sorted[index];
 }
 
-void shiftLeft(char* word)
+// Function to generate a benchmark corpus: settings->wordCount random dictionary words, separated by
+// spaces with a line break every BENCHMARK_WORDS_PER_LINE words, with typoPercent of them misspelled by
+// makeTypo. The misspelled words are also copied into *typos (MAX_WORD_LENGTH + 2 bytes each) for timing
+// the suggestions; that buffer starts at the expected number of typos and doubles when it fills up.
+// *allocated gets the bytes the corpus and the typos fill. The dictionary must pass hasBenchmarkWord.
+// Returns the corpus, which the caller must free.
+char* generateCorpus(openHashTable* hashTable, BenchmarkSettings* settings, size_t* corpusSize, char** typos, size_t* typoCount,
+                     size_t* allocated)
 {
-    int len = strlen(word);
-    for (int i = 1; i < len; i++)
+    OutputBuffer corpus = {NULL, 0, 0};
+    size_t typoCapacity = settings->wordCount / 100 * settings->typoPercent + 64;
+    *typos = malloc(typoCapacity * (MAX_WORD_LENGTH + 2));
+    *typoCount = 0;
+
+    FrontCodedIterator iterator;
+    if (hashTable->frontCoded != NULL)
     {
-        word[i-1] = word[i];
+        initFrontCodedIterator(&iterator, hashTable->frontCoded, "", 0);
     }
-    word[len - 1] = '\0';
-}
 
-void checkAndAddSuggestion(openHashTable* hashTable, char** (*suggestions), int *size, int *capacity, char* word)
-{
-    if (!isMisspelled(hashTable, word))
+    uint64_t randomState = settings->seed != 0 ? settings->seed : 1;
+    for (size_t i = 0; i < settings->wordCount; )
     {
-        // Double the capacity if the array is full
-        if (*size >= *capacity)
+        const char* original;
+        if (hashTable->frontCoded != NULL)
+        {
+            original = seekFrontCodedRank(&iterator, nextRandom(&randomState) % hashTable->count);
+        } else
+        {
+            Slot slot = hashTable->slots[nextRandom(&randomState) & hashTable->mask];
+            if (slot.offset == EMPTY_SLOT)
+            {
+                continue;
+            }
+            original = hashTable->arena + slot.offset;
+        }
+        size_t len = strlen(original);
+        if (len < 2 || len >= MAX_WORD_LENGTH)
+        {
+            continue;
+        }
+
+        if (nextRandom(&randomState) % 100 < (uint64_t)settings->typoPercent)
+        {
+            if (*typoCount == typoCapacity)
+            {
+                typoCapacity *= 2;
+                *typos = realloc(*typos, typoCapacity * (MAX_WORD_LENGTH + 2));
+            }
+            char* typo = *typos + *typoCount * (MAX_WORD_LENGTH + 2);
+            makeTypo(typo, original, len, &randomState);
+            appendStringToOutput(&corpus, typo);
+            (*typoCount)++;
+        } else
         {
-            *capacity *= 2;
-            *suggestions = realloc(*suggestions, sizeof(char*) * (*capacity));  // Realloc will change the pointer to the array. So, we pass by reference for suggestions.
+            appendStringToOutput(&corpus, original);
         }
 
-        (*suggestions)[*size] = malloc(strlen(word) + 1);
-        strcpy((*suggestions)[*size], word);
-        (*size)++;
+        i++;
+        appendStringToOutput(&corpus, i % BENCHMARK_WORDS_PER_LINE == 0 ? "\n" : " ");
     }
+    if (hashTable->frontCoded != NULL)
+    {
+        freeFrontCodedIterator(&iterator);
+    }
+
+    *corpusSize = corpus.size;
+    *allocated = corpus.size + *typoCount * (MAX_WORD_LENGTH + 2);
+    return corpus.data;
 }
 
-void printSuggestions(openHashTable* hashTable, char* originalWord)
+// Function for "bench" mode: generate a corpus with injected typos from the dictionary, then measure the
+// dictionary load time, how fast the whole corpus is checked (report discarded), the latency of finding
+// the suggestions for each misspelled word on its own (without the suggestion cache), and the peak RSS.
+// Prints a table, or one JSON object with --json, so the results of two builds can be compared.
+int runBenchmark(const char* dictionaryFilePath, BenchmarkSettings* settings, CheckOptions* options)
 {
-    // Initialize an array to store suggestions
-    int capacity = 5;
-    int size = 0;
-    char** suggestions = malloc(sizeof(char*) * capacity);
-    
-    // First, we will copy the word into a separate variable.
-    char* word = malloc(sizeof(char) * (strlen(originalWord) + 5));
-    strcpy(word, originalWord);
-
-    //////////////////////////////////
-    // Step 1: Inverted adjacent pairs
-    //////////////////////////////////
+    double start = currentSeconds();
+    openHashTable* hashTable = openDictionary(dictionaryFilePath);
+    if (hashTable == NULL || hashTable->count == 0)
+    {
+        fprintf(stderr, "Error opening file\n");
+        return 1;
+    }
+    if (!prepareDictionary(hashTable, options))
+    {
+        return 1;
+    }
+    double loadTime = currentSeconds() - start;
 
-    for (int i = 0; i < strlen(originalWord) - 1; i++)
+    start = currentSeconds();
+    SpellChecker checker;
+    initSpellChecker(&checker, hashTable, options, false);
+    double buildTime = currentSeconds() - start;
+    if (!hasBenchmarkWord(hashTable))
     {
-        swap(&word[i], &word[i+1]);   // Swap the adjacent pair
+        fprintf(stderr, "The dictionary has no words of 2 to %d letters to build a corpus from\n", MAX_WORD_LENGTH - 1);
+        freeSpellChecker(&checker);
+        freeHashTable(hashTable);
+        return 1;
+    }
 
-        checkAndAddSuggestion(hashTable, &suggestions, &size, &capacity, word);
+    // The peak RSS below includes the corpus, so its size is reported next to it.
+    size_t corpusSize;
+    char* typos;
+    size_t typoCount;
+    size_t corpusAllocated;
+    char* corpus = generateCorpus(hashTable, settings, &corpusSize, &typos, &typoCount, &corpusAllocated);
 
-        swap(&word[i], &word[i+1]);     // swap the same pair again to change the word back to how it was originally        
+    FILE* discard = fopen("/dev/null", "w");
+    if (discard == NULL)
+    {
+        fprintf(stderr, "Could not open /dev/null\n");
+        return 1;
     }
+    int threadCount = options->threadCount == 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : options->threadCount;
+    start = currentSeconds();
+    checkInput(&checker, corpus, corpusSize, threadCount, discard);
+    double checkTime = currentSeconds() - start;
+    fclose(discard);
 
-    //////////////////////////////////////////////////////
-    // Step 2: Missing letters at the beginning or the end
-    //////////////////////////////////////////////////////
+    // Typos that happen to be dictionary words get no suggestions, so they are not timed.
+    double* latencies = malloc(sizeof(double) * (typoCount + 1));
+    size_t timed = 0;
+    for (size_t i = 0; i < typoCount; i++)
+    {
+        char* typo = typos + i * (MAX_WORD_LENGTH + 2);
+        if (!isMisspelled(hashTable, typo))
+        {
+            continue;
+        }
+        RankedSuggestion* suggestions;
+        double wordStart = currentSeconds();
+        findCheckerSuggestions(&checker, typo, &suggestions);
+        latencies[timed++] = (currentSeconds() - wordStart) * 1e6;
+        free(suggestions);
+    }
+    qsort(latencies, timed, sizeof(double), compareLatencies);
+    double totalLatency = 0;
+    for (size_t i = 0; i < timed; i++)
+    {
+        totalLatency += latencies[i];
+    }
 
-    // Let's start with the beginning by shifting each character to thr right and then inserting from a to z in the beginning.
-    shiftRight(word);
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peakRssKiB = usage.ru_maxrss;
 
-    // Let's add character from 'a' to 'z' in the front.
-    for (char c = 'a'; c <= 'z'; c++)
-    {
-        word[0] = c;   // Put the character in the front
+    const char* methods[] = { "classic", "symspell", "trie" };
+    double wordsPerSecond = checkTime > 0 ? settings->wordCount / checkTime : 0.0;
+    double p50 = latencyPercentile(latencies, timed, 50);
+    double p99 = latencyPercentile(latencies, timed, 99);
+    double maxLatency = timed > 0 ? latencies[timed - 1] : 0.0;
+    double meanLatency = timed > 0 ? totalLatency / timed : 0.0;
 
-        checkAndAddSuggestion(hashTable, &suggestions, &size, &capacity, word);
+    if (settings->json)
+    {
+        printf("{\"dictionary_words\": %u, \"hash\": \"%s\", \"method\": \"%s\", \"threads\": %d, "
+               "\"corpus_words\": %zu, \"corpus_bytes\": %zu, \"typo_percent\": %d, \"seed\": %llu, \"typos\": %zu, "
+               "\"load_ms\": %.3f, \"build_ms\": %.3f, \"check_ms\": %.3f, \"words_per_second\": %.0f, "
+               "\"suggestion_samples\": %zu, \"suggestion_us_p50\": %.2f, \"suggestion_us_p99\": %.2f, "
+               "\"suggestion_us_max\": %.2f, \"suggestion_us_mean\": %.2f, \"peak_rss_kib\": %ld, \"corpus_kib\": %zu}\n",
+               hashTable->count, activeHash->name, methods[options->method], threadCount,
+               settings->wordCount, corpusSize, settings->typoPercent, (unsigned long long)settings->seed, typoCount,
+               loadTime * 1000, buildTime * 1000, checkTime * 1000, wordsPerSecond,
+               timed, p50, p99, maxLatency, meanLatency, peakRssKiB, corpusAllocated / 1024);
+    } else
+    {
+        printf("Dictionary: %u words loaded in %.1f ms (hash %s), %s suggestions built in %.1f ms\n",
+               hashTable->count, loadTime * 1000, activeHash->name, methods[options->method], buildTime * 1000);
+        printf("Corpus: %zu words, %zu bytes, %zu typos (%d%%, seed %llu)\n",
+               settings->wordCount, corpusSize, typoCount, settings->typoPercent, (unsigned long long)settings->seed);
+        printf("Check: %.1f ms with %d thread%s, %.0f words/s, %.1f MB/s\n", checkTime * 1000, threadCount,
+               threadCount == 1 ? "" : "s", wordsPerSecond, checkTime > 0 ? corpusSize / checkTime / 1e6 : 0.0);
+        printf("Suggestions: %zu misspellings, p50 %.2f us, p99 %.2f us, max %.2f us, mean %.2f us\n",
+               timed, p50, p99, maxLatency, meanLatency);
+        printf("Peak RSS: %.1f MiB, %.1f MiB of it the generated corpus and typos\n", peakRssKiB / 1024.0,
+               corpusAllocated / 1048576.0);
     }
-    strcpy(word, originalWord);    // Get the original word back
 
-    // Now, let's add characters 'a' to 'z' at the end.
-    for (char c = 'a'; c <= 'z'; c++)
-    {
-        word[strlen(word)] = c;
-        word[strlen(word) + 1] = '\0';
+    free(latencies);
+    free(typos);
+    free(corpus);
+    freeThreadSuggestionCache();
+    freeSpellChecker(&checker);
+    freeHashTable(hashTable);
 
-        checkAndAddSuggestion(hashTable, &suggestions, &size, &capacity, word);
+    return 0;
+}
 
-        strcpy(word, originalWord);    // Get the original word back
+// Function to parse one of the optional flags after add|ignore. Returns false if it is not a valid flag.
+bool parseOption(CheckOptions* options, const char* argument)
+{
+    if (strcmp(argument, "--suggest=classic") == 0)
+    {
+        options->method = SUGGEST_CLASSIC;
+    } else if (strcmp(argument, "--suggest=symspell") == 0)
+    {
+        options->method = SUGGEST_SYMSPELL;
+    } else if (strcmp(argument, "--suggest=trie") == 0)
+    {
+        options->method = SUGGEST_TRIE;
+    } else if (strncmp(argument, "--threads=", 10) == 0)
+    {
+        options->threadCount = atoi(argument + 10);
+        return options->threadCount >= 0;
+    } else if (strcmp(argument, "--bloom") == 0)
+    {
+        options->bloomBitsPerWord = BLOOM_DEFAULT_BITS_PER_WORD;
+    } else if (strncmp(argument, "--bloom=", 8) == 0)
+    {
+        options->bloomBitsPerWord = atoi(argument + 8);
+        return options->bloomBitsPerWord >= 1 && options->bloomBitsPerWord <= 64;
+    } else if (strcmp(argument, "--stats") == 0)
+    {
+        options->printStats = true;
+    } else if (strncmp(argument, "--freq=", 7) == 0)
+    {
+        options->frequencyFile = argument + 7;
+    } else if (strncmp(argument, "--socket=", 9) == 0)
+    {
+        options->socketPath = argument + 9;
+    } else if (strcmp(argument, "--mph") == 0)
+    {
+        options->perfectHash = true;
+    } else if (strcmp(argument, "--front-coded") == 0)
+    {
+        options->frontCoded = true;
+    } else if (strcmp(argument, "--journal") == 0)
+    {
+        options->useJournal = true;
+    } else if (strncmp(argument, "--journal=", 10) == 0)
+    {
+        options->useJournal = true;
+        options->journalFile = argument + 10;
+    } else if (strncmp(argument, "--hash=", 7) == 0)
+    {
+        options->hashName = argument + 7;
+    } else if (strncmp(argument, "--tokenizer=", 12) == 0)
+    {
+        options->tokenizer = argument + 12;
+    } else if (strncmp(argument, "--top=", 6) == 0)
+    {
+        options->limit = atoi(argument + 6);
+        return options->limit >= 0;
+    } else if (strncmp(argument, "--max-distance=", 15) == 0)
+    {
+        options->maxDistance = atoi(argument + 15);
+        return options->maxDistance >= 1 && options->maxDistance <= SYMSPELL_MAX_DISTANCE;
+    } else
+    {
+        return false;
     }
 
-    /////////////////////////////////////////////////////
-    // Step 3: Extra letters at the beginning or the end
-    ////////////////////////////////////////////////////
-
-    // Let's remove the first character of the string by shifting left.
-    shiftLeft(word);
+    return true;
+}
 
-    checkAndAddSuggestion(hashTable, &suggestions, &size, &capacity, word);
 
-    strcpy(word, originalWord);     // Get the original word back
+int main(int argc, char **argv)
+{
+    CheckOptions options;
+    options.method = SUGGEST_CLASSIC;
+    options.maxDistance = SYMSPELL_DEFAULT_DISTANCE;
+    options.limit = 0;
+    options.threadCount = 1;
+    options.tokenizer = "auto";
+    options.bloomBitsPerWord = 0;
+    options.printStats = false;
+    options.frequencyFile = NULL;
+    options.socketPath = NULL;
+    options.hashName = DEFAULT_HASH_FUNCTION;
+    options.perfectHash = false;
+    options.frontCoded = false;
+    options.useJournal = false;
+    options.journalFile = NULL;
 
-    // Let's remove the last character of the string by declaring last index as '\0'
-    word[strlen(word) - 1] = '\0';
+    // "compile" mode: ./spell_checker compile words.txt [snapshot] [--hash=name] [--mph] [--threads=N]
+    if (argc >= 3 && strcmp(argv[1], "compile") == 0)
+    {
+        const char* snapshotArgument = NULL;
+        for (int i = 3; i < argc; i++)
+        {
+            if ((strncmp(argv[i], "--hash=", 7) == 0 || strcmp(argv[i], "--mph") == 0 || strncmp(argv[i], "--threads=", 10) == 0)
+                && parseOption(&options, argv[i]))
+            {
+                continue;
+            } else if (argv[i][0] != '-' && snapshotArgument == NULL)
+            {
+                snapshotArgument = argv[i];
+            } else
+            {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (!selectHashFunction(options.hashName))
+        {
+            fprintf(stderr, "Unknown hash function: %s\n", options.hashName);
+            return 1;
+        }
+        char* snapshotPath = snapshotArgument != NULL ? strdup(snapshotArgument) : snapshotPathFor(argv[2]);
+        int status = compileDictionary(argv[2], snapshotPath, &options);
+        free(snapshotPath);
+        return status;
+    }
 
-    checkAndAddSuggestion(hashTable, &suggestions, &size, &capacity, word);
-    
-    strcpy(word, originalWord);     // Get the original word back
+    // "compact" mode: ./spell_checker compact words.txt [--journal=path] [--hash=name] [--mph] [--threads=N]
+    if (argc >= 3 && strcmp(argv[1], "compact") == 0)
+    {
+        for (int i = 3; i < argc; i++)
+        {
+            if ((strncmp(argv[i], "--journal=", 10) != 0 && strncmp(argv[i], "--hash=", 7) != 0 && strcmp(argv[i], "--mph") != 0
+                 && strncmp(argv[i], "--threads=", 10) != 0) || !parseOption(&options, argv[i]))
+            {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (!selectHashFunction(options.hashName))
+        {
+            fprintf(stderr, "Unknown hash function: %s\n", options.hashName);
+            return 1;
+        }
+        char* journalPath = journalPathFor(argv[2], &options);
+        int status = 0;
+        int journalLock = lockJournal(journalPath, false);
+        if (journalLock == -1 && errno != ENOENT)
+        {
+            fprintf(stderr, "Error opening file %s\n", journalPath);
+            status = 1;
+        } else if (journalLock != -1 && !compactJournal(argv[2], journalPath, &options))
+        {
+            fprintf(stderr, "Could not fold %s into %s\n", journalPath, argv[2]);
+            status = 1;
+        }
+        if (journalLock != -1)
+        {
+            close(journalLock);
+        }
+        free(journalPath);
+        return status;
+    }
 
-    //////////////////////////////////
-    // Finally, print the suggestions
-    //////////////////////////////////
+    // "prefix" mode: ./spell_checker prefix words.txt <prefix> [--hash=name]
+    if (argc >= 4 && strcmp(argv[1], "prefix") == 0)
+    {
+        for (int i = 4; i < argc; i++)
+        {
+            if (strncmp(argv[i], "--hash=", 7) != 0 || !parseOption(&options, argv[i]))
+            {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (!selectHashFunction(options.hashName))
+        {
+            fprintf(stderr, "Unknown hash function: %s\n", options.hashName);
+            return 1;
+        }
+        return listPrefix(argv[2], argv[3]);
+    }
 
-    printf("Suggestions: ");
-    for (int i = 0; i < size; i++)
+    // "bench-suggest" mode: ./spell_checker bench-suggest words.txt [count] [--max-distance=N] [--top=N]
+    if (argc >= 3 && strcmp(argv[1], "bench-suggest") == 0)
     {
-        printf("%s ", suggestions[i]);
+        int wordCount = BENCHMARK_DEFAULT_WORDS;
+        for (int i = 3; i < argc; i++)
+        {
+            if (argv[i][0] != '-')
+            {
+                wordCount = atoi(argv[i]);
+            } else if (!parseOption(&options, argv[i]))
+            {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (!selectHashFunction(options.hashName))
+        {
+            fprintf(stderr, "Unknown hash function: %s\n", options.hashName);
+            return 1;
+        }
+        if (options.frontCoded)
+        {
+            fprintf(stderr, "bench-suggest times the trie and the deletion index too, which --front-coded cannot build\n");
+            return 1;
+        }
+        return benchmarkSuggestions(argv[2], wordCount > 0 ? wordCount : BENCHMARK_DEFAULT_WORDS, &options);
     }
 
-    ///////////////////////////////////////////////////////
-    // Time to free the sugesstions array and originalWord.
-    //////////////////////////////////////////////////////
-    for (int i = 0; i < size; i++)
+    // "bench" mode: ./spell_checker bench words.txt [--words=N] [--typo-rate=P] [--seed=N] [--json] [options]
+    if (argc >= 3 && strcmp(argv[1], "bench") == 0)
     {
-        free(suggestions[i]);
+        BenchmarkSettings settings;
+        settings.wordCount = BENCHMARK_CORPUS_WORDS;
+        settings.typoPercent = BENCHMARK_TYPO_PERCENT;
+        settings.seed = BENCHMARK_SEED;
+        settings.json = false;
+        for (int i = 3; i < argc; i++)
+        {
+            if (strncmp(argv[i], "--words=", 8) == 0 && atol(argv[i] + 8) > 0)
+            {
+                settings.wordCount = atol(argv[i] + 8);
+            } else if (strncmp(argv[i], "--typo-rate=", 12) == 0 && atoi(argv[i] + 12) >= 0 && atoi(argv[i] + 12) <= 100)
+            {
+                settings.typoPercent = atoi(argv[i] + 12);
+            } else if (strncmp(argv[i], "--seed=", 7) == 0)
+            {
+                settings.seed = strtoull(argv[i] + 7, NULL, 0);
+            } else if (strcmp(argv[i], "--json") == 0)
+            {
+                settings.json = true;
+            } else if (!parseOption(&options, argv[i]))
+            {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (!selectTokenizer(options.tokenizer) || !selectHashFunction(options.hashName))
+        {
+            fprintf(stderr, "Unknown tokenizer or hash function: %s, %s\n", options.tokenizer, options.hashName);
+            return 1;
+        }
+        return runBenchmark(argv[2], &settings, &options);
     }
-    free(suggestions);
-    free(word);
-}
 
-// Function to free the hash table
-void freeHashTable(openHashTable* hashTable) {
-    for (int i = 0; i < hashTable->size; i++) {
-        Node* current = hashTable->buckets[i];
+    // "serve" mode: ./spell_checker serve words.txt [--socket=path] [options]
+    if (argc >= 3 && strcmp(argv[1], "serve") == 0)
+    {
+        for (int i = 3; i < argc; i++)
+        {
+            if (!parseOption(&options, argv[i]))
+            {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (!selectHashFunction(options.hashName))
+        {
+            fprintf(stderr, "Unknown hash function: %s\n", options.hashName);
+            return 1;
+        }
+        return runServer(argv[2], &options);
+    }
 
-        while (current != NULL) {
-            Node* temp = current;
-            current = current->next;
-            free(temp->word);
-            free(temp);
+    // "client" mode: ./spell_checker client words.txt test.txt add|ignore [--socket=path]
+    if (argc >= 5 && strcmp(argv[1], "client") == 0)
+    {
+        for (int i = 5; i < argc; i++)
+        {
+            if (strncmp(argv[i], "--socket=", 9) != 0 || !parseOption(&options, argv[i]))
+            {
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        if (!selectTokenizer(options.tokenizer))
+        {
+            return 1;
         }
+        return runClient(argv[2], argv[3], strcmp(argv[4], "add") == 0, &options);
     }
-    free(hashTable->buckets);
-    free(hashTable);
-}
 
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s <dictionary> <input> add|ignore [--suggest=classic|symspell|trie] [--max-distance=1..%d] [--top=N] [--threads=N] [--tokenizer=auto|avx2|sse2|scalar]\n"
+                        "       %*s [--freq=path] [--bloom[=bits per word]] [--mph] [--front-coded] [--hash=poly101|fnv1a|murmur3|wyhash] [--journal[=path]] [--stats]\n"
+                        "       %s compile <dictionary> [snapshot] [--hash=name] [--mph] [--threads=N]\n"
+                        "       %s compact <dictionary> [--journal=path] [--mph] [--threads=N]\n"
+                        "       %s prefix <dictionary> <prefix> [--hash=name]\n"
+                        "       %s bench-suggest <dictionary> [count] [--max-distance=1..%d] [--top=N] [--freq=path]\n"
+                        "       %s bench <dictionary> [--words=N] [--typo-rate=0..100] [--seed=N] [--json] [check options]\n"
+                        "       %s serve <dictionary> [--socket=path] [--suggest=...] [--max-distance=N] [--top=N] [--freq=path] [--bloom[=N]] [--stats]\n"
+                        "       %s client <dictionary> <input> add|ignore [--socket=path]\n",
+                argv[0], SYMSPELL_MAX_DISTANCE, (int)strlen(argv[0]), "", argv[0], argv[0], argv[0], argv[0], SYMSPELL_MAX_DISTANCE, argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    for (int i = 4; i < argc; i++)
+    {
+        if (!parseOption(&options, argv[i]))
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!selectTokenizer(options.tokenizer))
+    {
+        fprintf(stderr, "Tokenizer not available on this machine: %s\n", options.tokenizer);
+        return 1;
+    }
+    if (!selectHashFunction(options.hashName))
+    {
+        fprintf(stderr, "Unknown hash function: %s\n", options.hashName);
+        return 1;
+    }
 
-int main(int argc, char **argv)
-{
 	char *dictionaryFilePath = argv[1]; //this keeps the path to the dictionary file file
 	char *inputFilePath = argv[2]; //this keeps the path to the input text file
 	char *check = argv[3]; // this keeps the flag to whether we should insert mistyped words into dictionary or ignore
-	int numOfWords = 0; //this variable will tell us how much memory to allocate
 
 	int insertToDictionary;
 	if(strcmp(check,"add")==0)
 		insertToDictionary = 1;
 	else
 		insertToDictionary = 0;
+
+    // An add run with a journal locks it before loading the dictionary, so another run cannot compact the
+    // journal into the dictionary between the two loads.
+    char* journalPath = NULL;
+    int journalLock = -1;
+    if (options.useJournal)
+    {
+        journalPath = journalPathFor(dictionaryFilePath, &options);
+        if (insertToDictionary == 1 && (journalLock = lockJournal(journalPath, true)) == -1)
+        {
+            fprintf(stderr, "Error opening file %s\n", journalPath);
+            exit(1);
+        }
+    }
     
 	////////////////////////////////////////////////////////////////////
-	//read dictionary file
-    FILE *fp = fopen(dictionaryFilePath, "r");
-    char *line = NULL; //variable to be used for line counting
-    size_t lineBuffSize = 0; //variable to be used for line counting
-    ssize_t lineSize; //variable to be used for line counting
+	//read dictionary file: its compiled snapshot if there is an up-to-date one, otherwise the text in one pass
+    openHashTable* newOpenHashTable = openDictionary(dictionaryFilePath);
 
     //check if the file is accessible, just to make sure...
-    if(fp == NULL)
+    if(newOpenHashTable == NULL)
     {
         fprintf(stderr, "Error opening file\n");
         exit(1);
     }
 
-    //First, let's count number of words in the dictionary.
-    //This will help us know how much memory to allocate for our hash table
-    while((lineSize = getline(&line,&lineBuffSize,fp)) !=-1)
-        numOfWords++;
-    
-    //HINT: You can initialize your hash table here, since you know the size of the dictionary
-    openHashTable* newOpenHashTable = malloc(sizeof(openHashTable));
-    newOpenHashTable->buckets = malloc(sizeof(Node*) * numOfWords);
-    newOpenHashTable->size = numOfWords;
+    // Replay the words earlier add-mode runs put in the journal, and keep appending to it in add mode.
+    uint32_t journalWords = 0;
+    off_t journalSize = 0;
+    if (options.useJournal)
+    {
+        if (!replayJournal(newOpenHashTable, journalPath, &journalWords, &journalSize))
+        {
+            fprintf(stderr, "Error opening file %s\n", journalPath);
+            exit(1);
+        }
+    }
 
-    for (int i = 0; i < newOpenHashTable -> size; i++)
+    if (!prepareDictionary(newOpenHashTable, &options))
     {
-        newOpenHashTable->buckets[i] = NULL;
+        exit(1);
     }
-    
-    //rewind file pointer to the beginning of the file, to be able to read it line by line.
-    fseek(fp, 0, SEEK_SET);
 
-    char wrd[BUFSIZE];
-    for (int i = 0; i < numOfWords; i++)
+    SpellChecker checker;
+    initSpellChecker(&checker, newOpenHashTable, &options, insertToDictionary == 1);
+    if (journalPath != NULL && insertToDictionary == 1)
     {
-        fscanf(fp, "%s \n", wrd);
-        
-        //HINT: here is a good place to insert the words into your hash table
-        insertToHashTable(newOpenHashTable, wrd);
+        checker.journal = openJournal(journalLock, journalPath, journalSize, journalWords);
+        if (checker.journal == NULL)
+        {
+            fprintf(stderr, "Error opening file %s\n", journalPath);
+            exit(1);
+        }
     }
-    fclose(fp);
-    
+
+    int threadCount = options.threadCount == 0 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : options.threadCount;
+
 	////////////////////////////////////////////////////////////////////
 	//read the input text file word by word
-    fp = fopen(inputFilePath, "r");
+    size_t inputSize;
+    bool inputIsMapped;
+    char* input = readInputFile(inputFilePath, &inputSize, &inputIsMapped);
 	
 	//check if the file is accessible, just to make sure...
-	if(fp == NULL)
+	if(input == NULL)
 	{
 		fprintf(stderr, "Error opening file\n");
 		return -1;
 	}
 
     //HINT: You can use a flag to indicate if there is a misspleed word or not, which is initially set to 1
-	int noTypo=1;
-    
-	//read a line from the input file
-	while((lineSize = getline(&line,&lineBuffSize,fp)) !=-1)
-	{
-		char *word;
-        //These are the delimiters you are expected to check for. Nothing else is needed here.
-		const char delimiter[]= " ,.:;!\n";
-
-		//split the buffer by delimiters to read a single word
-		word = strtok(line,delimiter); 
-		
-		//read the line word by word
-		while(word!=NULL)
-		{
-            // HINT: Since this nested while loop will keep reading the input text word by word, here is a good place to check for misspelled words
-            if (isMisspelled(newOpenHashTable, word))
-            {
-                noTypo = 0;
-                printf("Misspelled word: %s\n",word);                
-                printSuggestions(newOpenHashTable, word);
-                printf("\n");
-
-                if (insertToDictionary == 1)
-                {
-                    insertToHashTable(newOpenHashTable, word);
-                }
-            }
-            
-			word = strtok(NULL,delimiter); 
-		}
-	}
-	fclose(fp);
+	int noTypo = checkInput(&checker, input, inputSize, threadCount, stdout) ? 0 : 1;
+
+    freeInputFile(input, inputSize, inputIsMapped);
     
+    mergeLookupStats();
+    if (options.printStats)
+    {
+        printLookupStats(newOpenHashTable);
+    }
+
     //HINT: If the flag noTypo is not altered (which you should do in the loop above if there exists a word not in the dictionary), then you should print "No typo!"
     if(noTypo==1)
         printf("No typo!\n");
     
 
+    // Once the journal is long enough, fold it into the dictionary so later runs do not replay it word by word.
+    // That happens before closeJournal gives up the lock.
+    if (checker.journal != NULL)
+    {
+        syncJournal(checker.journal);
+        bool compact = checker.journal->wordCount >= JOURNAL_COMPACT_WORDS && !checker.journal->failed;
+        if (compact && !compactJournal(dictionaryFilePath, journalPath, &options))
+        {
+            fprintf(stderr, "Could not fold %s into %s\n", journalPath, dictionaryFilePath);
+        }
+        closeJournal(checker.journal);
+    }
+    free(journalPath);
+
     // DON'T FORGET to free the memory that you allocated
+    freeThreadSuggestionCache();
+    freeSpellChecker(&checker);
     freeHashTable(newOpenHashTable);
     
 	return 0;
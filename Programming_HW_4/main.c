@@ -1,6 +1,60 @@
+// Build with: gcc -O2 -pthread -o huffman main.c
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// The encoded file is a binary container: a 16-byte header, the code lengths, then the code bits packed 8 to a
+// byte, first bit in the most significant position. The header is CONTAINER_MAGIC, the container version and
+// the exact number of code bits (both little-endian), so the zero bits padding the last byte are never decoded.
+// The code lengths of the 256 characters follow as runs: a byte with the run length minus one, then the code
+// length shared by the run. The codes are canonical, so the lengths are all the decoder needs.
+// Version 1 containers have no code lengths and are decoded with the codes from the code table file.
+// Files that do not start with the magic are read as the old text format, one '0' or '1' character per bit.
+#define CONTAINER_MAGIC "HUFB"
+#define CONTAINER_VERSION 2
+#define CONTAINER_HEADER_SIZE 16
+
+// A stream has the same header with STREAM_VERSION and the block size in place of the bit count, then blocks
+// that each carry their own codes, so it can be written and read in one pass through a pipe. A block is the
+// number of characters in it (4 bytes) and its number of code bits (8 bytes), both little-endian, its code
+// lengths and its code bits, padded to a whole byte. A block of 0 characters, with nothing after the count
+// and bit count, ends the stream.
+// After the end block comes the block index: the offset of every block and of the end block from the start of
+// the stream (8 bytes each), then the number of blocks (8 bytes) and STREAM_INDEX_MAGIC. A decoder reading
+// the stream in order stops at the end block and never sees it; one that can seek finds every block from it.
+// An INTERLEAVED_STREAM_VERSION stream splits every block's characters into INTERLEAVED_STREAMS equal parts
+// (the last one shorter), encoded one after another with the block's codes. Between the code lengths and the
+// code bits are the bit counts of the parts (8 bytes each, little-endian), and each part is padded to a whole
+// byte, so the decoder can find every part and decode them all in one loop.
+#define STREAM_VERSION 3
+#define INTERLEAVED_STREAM_VERSION 4
+#define INTERLEAVED_STREAMS 4
+#define STREAM_BLOCK_HEADER_SIZE 12
+#define DEFAULT_BLOCK_SIZE (256 * 1024)
+#define MAX_BLOCK_SIZE (64 * 1024 * 1024)
+#define STREAM_INDEX_MAGIC "HUFI"
+#define STREAM_INDEX_FOOTER_SIZE 12
+
+// With --threads, workers run at most this many blocks per thread ahead of the output.
+#define BLOCKS_IN_FLIGHT_PER_THREAD 4
+
+// Longest code a container may declare. The decoder needs a whole code in its 57-bit accumulator, and
+// 32-bit frequencies give codes of at most 46 bits.
+#define MAX_CODE_LENGTH 57
+
+// Bytes the bit writer and reader collect before each fwrite / fread.
+#define BIT_BUFFER_SIZE 65536
+
+// Bits the decoder looks at per table lookup. The primary table has 2^DECODE_TABLE_BITS entries; codes longer
+// than that continue in subtables of at most as many bits. 11 bits keeps the primary table (16 KiB) in L1.
+#define DECODE_TABLE_BITS 11
+
+// Times each decoder runs over the encoded file in bench mode; the best run is reported.
+#define BENCH_RUNS 5
 
 // a struct to keep frequency and binary code representation of a character
 typedef struct CodeTable{
@@ -8,6 +62,95 @@ typedef struct CodeTable{
   char *binary_code;
 } CodeTable;
 
+// The code of every character as a number, and its length in bits (0 for characters not in the text).
+typedef struct CodeBook
+{
+  uint64_t codes[256];
+  unsigned char lengths[256];
+} CodeBook;
+
+// Collects code bits in a 64-bit accumulator and writes them out a whole word at a time through a buffer.
+// With no file, the buffer is copied to memory instead, which must have room for all the bytes.
+typedef struct BitWriter
+{
+  FILE* file;
+  unsigned char* memory;
+  size_t memorySize;
+  uint64_t accumulator;   // the last bitCount bits are waiting to be written
+  int bitCount;           // always less than 64
+  uint64_t totalBits;
+  unsigned char buffer[BIT_BUFFER_SIZE];
+  size_t bufferSize;
+} BitWriter;
+
+// Hands out the code bits of a container, reading the file through a buffer. With no file the buffer is the
+// whole payload, already in memory.
+typedef struct BitReader
+{
+  FILE* file;
+  uint64_t accumulator;   // the first bitCount bits are the next ones
+  int bitCount;
+  uint64_t bitsLeft;      // code bits not handed out yet, from the header
+  unsigned char* buffer;
+  size_t bufferSize;
+  size_t bufferPosition;
+} BitReader;
+
+// One entry of the decoding table, found by the next DECODE_TABLE_BITS bits (or subtableBits bits in a subtable).
+// A primary entry decodes up to two symbols when both codes fit in its bits. An entry with symbolCount 0
+// belongs to a code longer than the table: it skips `length` bits and continues in the subtable.
+typedef struct DecodeEntry
+{
+  unsigned char symbols[2];
+  unsigned char symbolCount;
+  unsigned char length;         // bits taken by all the symbols of the entry
+  unsigned char firstLength;    // bits taken by the first symbol alone
+  unsigned char subtableBits;
+  uint32_t subtable;            // index of the subtable's first entry
+} DecodeEntry;
+
+// The primary table followed by all its subtables, in one array.
+typedef struct DecodeTable
+{
+  DecodeEntry* entries;
+  uint32_t size;
+  uint32_t capacity;
+} DecodeTable;
+
+// One block of a stream on its way through the worker pool: the bytes going in and the bytes coming out.
+typedef struct StreamBlock
+{
+  unsigned char* input;
+  size_t inputSize;
+  size_t inputCapacity;
+  unsigned char* output;
+  size_t outputSize;
+  size_t outputCapacity;
+  uint64_t bitCount;        // code bits of an encoded block, for the statistics
+  int done;
+  int failed;
+} StreamBlock;
+
+// State shared by the worker threads of a parallel stream-encode or stream-decode.
+typedef struct ParallelStream
+{
+  StreamBlock* blocks;      // block i is in blocks[i % window]
+  size_t window;            // how far ahead of nextToWrite the workers may go
+  size_t blocksReady;       // blocks handed to the workers so far
+  size_t nextBlock;         // next block a worker will take
+  size_t nextToWrite;       // next block the main thread will write
+  int inputDone;            // no block will be added after blocksReady
+  int stopping;             // the main thread gave up; workers take no more blocks
+  int encoding;
+  int interleaved;          // blocks are split into INTERLEAVED_STREAMS parts
+  int maxCodeLength;        // encoding: --max-code-length, or 0
+  int fd;                   // decoding: the stream, read by the workers at the offsets of the index
+  uint64_t* offsets;
+  pthread_mutex_t lock;
+  pthread_cond_t blockReady;
+  pthread_cond_t blockDone;
+} ParallelStream;
+
 typedef struct Node
 {
   unsigned frequency;
@@ -203,216 +346,2143 @@ void labelHuffmanEdges(Node* node, CodeTable* codeTable, char* binaryArray, int
   }
 }
 
-// Function to traverse the huffman tree and write to decode file. Only for decode mode.
-void traverseAndDecode(char* encodedTextFilePath, char* decodedTextFilePath, Node* node)
+// Function to turn the '0'/'1' code strings of a code table into a code book.
+void codeBookFromCodeTable(CodeTable* codeTable, CodeBook* book)
 {
-  FILE* encodedFile = fopen(encodedTextFilePath, "r");
-  if (encodedFile == NULL)
+  for (int i = 0; i < 256; i++)
   {
-    printf("Could not open file to write: %s\n",encodedTextFilePath);
-    return;
+    book->codes[i] = 0;
+    book->lengths[i] = 0;
+    if (codeTable[i].binary_code != NULL)
+    {
+      for (int j = 0; codeTable[i].binary_code[j] != '\0' && j < 64; j++)
+      {
+        book->codes[i] = (book->codes[i] << 1) | (codeTable[i].binary_code[j] == '1');
+        book->lengths[i]++;
+      }
+    }
   }
+}
 
-  FILE* decodedFile = fopen(decodedTextFilePath, "w");
-  if (decodedFile == NULL)
+// Function to give the characters canonical codes from their code lengths: shorter codes first, and codes of
+// the same length in character order, each one the previous code plus one. Returns 0 if the lengths cannot
+// be the lengths of a prefix code.
+int assignCanonicalCodes(CodeBook* book)
+{
+  int lengthCount[MAX_CODE_LENGTH + 1] = {0};
+  for (int i = 0; i < 256; i++)
   {
-    printf("Could not open file to write: %s\n",decodedTextFilePath);
-    return;
+    if (book->lengths[i] > MAX_CODE_LENGTH)
+    {
+      return 0;
+    }
+    lengthCount[book->lengths[i]]++;
   }
+  lengthCount[0] = 0;
 
-  char bit;
-  Node* currentNode = node;
-  while ((bit = fgetc(encodedFile)) != EOF)
-  {    
-    if (bit == '0')
+  // The first code of each length follows the last code of the length before, with a 0 appended.
+  uint64_t nextCode[MAX_CODE_LENGTH + 1];
+  uint64_t code = 0;
+  for (int length = 1; length <= MAX_CODE_LENGTH; length++)
+  {
+    code = (code + lengthCount[length - 1]) << 1;
+    nextCode[length] = code;
+    if (lengthCount[length] > 0 && code + lengthCount[length] - 1 >= (1ull << length))
     {
-      currentNode = currentNode->left;
+      return 0;
+    }
+  }
 
-    } else if (bit == '1')
+  for (int i = 0; i < 256; i++)
+  {
+    book->codes[i] = book->lengths[i] > 0 ? nextCode[book->lengths[i]]++ : 0;
+  }
+
+  return 1;
+}
+
+// Function to find the longest code in a code book.
+int longestCode(CodeBook* book)
+{
+  int longest = 0;
+  for (int i = 0; i < 256; i++)
+  {
+    if (book->lengths[i] > longest)
     {
-      currentNode = currentNode->right;
+      longest = book->lengths[i];
     }
+  }
 
-    // We've hit the leaf node. Write the character in the current node to decodedFile.
-    if (currentNode->left == NULL && currentNode->right == NULL)
+  return longest;
+}
+
+// Function to give the characters of a code table the best code lengths of at most maxLength bits, with the
+// package-merge algorithm. Starting from the characters sorted by frequency, each round pairs up the list of
+// the round before into packages and merges them with the characters again; after maxLength - 1 rounds the
+// 2n - 2 lightest items hold each character once for every bit of its code. Every item keeps a count per
+// character of what it holds. Returns 0 if maxLength bits are too few for the number of characters.
+int limitCodeLengths(CodeTable* codeTable, CodeBook* book, int maxLength)
+{
+  int symbols[256];
+  int n = 0;
+  for (int i = 0; i < 256; i++)
+  {
+    if (codeTable[i].frequency > 0)
     {
-      fprintf(decodedFile, "%c", currentNode->character);
-      currentNode = node;
+      symbols[n++] = i;
     }
   }
+  if (n < 2 || (maxLength < 9 && n > (1 << maxLength)))
+  {
+    return n < 2;
+  }
 
-  fclose(encodedFile);
-  fclose(decodedFile);
-}
+  // Lightest first, and characters in order between equal frequencies.
+  for (int i = 1; i < n; i++)
+  {
+    int symbol = symbols[i];
+    int j = i - 1;
+    while (j >= 0 && codeTable[symbols[j]].frequency > codeTable[symbol].frequency)
+    {
+      symbols[j + 1] = symbols[j];
+      j--;
+    }
+    symbols[j + 1] = symbol;
+  }
 
-// Partition function.
-int partition(Node** arr, int low, int high) {
-  int mid = low + (high - low)/2;
-  Node* pivot = arr[mid];  // Taking middle element as the pivot.
-  int i = low - 1;
+  // Two lists of at most 2n items: the one being read and the one being built.
+  int capacity = 2 * n;
+  uint64_t* weights[2] = {malloc(sizeof(uint64_t) * capacity), malloc(sizeof(uint64_t) * capacity)};
+  unsigned char* counts[2] = {malloc((size_t)capacity * n), malloc((size_t)capacity * n)};
+  int size = n;
+  for (int i = 0; i < n; i++)
+  {
+    weights[0][i] = codeTable[symbols[i]].frequency;
+    memset(counts[0] + (size_t)i * n, 0, n);
+    counts[0][(size_t)i * n + i] = 1;
+  }
 
-  swap(&arr[mid], &arr[high]);    // Swapping the pivot with the last element.
+  int current = 0;
+  for (int round = 1; round < maxLength; round++)
+  {
+    int next = 1 - current;
+    int packages = size / 2;
+    int leaf = 0, package = 0, newSize = 0;
+    while (leaf < n || package < packages)
+    {
+      uint64_t packageWeight = package < packages ? weights[current][2 * package] + weights[current][2 * package + 1] : 0;
+      unsigned char* itemCounts = counts[next] + (size_t)newSize * n;
+      if (package == packages || (leaf < n && codeTable[symbols[leaf]].frequency <= packageWeight))
+      {
+        weights[next][newSize] = codeTable[symbols[leaf]].frequency;
+        memset(itemCounts, 0, n);
+        itemCounts[leaf] = 1;
+        leaf++;
+      } else
+      {
+        weights[next][newSize] = packageWeight;
+        unsigned char* first = counts[current] + (size_t)(2 * package) * n;
+        for (int i = 0; i < n; i++)
+        {
+          itemCounts[i] = first[i] + first[n + i];
+        }
+        package++;
+      }
+      newSize++;
+    }
+    size = newSize;
+    current = next;
+  }
 
-  for (int j = low; j < high; j++) {
-    if (arr[j]->frequency < pivot->frequency || (arr[j]->frequency == pivot->frequency && arr[j]->character < pivot->character)) 
+  for (int i = 0; i < n; i++)
+  {
+    int length = 0;
+    for (int item = 0; item < 2 * n - 2; item++)
     {
-      i++;
-      swap(&arr[i], &arr[j]);
+      length += counts[current][(size_t)item * n + i];
     }
+    book->lengths[symbols[i]] = (unsigned char)length;
   }
 
-  swap(&arr[i + 1], &arr[high]);  // Putting the pivot in the middle.
-  return i + 1;   // Returning pivot's index
+  for (int i = 0; i < 2; i++)
+  {
+    free(weights[i]);
+    free(counts[i]);
+  }
+  return 1;
 }
 
-// Quicksort function.
-void quickSort(Node** arr, int low, int high) {
-  if (low < high) {
-    int pivotIndex = partition(arr, low, high);
-    quickSort(arr, low, pivotIndex - 1);
-    quickSort(arr, pivotIndex + 1, high);
+// Function to write the codes of a code book back into the '0'/'1' strings of a code table.
+void codeTableFromCodeBook(CodeBook* book, CodeTable* codeTable)
+{
+  for (int i = 0; i < 256; i++)
+  {
+    if (codeTable[i].binary_code == NULL)
+    {
+      continue;
+    }
+
+    free(codeTable[i].binary_code);
+    codeTable[i].binary_code = malloc(book->lengths[i] + 1);
+    for (int j = 0; j < book->lengths[i]; j++)
+    {
+      codeTable[i].binary_code[j] = (book->codes[i] >> (book->lengths[i] - 1 - j)) & 1 ? '1' : '0';
+    }
+    codeTable[i].binary_code[book->lengths[i]] = '\0';
   }
 }
 
-// Calculate compressed size.
-int calculateCompressedSize(CodeTable* codeTable, Node** nodeArray, int nodeCount)
+// Function to store a number in the given number of bytes, least significant byte first.
+void writeLittleEndian(unsigned char* bytes, uint64_t value, int byteCount)
 {
-  int compressed_size = 0;
-
-  for (int i = 0; i < nodeCount; i++)
+  for (int i = 0; i < byteCount; i++)
   {
-    compressed_size += strlen(codeTable[nodeArray[i]->character].binary_code) * (nodeArray[i]->frequency);
+    bytes[i] = (unsigned char)(value >> (8 * i));
   }
-  
-  return compressed_size;
 }
 
-// This function will write the encoded version of the input text file into text file.
-void writeEncodedToFile(char* inputTextFilePath, char* encodedTextFilePath, CodeTable* codeTable)
+// Function to read a number stored least significant byte first.
+uint64_t readLittleEndian(const unsigned char* bytes, int byteCount)
 {
-  FILE* inputFile = fopen(inputTextFilePath, "r");
-
-  if (inputFile == NULL)
+  uint64_t value = 0;
+  for (int i = byteCount - 1; i >= 0; i--)
   {
-    printf("Could not open file to read: %s\n",inputTextFilePath);
-    return;
+    value = (value << 8) | bytes[i];
   }
 
-  FILE* encodeFile = fopen(encodedTextFilePath, "w");
+  return value;
+}
+
+// Function to write the 16-byte header of a container or stream.
+int writeHeader(FILE* file, int version, uint64_t value)
+{
+  unsigned char header[CONTAINER_HEADER_SIZE];
+  memcpy(header, CONTAINER_MAGIC, 4);
+  writeLittleEndian(header + 4, version, 4);
+  writeLittleEndian(header + 8, value, 8);
 
-  if (encodeFile == NULL)
+  return fwrite(header, CONTAINER_HEADER_SIZE, 1, file) == 1;
+}
+
+// Function to write the container header for a payload of bitCount code bits.
+int writeContainerHeader(FILE* file, uint64_t bitCount)
+{
+  return writeHeader(file, CONTAINER_VERSION, bitCount);
+}
+
+// Function to read the container header. Returns the container version and stores the number of code bits
+// (the block size for a stream), 0 if the file does not start with the magic (an old text file), and -1 for
+// a version we cannot read.
+int readContainerHeader(FILE* file, uint64_t* bitCount)
+{
+  unsigned char header[CONTAINER_HEADER_SIZE];
+  if (fread(header, 1, CONTAINER_HEADER_SIZE, file) != CONTAINER_HEADER_SIZE || memcmp(header, CONTAINER_MAGIC, 4) != 0)
   {
-    printf("Could not open file to read: %s\n",encodedTextFilePath);
-    return;
+    return 0;
+  }
+  uint64_t version = readLittleEndian(header + 4, 4);
+  if (version < 1 || version > INTERLEAVED_STREAM_VERSION)
+  {
+    return -1;
   }
 
-  char c;
-  while ((c = fgetc(inputFile)) != EOF && c != '\n')
+  *bitCount = readLittleEndian(header + 8, 8);
+  return (int)version;
+}
+
+// Function to store the code lengths of the 256 characters as runs of equal lengths. Returns the number of
+// bytes, at most 512.
+int codeLengthRuns(CodeBook* book, unsigned char* runs)
+{
+  int size = 0;
+  for (int i = 0; i < 256; )
   {
-    fprintf(encodeFile, "%s", codeTable[c].binary_code);
+    int run = 1;
+    while (i + run < 256 && book->lengths[i + run] == book->lengths[i])
+    {
+      run++;
+    }
+    runs[size++] = (unsigned char)(run - 1);
+    runs[size++] = book->lengths[i];
+    i += run;
   }
 
-  fclose(inputFile);
-  fclose(encodeFile);
+  return size;
 }
 
-// Function to recursively free the Huffman tree nodes
-void freeHuffmanTree(Node* node)
+// Function to write the code lengths of the 256 characters as runs of equal lengths.
+int writeCodeLengths(FILE* file, CodeBook* book)
 {
-  if (node == NULL) return;
-  
-  // Recursively free left and right subtrees
-  freeHuffmanTree(node->left);
-  freeHuffmanTree(node->right);
-  
-  // Free the current node
-  free(node);
+  unsigned char runs[512];
+  int size = codeLengthRuns(book, runs);
+
+  return fwrite(runs, 1, size, file) == (size_t)size;
 }
 
-// Free all the dynamically allocated memory
-void freeMemory(Heap* heap, CodeTable* codeTable, Node** nodeArray)
+// Function to start a bit writer on a file.
+void initBitWriter(BitWriter* writer, FILE* file)
 {
-  // Free the Huffman tree (root node is in heap->array[0])
-  freeHuffmanTree(heap->array[0]);
+  writer->file = file;
+  writer->memory = NULL;
+  writer->memorySize = 0;
+  writer->accumulator = 0;
+  writer->bitCount = 0;
+  writer->totalBits = 0;
+  writer->bufferSize = 0;
+}
 
-  // Free the heap
-  free(heap->array);
-  free(heap);
+// Function to start a bit writer on memory with room for all the bytes it will write.
+void initMemoryBitWriter(BitWriter* writer, unsigned char* memory)
+{
+  initBitWriter(writer, NULL);
+  writer->memory = memory;
+}
 
-  // Free the codeTable binary codes
-  for (int i = 0; i < 256; i++)
+// Function to write out the bytes the bit writer has collected.
+void flushBitBuffer(BitWriter* writer)
+{
+  if (writer->file != NULL)
   {
-    free(codeTable[i].binary_code);
+    fwrite(writer->buffer, 1, writer->bufferSize, writer->file);
+  } else
+  {
+    memcpy(writer->memory + writer->memorySize, writer->buffer, writer->bufferSize);
+    writer->memorySize += writer->bufferSize;
   }
-
-  free(codeTable);
-  free(nodeArray);
+  writer->bufferSize = 0;
 }
 
+// Function to add a full 64-bit word to the buffer, most significant byte first so the bits stay in order.
+void emitWord(BitWriter* writer, uint64_t word)
+{
+  if (writer->bufferSize + 8 > BIT_BUFFER_SIZE)
+  {
+    flushBitBuffer(writer);
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    writer->buffer[writer->bufferSize++] = (unsigned char)(word >> (56 - 8 * i));
+  }
+}
 
-int main(int argc, char **argv)
+// Function to write the low `length` bits of value (at most 32), most significant first.
+void writeBits(BitWriter* writer, uint64_t value, int length)
 {
-  char* mode = argv[1];
-  char* inputTextFilePath;
-  char* codeTableFilePath;
-  char* encodedTextFilePath;
-  char* decodedTextFilePath;
+  writer->totalBits += length;
 
-  //argv[1] will be "encode" or "decode" signifying the mode of the program
-  if (strcmp(mode, "encode") == 0)
+  if (writer->bitCount + length < 64)
   {
-    /*----------------ENCODER-----------------------*/
-
-    inputTextFilePath = argv[2];
-    codeTableFilePath = argv[3];
-    encodedTextFilePath = argv[4];
+    writer->accumulator = (writer->accumulator << length) | value;
+    writer->bitCount += length;
+    return;
+  }
 
-    // Read the input text file
-    FILE *inputFile = fopen(inputTextFilePath, "r");
+  // The accumulator fills up: top it off with the first bits of value and write the word.
+  int room = 64 - writer->bitCount;
+  int rest = length - room;
+  emitWord(writer, (writer->accumulator << room) | (value >> rest));
+  writer->accumulator = value & ((1ull << rest) - 1);
+  writer->bitCount = rest;
+}
 
-    if (inputFile == NULL)
+// Function to write the bits still in the accumulator, padding the last byte with zeros, and flush the buffer.
+void finishBitWriter(BitWriter* writer)
+{
+  uint64_t word = writer->bitCount > 0 ? writer->accumulator << (64 - writer->bitCount) : 0;
+  for (int i = 0; i < (writer->bitCount + 7) / 8; i++)
+  {
+    if (writer->bufferSize == BIT_BUFFER_SIZE)
     {
-      printf("Could not open file to read: %s\n",inputTextFilePath);
-      return -1;
+      flushBitBuffer(writer);
     }
+    writer->buffer[writer->bufferSize++] = (unsigned char)(word >> (56 - 8 * i));
+  }
+  writer->bitCount = 0;
+  flushBitBuffer(writer);
+}
 
-    // Initialize the code table, which will store the frequency of each character, and eventually the binary code. We are allocating a space of 256 in the table.
-    // The character's ASCII code will serve as hashing the index for that character.
-    CodeTable *codeTable = malloc(sizeof(CodeTable)*256);
+// Function to start a bit reader on a file positioned just after the container header.
+void initBitReader(BitReader* reader, FILE* file, uint64_t bitCount)
+{
+  reader->file = file;
+  reader->accumulator = 0;
+  reader->bitCount = 0;
+  reader->bitsLeft = bitCount;
+  reader->buffer = malloc(BIT_BUFFER_SIZE);
+  reader->bufferSize = 0;
+  reader->bufferPosition = 0;
+}
 
-    //set frequency to zero and binary_codes to NULL initially.
-    for(int i = 0; i < 256; i++)
-    {
-      codeTable[i].frequency = 0;
-      codeTable[i].binary_code = NULL;
-    }
+// Function to start a bit reader on a payload already in memory. The reader does not own the bytes.
+void initMemoryBitReader(BitReader* reader, unsigned char* bytes, size_t size, uint64_t bitCount)
+{
+  reader->file = NULL;
+  reader->accumulator = 0;
+  reader->bitCount = 0;
+  reader->bitsLeft = bitCount;
+  reader->buffer = bytes;
+  reader->bufferSize = size;
+  reader->bufferPosition = 0;
+}
 
-    int totalNumOfCharacters=0;
-    char c;
+// Function to free the buffer of a bit reader started on a file.
+void freeBitReader(BitReader* reader)
+{
+  if (reader->file != NULL)
+  {
+    free(reader->buffer);
+  }
+}
 
-    // read the file character by character
-    while ((c = fgetc(inputFile)) != EOF && c!='\n')
+// Function to top the accumulator up to at least 57 bits, one byte at a time, while there are bytes left.
+// Returns 0 once the buffer is empty and there is nothing more to read.
+int refillBitReader(BitReader* reader)
+{
+  while (reader->bitCount <= 56)
+  {
+    if (reader->bufferPosition == reader->bufferSize)
     {
-      //increase the frequency of the character by one
-      codeTable[c].frequency++;
-      //increase the total character count
-      totalNumOfCharacters++;
+      if (reader->file == NULL)
+      {
+        return 0;
+      }
+      reader->bufferSize = fread(reader->buffer, 1, BIT_BUFFER_SIZE, reader->file);
+      reader->bufferPosition = 0;
+      if (reader->bufferSize == 0)
+      {
+        return 0;
+      }
     }
-    fclose(inputFile);
+    reader->accumulator |= (uint64_t)reader->buffer[reader->bufferPosition++] << (56 - reader->bitCount);
+    reader->bitCount += 8;
+  }
 
-    // We will create a NodeArray that will store all the characters we have in the CodeTable with frequency > 0 and then generate a min heap (priority queue)
-    // nodeArray is basically codeTable, but only contains characters with frequency > 0. That way, we don't have to deal with characters with frequcny < 0 while sorting.
-    // Also, since we make nodes for each character, it's easier to make a heap as well.
-    Node** nodeArray = intializeNodeArray(totalNumOfCharacters);
-    int nodeCount = insertToNodeArray(nodeArray, codeTable, 256);
+  return 1;
+}
 
-    // We will build the min heap.
-    Heap* heap = initializeHeap(nodeCount);
+// Function to drop the zero bits that pad the last byte of a payload, so the reader is at a whole byte.
+void alignBitReader(BitReader* reader)
+{
+  int padding = reader->bitCount % 8;
+  reader->accumulator <<= padding;
+  reader->bitCount -= padding;
+}
 
-    // We will insert to heap.
-    for (int i = 0; i < nodeCount; i++)
+// Function to read whole bytes from a reader at a byte boundary: first the bytes already in the accumulator,
+// then straight from the buffer. Returns 0 if the file ends first.
+int readAlignedBytes(BitReader* reader, unsigned char* bytes, size_t count)
+{
+  size_t i = 0;
+  while (i < count && reader->bitCount > 0)
+  {
+    bytes[i++] = (unsigned char)(reader->accumulator >> 56);
+    reader->accumulator <<= 8;
+    reader->bitCount -= 8;
+  }
+
+  while (i < count)
+  {
+    if (reader->bufferPosition == reader->bufferSize)
     {
-      insertToHeap(heap, nodeArray[i]);
+      if (reader->file == NULL)
+      {
+        return 0;
+      }
+      reader->bufferSize = fread(reader->buffer, 1, BIT_BUFFER_SIZE, reader->file);
+      reader->bufferPosition = 0;
+      if (reader->bufferSize == 0)
+      {
+        return 0;
+      }
+    }
+    size_t available = reader->bufferSize - reader->bufferPosition;
+    size_t take = count - i < available ? count - i : available;
+    memcpy(bytes + i, reader->buffer + reader->bufferPosition, take);
+    reader->bufferPosition += take;
+    i += take;
+  }
+
+  return 1;
+}
+
+// Function to read the code lengths written by writeCodeLengths and give the characters their canonical codes.
+// Returns 0 if the file ends early or the lengths are not those of a prefix code.
+int readCodeLengths(BitReader* reader, CodeBook* book)
+{
+  for (int i = 0; i < 256; )
+  {
+    unsigned char run[2];
+    if (!readAlignedBytes(reader, run, 2) || i + run[0] + 1 > 256)
+    {
+      return 0;
+    }
+    memset(book->lengths + i, run[1], run[0] + 1);
+    i += run[0] + 1;
+  }
+
+  return assignCanonicalCodes(book);
+}
+
+// Function to read the next code bit. Returns -1 once all the bits from the header have been read,
+// or if the file ends before them.
+int readBit(BitReader* reader)
+{
+  if (reader->bitsLeft == 0)
+  {
+    return -1;
+  }
+
+  if (reader->bitCount == 0)
+  {
+    // Refill the accumulator with as many whole bytes as fit.
+    refillBitReader(reader);
+    if (reader->bitCount == 0)
+    {
+      reader->bitsLeft = 0;
+      return -1;
+    }
+  }
+
+  int bit = (int)(reader->accumulator >> 63);
+  reader->accumulator <<= 1;
+  reader->bitCount--;
+  reader->bitsLeft--;
+
+  return bit;
+}
+
+// Function to decode a container one bit at a time, following the tree from the root to a leaf for each
+// character. Returns the number of characters written.
+uint64_t decodeWithTree(BitReader* reader, Node* root, FILE* decodedFile)
+{
+  uint64_t written = 0;
+  Node* currentNode = root;
+  int codeBit;
+  while ((codeBit = readBit(reader)) != -1)
+  {
+    currentNode = codeBit == 0 ? currentNode->left : currentNode->right;
+
+    // We've hit the leaf node. Write the character in the current node to decodedFile.
+    if (currentNode->left == NULL && currentNode->right == NULL)
+    {
+      fputc(currentNode->character, decodedFile);
+      currentNode = root;
+      written++;
+    }
+  }
+
+  return written;
+}
+
+// Function to make room for count more entries at the end of the decoding table. Returns the first one's index.
+uint32_t reserveDecodeEntries(DecodeTable* table, uint32_t count)
+{
+  if (table->size + count > table->capacity)
+  {
+    while (table->size + count > table->capacity)
+    {
+      table->capacity *= 2;
+    }
+    table->entries = realloc(table->entries, sizeof(DecodeEntry) * table->capacity);
+  }
+
+  uint32_t start = table->size;
+  table->size += count;
+  memset(table->entries + start, 0, sizeof(DecodeEntry) * count);
+  return start;
+}
+
+// Function to fill the 2^bits entries at `start` for the codes that begin with the prefixLength-bit `prefix`.
+// A code that ends within the table fills every entry its remaining bits lead to. A longer one marks the
+// entry of its next `bits` bits for a subtable, sized to the longest code that goes through it.
+void fillDecodeTable(DecodeTable* table, uint32_t start, int bits, uint64_t prefix, int prefixLength, CodeBook* book)
+{
+  for (int i = 0; i < 256; i++)
+  {
+    int rest = book->lengths[i] - prefixLength;
+    if (book->lengths[i] == 0 || rest < 0 || (prefixLength > 0 && (book->codes[i] >> rest) != prefix))
+    {
+      continue;
+    }
+    uint64_t restCode = book->codes[i] & ((1ull << rest) - 1);
+
+    if (rest <= bits)
+    {
+      uint32_t first = start + (uint32_t)(restCode << (bits - rest));
+      for (uint32_t j = 0; j < (1u << (bits - rest)); j++)
+      {
+        DecodeEntry* entry = &table->entries[first + j];
+        entry->symbols[0] = (unsigned char)i;
+        entry->symbolCount = 1;
+        entry->length = rest;
+        entry->firstLength = rest;
+      }
+    } else
+    {
+      // Until the subtable is built, subtableBits holds the longest code's bits past this table.
+      DecodeEntry* entry = &table->entries[start + (uint32_t)(restCode >> (rest - bits))];
+      entry->length = bits;
+      if (rest - bits > entry->subtableBits)
+      {
+        entry->subtableBits = rest - bits;
+      }
+    }
+  }
+
+  for (uint32_t index = 0; index < (1u << bits); index++)
+  {
+    if (table->entries[start + index].symbolCount == 0 && table->entries[start + index].subtableBits > 0)
+    {
+      int subtableBits = table->entries[start + index].subtableBits;
+      subtableBits = subtableBits < DECODE_TABLE_BITS ? subtableBits : DECODE_TABLE_BITS;
+      uint32_t subtable = reserveDecodeEntries(table, 1u << subtableBits);
+
+      // Filling the subtable may move the entries, so they are only indexed after it.
+      fillDecodeTable(table, subtable, subtableBits, (prefix << bits) | index, prefixLength + bits, book);
+      table->entries[start + index].subtableBits = subtableBits;
+      table->entries[start + index].subtable = subtable;
+    }
+  }
+}
+
+// Function to build the decoding table for a code book. Once the primary table is filled, every entry whose
+// symbol leaves bits to spare looks those bits up in the primary table itself to pick up a second symbol.
+DecodeTable* buildDecodeTable(CodeBook* book)
+{
+  DecodeTable* table = malloc(sizeof(DecodeTable));
+  table->capacity = 1u << (DECODE_TABLE_BITS + 1);
+  table->size = 0;
+  table->entries = malloc(sizeof(DecodeEntry) * table->capacity);
+
+  uint32_t primary = reserveDecodeEntries(table, 1u << DECODE_TABLE_BITS);
+  fillDecodeTable(table, primary, DECODE_TABLE_BITS, 0, 0, book);
+
+  uint32_t mask = (1u << DECODE_TABLE_BITS) - 1;
+  for (uint32_t index = 0; index < (1u << DECODE_TABLE_BITS); index++)
+  {
+    DecodeEntry* entry = &table->entries[index];
+    int spare = DECODE_TABLE_BITS - entry->firstLength;
+    if (entry->symbolCount == 0 || entry->firstLength == 0 || spare == 0)
+    {
+      continue;
+    }
+
+    DecodeEntry* next = &table->entries[(index << entry->firstLength) & mask];
+    if (next->symbolCount != 0 && next->firstLength > 0 && next->firstLength <= spare)
+    {
+      entry->symbols[1] = next->symbols[0];
+      entry->symbolCount = 2;
+      entry->length = entry->firstLength + next->firstLength;
+    }
+  }
+
+  return table;
+}
+
+// Function to free a decoding table.
+void freeDecodeTable(DecodeTable* table)
+{
+  free(table->entries);
+  free(table);
+}
+
+// Function to decode code bits with the decoding table into output: each lookup on the next DECODE_TABLE_BITS
+// bits gives one or two characters, or leads to a subtable for a longer code. The accumulator holds at least
+// 57 bits before every lookup (zeros past the end of the file), enough for any code of a 32-bit frequency.
+// Stops when the bits run out or fewer than 2 bytes of output are left, and returns the characters written.
+size_t decodeSymbols(BitReader* reader, DecodeTable* table, unsigned char* output, size_t capacity)
+{
+  size_t outputSize = 0;
+  DecodeEntry* entries = table->entries;
+
+  while (reader->bitsLeft > 0 && outputSize + 2 <= capacity)
+  {
+    if (reader->bitCount <= 56 && !refillBitReader(reader) && (uint64_t)reader->bitCount < reader->bitsLeft)
+    {
+      // The file ends before the bit count from the header; decode what it holds.
+      reader->bitsLeft = reader->bitCount;
+      if (reader->bitsLeft == 0)
+      {
+        break;
+      }
+    }
+
+    uint64_t bits = reader->accumulator;
+    DecodeEntry entry = entries[bits >> (64 - DECODE_TABLE_BITS)];
+    int skipped = 0;
+    while (entry.symbolCount == 0 && entry.subtableBits > 0)
+    {
+      skipped += entry.length;
+      entry = entries[entry.subtable + ((bits << skipped) >> (64 - entry.subtableBits))];
+    }
+
+    if (entry.symbolCount == 0)
+    {
+      // No code starts with these bits: the container is damaged.
+      break;
+    }
+
+    int length = skipped + entry.length;
+    int symbolCount = entry.symbolCount;
+    if ((uint64_t)length > reader->bitsLeft)
+    {
+      // The second symbol would come from the padding at the end: keep only the first, if it is all there.
+      length = skipped + entry.firstLength;
+      symbolCount = 1;
+      if ((uint64_t)length > reader->bitsLeft)
+      {
+        break;
+      }
+    }
+
+    output[outputSize] = entry.symbols[0];
+    output[outputSize + 1] = entry.symbols[1];
+    outputSize += symbolCount;
+
+    reader->accumulator <<= length;
+    reader->bitCount -= length;
+    reader->bitsLeft -= length;
+  }
+
+  return outputSize;
+}
+
+// Function to decode a container with the decoding table into a file, a buffer at a time.
+// Returns the number of characters written.
+uint64_t decodeWithTable(BitReader* reader, DecodeTable* table, FILE* decodedFile)
+{
+  unsigned char* output = malloc(BIT_BUFFER_SIZE);
+  uint64_t written = 0;
+  size_t size;
+  while ((size = decodeSymbols(reader, table, output, BIT_BUFFER_SIZE)) > 0)
+  {
+    fwrite(output, 1, size, decodedFile);
+    written += size;
+  }
+
+  free(output);
+  return written;
+}
+
+// Partition function.
+int partition(Node** arr, int low, int high) {
+  int mid = low + (high - low)/2;
+  Node* pivot = arr[mid];  // Taking middle element as the pivot.
+  int i = low - 1;
+
+  swap(&arr[mid], &arr[high]);    // Swapping the pivot with the last element.
+
+  for (int j = low; j < high; j++) {
+    if (arr[j]->frequency < pivot->frequency || (arr[j]->frequency == pivot->frequency && arr[j]->character < pivot->character)) 
+    {
+      i++;
+      swap(&arr[i], &arr[j]);
+    }
+  }
+
+  swap(&arr[i + 1], &arr[high]);  // Putting the pivot in the middle.
+  return i + 1;   // Returning pivot's index
+}
+
+// Quicksort function.
+void quickSort(Node** arr, int low, int high) {
+  if (low < high) {
+    int pivotIndex = partition(arr, low, high);
+    quickSort(arr, low, pivotIndex - 1);
+    quickSort(arr, pivotIndex + 1, high);
+  }
+}
+
+// Calculate compressed size.
+int calculateCompressedSize(CodeTable* codeTable, Node** nodeArray, int nodeCount)
+{
+  int compressed_size = 0;
+
+  for (int i = 0; i < nodeCount; i++)
+  {
+    compressed_size += strlen(codeTable[nodeArray[i]->character].binary_code) * (nodeArray[i]->frequency);
+  }
+  
+  return compressed_size;
+}
+
+// Function to write the code of one character. With 32-bit frequencies a code can pass 32 bits, and is then
+// written in two parts.
+void writeCode(BitWriter* writer, CodeBook* book, unsigned char c)
+{
+  int length = book->lengths[c];
+  if (length > 32)
+  {
+    writeBits(writer, book->codes[c] >> 32, length - 32);
+    length = 32;
+  }
+  writeBits(writer, book->codes[c] & 0xFFFFFFFFull, length);
+}
+
+// This function will write the encoded version of the input text file into a binary container.
+void writeEncodedToFile(char* inputTextFilePath, char* encodedTextFilePath, CodeBook* book)
+{
+  FILE* inputFile = fopen(inputTextFilePath, "r");
+
+  if (inputFile == NULL)
+  {
+    printf("Could not open file to read: %s\n",inputTextFilePath);
+    return;
+  }
+
+  FILE* encodeFile = fopen(encodedTextFilePath, "wb");
+
+  if (encodeFile == NULL)
+  {
+    printf("Could not open file to read: %s\n",encodedTextFilePath);
+    return;
+  }
+
+  // The header is written with a bit count of 0 first and rewritten once the count is known.
+  BitWriter* writer = malloc(sizeof(BitWriter));
+  initBitWriter(writer, encodeFile);
+  writeContainerHeader(encodeFile, 0);
+  writeCodeLengths(encodeFile, book);
+
+  char c;
+  while ((c = fgetc(inputFile)) != EOF && c != '\n')
+  {
+    writeCode(writer, book, (unsigned char)c);
+  }
+  finishBitWriter(writer);
+
+  rewind(encodeFile);
+  writeContainerHeader(encodeFile, writer->totalBits);
+  free(writer);
+
+  fclose(inputFile);
+  fclose(encodeFile);
+}
+
+// Function to recursively free the Huffman tree nodes
+void freeHuffmanTree(Node* node)
+{
+  if (node == NULL) return;
+  
+  // Recursively free left and right subtrees
+  freeHuffmanTree(node->left);
+  freeHuffmanTree(node->right);
+  
+  // Free the current node
+  free(node);
+}
+
+// Free all the dynamically allocated memory
+void freeMemory(Heap* heap, CodeTable* codeTable, Node** nodeArray)
+{
+  // Free the Huffman tree (root node is in heap->array[0])
+  freeHuffmanTree(heap->array[0]);
+
+  // Free the heap
+  free(heap->array);
+  free(heap);
+
+  // Free the codeTable binary codes
+  for (int i = 0; i < 256; i++)
+  {
+    free(codeTable[i].binary_code);
+  }
+
+  free(codeTable);
+  free(nodeArray);
+}
+
+// Function to read a code table file and rebuild the huffman tree from its frequencies. Returns the heap
+// whose only node is the root of the tree, or NULL if the file cannot be opened.
+Heap* readCodeTableFile(char* codeTableFilePath, CodeTable** codeTableOut, Node*** nodeArrayOut)
+{
+  FILE* codeTableFile = fopen(codeTableFilePath, "r");
+
+  if (codeTableFile == NULL)
+  {
+    printf("Could not open file to write: %s\n",codeTableFilePath);
+    return NULL;
+  }
+
+  // Read the codeTableFile and store each character and its frequency and binary_code to codeTable
+  char c;
+  char line[256];
+  char binary_code[256];
+  unsigned int frequency;
+  int totalNumOfCharacters = 0;
+  CodeTable* codeTable = malloc(sizeof(CodeTable) * 256);
+
+  // Set frequency to zero and binary_codes to NULL initially.
+  for(int i = 0; i < 256; i++)
+  {
+    codeTable[i].frequency = 0;
+    codeTable[i].binary_code = NULL;
+  }
+
+  while (fgets(line, sizeof(line), codeTableFile))
+  {
+    // A text with a single character gives it an empty code, which leaves two tabs in a row.
+    if ((sscanf(line, "%c\t%s\t%u", &c, binary_code, &frequency)) != 3)
+    {
+      if ((sscanf(line, "%c\t\t%u", &c, &frequency)) != 2)
+      {
+        continue;
+      }
+      binary_code[0] = '\0';
+    }
+    
+    codeTable[c].frequency = frequency;
+    codeTable[c].binary_code = malloc(strlen(binary_code) + 1);
+    strcpy(codeTable[c].binary_code, binary_code);
+
+    totalNumOfCharacters++;
+  }
+  fclose(codeTableFile);
+
+  // Initialize nodeArray.
+  Node** nodeArray = intializeNodeArray(totalNumOfCharacters);
+
+  // Insert each character from codeTable to nodeArray.
+  int nodeCount = insertToNodeArray(nodeArray, codeTable, 256);
+
+  // Initialize Heap. An empty text leaves it without a root, which is NULL.
+  Heap* heap = initializeHeap(nodeCount > 0 ? nodeCount : 1);
+  heap->array[0] = NULL;
+
+  // Build the min heap by inserting each node from nodeArray to Heap.
+  for (int i = 0; i < nodeCount; i++)
+  {
+    insertToHeap(heap, nodeArray[i]);
+  }
+  
+  // Build the huffman tree.
+  buildHuffmanTree(heap);
+
+  *codeTableOut = codeTable;
+  *nodeArrayOut = nodeArray;
+  return heap;
+}
+
+// Function to load 8 bytes as a number, the first byte in the most significant position.
+uint64_t loadBigEndian(const unsigned char* bytes)
+{
+  uint64_t value;
+  memcpy(&value, bytes, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+// Function to decode the INTERLEAVED_STREAMS parts of a block, stored one after another in data, into output
+// (characters + 2 bytes). While every part has enough bits left, one loop takes a table lookup from each part
+// in turn: the lookups do not depend on each other, so the CPU runs them side by side. Each part keeps only
+// its bit position, and every round reloads 8 bytes from it, enough for 4 lookups of up to
+// DECODE_TABLE_BITS bits. The loop needs a table where every lookup gives a symbol, which codes of at most
+// DECODE_TABLE_BITS bits from a full tree do; otherwise, and for the last bits of each part, the parts are
+// finished with decodeSymbols. Returns 0 if the block is damaged.
+int decodeInterleaved(DecodeTable* table, unsigned char* data, size_t size, uint64_t* bitCounts,
+                      unsigned char* output, size_t characters)
+{
+  size_t partSize = (characters + INTERLEAVED_STREAMS - 1) / INTERLEAVED_STREAMS;
+  unsigned char* starts[INTERLEAVED_STREAMS];
+  unsigned char* outputs[INTERLEAVED_STREAMS];
+  unsigned char* outputEnds[INTERLEAVED_STREAMS];
+  uint64_t used[INTERLEAVED_STREAMS] = {0};
+  size_t offset = 0;
+  for (int s = 0; s < INTERLEAVED_STREAMS; s++)
+  {
+    starts[s] = data + offset;
+    if (bitCounts[s] > (uint64_t)(size - offset) * 8)
+    {
+      return 0;
+    }
+    offset += (bitCounts[s] + 7) / 8;
+    outputs[s] = output + (s * partSize < characters ? s * partSize : characters);
+    outputEnds[s] = output + ((s + 1) * partSize < characters ? (s + 1) * partSize : characters);
+  }
+
+  int fast = table->size == (1u << DECODE_TABLE_BITS);
+  for (uint32_t i = 0; fast && i < table->size; i++)
+  {
+    fast = table->entries[i].symbolCount != 0;
+  }
+
+  // 5 lookups' worth of bits left means every lookup of the round is followed by at least one more symbol, so
+  // the second byte each lookup stores stays inside the part. Room for 8 more characters keeps a damaged part
+  // from running into the next one.
+  while (fast)
+  {
+    for (int s = 0; s < INTERLEAVED_STREAMS; s++)
+    {
+      if (used[s] + 5 * DECODE_TABLE_BITS > bitCounts[s] || starts[s] + (used[s] >> 3) + 8 > data + size ||
+          outputs[s] + 8 > outputEnds[s])
+      {
+        fast = 0;
+      }
+    }
+    if (!fast)
+    {
+      break;
+    }
+
+    uint64_t bits[INTERLEAVED_STREAMS];
+    for (int s = 0; s < INTERLEAVED_STREAMS; s++)
+    {
+      bits[s] = loadBigEndian(starts[s] + (used[s] >> 3)) << (used[s] & 7);
+    }
+    for (int round = 0; round < 4; round++)
+    {
+      for (int s = 0; s < INTERLEAVED_STREAMS; s++)
+      {
+        DecodeEntry entry = table->entries[bits[s] >> (64 - DECODE_TABLE_BITS)];
+        outputs[s][0] = entry.symbols[0];
+        outputs[s][1] = entry.symbols[1];
+        outputs[s] += entry.symbolCount;
+        bits[s] <<= entry.length;
+        used[s] += entry.length;
+      }
+    }
+  }
+
+  for (int s = 0; s < INTERLEAVED_STREAMS; s++)
+  {
+    size_t partBytes = (bitCounts[s] + 7) / 8;
+    BitReader reader;
+    initMemoryBitReader(&reader, starts[s] + (used[s] >> 3), partBytes - (used[s] >> 3), bitCounts[s] - (used[s] & ~7ull));
+    refillBitReader(&reader);
+    int skip = (int)(used[s] & 7);
+    reader.accumulator <<= skip;
+    reader.bitCount -= skip;
+    reader.bitsLeft -= skip;
+
+    // decodeSymbols may store a byte or two past the end of the part, the start of the next part's characters.
+    size_t left = outputEnds[s] - outputs[s];
+    unsigned char saved[2] = {outputEnds[s][0], outputEnds[s][1]};
+    size_t decoded = decodeSymbols(&reader, table, outputs[s], left + 2);
+    outputEnds[s][0] = saved[0];
+    outputEnds[s][1] = saved[1];
+    if (decoded != left || reader.bitsLeft != 0)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Function to build the canonical code book for the character frequencies of one stream block, with codes of at
+// most maxCodeLength bits if it is not 0. Returns 0 if the characters do not fit in codes that short.
+int buildBlockCodeBook(unsigned int* frequencies, int maxCodeLength, CodeBook* book)
+{
+  CodeTable* codeTable = malloc(sizeof(CodeTable) * 256);
+  for (int i = 0; i < 256; i++)
+  {
+    codeTable[i].frequency = frequencies[i];
+    codeTable[i].binary_code = NULL;
+  }
+
+  Node** nodeArray = intializeNodeArray(256);
+  int nodeCount = insertToNodeArray(nodeArray, codeTable, 256);
+  Heap* heap = initializeHeap(nodeCount);
+  for (int i = 0; i < nodeCount; i++)
+  {
+    insertToHeap(heap, nodeArray[i]);
+  }
+  buildHuffmanTree(heap);
+
+  char binaryArray[256];
+  labelHuffmanEdges(heap->array[0], codeTable, binaryArray, 0);
+  codeBookFromCodeTable(codeTable, book);
+  if (nodeCount == 1)
+  {
+    book->lengths[heap->array[0]->character] = 1;
+  }
+
+  int fits = 1;
+  if (maxCodeLength > 0 && longestCode(book) > maxCodeLength)
+  {
+    fits = limitCodeLengths(codeTable, book, maxCodeLength);
+  }
+
+  freeMemory(heap, codeTable, nodeArray);
+  return fits && assignCanonicalCodes(book);
+}
+
+// Function to encode one stream block from its input bytes into its output: the block header, the code
+// lengths and the code bits, as INTERLEAVED_STREAMS parts if `interleaved`. Safe to run on any number of
+// blocks at once.
+void encodeStreamBlock(StreamBlock* block, int maxCodeLength, int interleaved)
+{
+  unsigned int frequencies[256] = {0};
+  for (size_t i = 0; i < block->inputSize; i++)
+  {
+    frequencies[block->input[i]]++;
+  }
+
+  CodeBook* book = malloc(sizeof(CodeBook));
+  if (!buildBlockCodeBook(frequencies, maxCodeLength, book))
+  {
+    block->failed = 1;
+    free(book);
+    return;
+  }
+
+  // The bit count is known from the frequencies, so the output can be sized before any bit is written.
+  uint64_t bitCount = 0;
+  for (int i = 0; i < 256; i++)
+  {
+    bitCount += (uint64_t)frequencies[i] * book->lengths[i];
+  }
+  size_t capacity = STREAM_BLOCK_HEADER_SIZE + 512 + 8 * INTERLEAVED_STREAMS + (bitCount + 7) / 8 + INTERLEAVED_STREAMS;
+  if (capacity > block->outputCapacity)
+  {
+    free(block->output);
+    block->output = malloc(capacity);
+    block->outputCapacity = capacity;
+  }
+
+  writeLittleEndian(block->output, block->inputSize, 4);
+  writeLittleEndian(block->output + 4, bitCount, 8);
+  size_t size = STREAM_BLOCK_HEADER_SIZE + codeLengthRuns(book, block->output + STREAM_BLOCK_HEADER_SIZE);
+
+  // Each part is written after the bit counts with a writer of its own, then its bit count is filled in.
+  int parts = interleaved ? INTERLEAVED_STREAMS : 1;
+  size_t partSize = (block->inputSize + parts - 1) / parts;
+  unsigned char* bitCounts = block->output + size;
+  if (interleaved)
+  {
+    size += 8 * INTERLEAVED_STREAMS;
+  }
+
+  BitWriter* writer = malloc(sizeof(BitWriter));
+  for (int s = 0; s < parts; s++)
+  {
+    size_t first = s * partSize < block->inputSize ? s * partSize : block->inputSize;
+    size_t last = (s + 1) * partSize < block->inputSize ? (s + 1) * partSize : block->inputSize;
+    initMemoryBitWriter(writer, block->output + size);
+    for (size_t i = first; i < last; i++)
+    {
+      writeCode(writer, book, block->input[i]);
+    }
+    finishBitWriter(writer);
+
+    if (interleaved)
+    {
+      writeLittleEndian(bitCounts + 8 * s, writer->totalBits, 8);
+    }
+    size += writer->memorySize;
+  }
+
+  block->outputSize = size;
+  block->bitCount = bitCount;
+  block->failed = 0;
+  free(writer);
+  free(book);
+}
+
+// Function to decode a stream block whose inputSize bytes are in its input into its output.
+// Safe to run on any number of blocks at once.
+void decodeStreamBlockBytes(StreamBlock* block, int interleaved)
+{
+  block->failed = 1;
+  block->outputSize = 0;
+
+  BitReader reader;
+  initMemoryBitReader(&reader, block->input, block->inputSize, 0);
+  unsigned char header[STREAM_BLOCK_HEADER_SIZE];
+  CodeBook* book = malloc(sizeof(CodeBook));
+  if (!readAlignedBytes(&reader, header, STREAM_BLOCK_HEADER_SIZE) || !readCodeLengths(&reader, book))
+  {
+    free(book);
+    return;
+  }
+  uint64_t characters = readLittleEndian(header, 4);
+  if (characters == 0 || characters > MAX_BLOCK_SIZE)
+  {
+    free(book);
+    return;
+  }
+
+  // decodeSymbols stops with fewer than 2 bytes left, so 2 more bytes let it decode the whole block.
+  if (characters + 2 > block->outputCapacity)
+  {
+    free(block->output);
+    block->output = malloc(characters + 2);
+    block->outputCapacity = characters + 2;
+  }
+  DecodeTable* table = buildDecodeTable(book);
+  if (interleaved)
+  {
+    // The parts start right after the bit counts; the reader has only taken whole bytes so far.
+    unsigned char counts[8 * INTERLEAVED_STREAMS];
+    uint64_t bitCounts[INTERLEAVED_STREAMS];
+    if (readAlignedBytes(&reader, counts, sizeof(counts)))
+    {
+      for (int s = 0; s < INTERLEAVED_STREAMS; s++)
+      {
+        bitCounts[s] = readLittleEndian(counts + 8 * s, 8);
+      }
+      size_t consumed = reader.bufferPosition - reader.bitCount / 8;
+      block->failed = !decodeInterleaved(table, block->input + consumed, block->inputSize - consumed, bitCounts,
+                                         block->output, characters);
+      block->outputSize = block->failed ? 0 : characters;
+    }
+  } else
+  {
+    reader.bitsLeft = readLittleEndian(header + 4, 8);
+    block->outputSize = decodeSymbols(&reader, table, block->output, characters + 2);
+    block->failed = block->outputSize != characters;
+  }
+
+  freeDecodeTable(table);
+  free(book);
+}
+
+// Function to decode one stream block, read by the worker itself at its offset in the index, into its output.
+// Safe to run on any number of blocks at once.
+void decodeStreamBlock(StreamBlock* block, int fd, uint64_t start, uint64_t end, int interleaved)
+{
+  block->failed = 1;
+  block->outputSize = 0;
+
+  size_t size = end - start;
+  if (size > block->inputCapacity)
+  {
+    free(block->input);
+    block->input = malloc(size);
+    block->inputCapacity = size;
+  }
+  block->inputSize = size;
+  if (pread(fd, block->input, size, start) != (ssize_t)size)
+  {
+    return;
+  }
+
+  decodeStreamBlockBytes(block, interleaved);
+}
+
+// Worker thread of a parallel stream: takes the next block until there are none left, but never runs more
+// than `window` blocks ahead of the block the main thread is writing.
+void* streamWorker(void* argument)
+{
+  ParallelStream* parallel = argument;
+
+  while (1)
+  {
+    pthread_mutex_lock(&parallel->lock);
+    while (!parallel->stopping && ((parallel->nextBlock == parallel->blocksReady && !parallel->inputDone) ||
+                                   parallel->nextBlock >= parallel->nextToWrite + parallel->window))
+    {
+      pthread_cond_wait(&parallel->blockReady, &parallel->lock);
+    }
+    if (parallel->stopping || parallel->nextBlock == parallel->blocksReady)
+    {
+      pthread_mutex_unlock(&parallel->lock);
+      break;
+    }
+    size_t index = parallel->nextBlock++;
+    StreamBlock* block = &parallel->blocks[index % parallel->window];
+    pthread_mutex_unlock(&parallel->lock);
+
+    if (parallel->encoding)
+    {
+      encodeStreamBlock(block, parallel->maxCodeLength, parallel->interleaved);
+    } else
+    {
+      decodeStreamBlock(block, parallel->fd, parallel->offsets[index], parallel->offsets[index + 1], parallel->interleaved);
+    }
+
+    pthread_mutex_lock(&parallel->lock);
+    block->done = 1;
+    pthread_cond_broadcast(&parallel->blockDone);
+    pthread_mutex_unlock(&parallel->lock);
+  }
+
+  return NULL;
+}
+
+// Function to set up the shared state of a parallel stream and start its workers; the caller has set what to
+// do, blocksReady and inputDone. With one thread there are no workers and a single block slot, and the main
+// thread does the work itself.
+pthread_t* startParallelStream(ParallelStream* parallel, int threadCount)
+{
+  parallel->window = threadCount > 1 ? (size_t)threadCount * BLOCKS_IN_FLIGHT_PER_THREAD : 1;
+  parallel->blocks = calloc(parallel->window, sizeof(StreamBlock));
+  parallel->nextBlock = 0;
+  parallel->nextToWrite = 0;
+  parallel->stopping = 0;
+  if (threadCount <= 1)
+  {
+    return NULL;
+  }
+
+  pthread_mutex_init(&parallel->lock, NULL);
+  pthread_cond_init(&parallel->blockReady, NULL);
+  pthread_cond_init(&parallel->blockDone, NULL);
+  pthread_t* workers = malloc(sizeof(pthread_t) * threadCount);
+  for (int t = 0; t < threadCount; t++)
+  {
+    pthread_create(&workers[t], NULL, streamWorker, parallel);
+  }
+
+  return workers;
+}
+
+// Function to get block i of a parallel stream once it is done, doing it on the main thread if there are no
+// workers.
+StreamBlock* waitForStreamBlock(ParallelStream* parallel, pthread_t* workers, size_t i)
+{
+  StreamBlock* block = &parallel->blocks[i % parallel->window];
+  if (workers == NULL)
+  {
+    if (parallel->encoding)
+    {
+      encodeStreamBlock(block, parallel->maxCodeLength, parallel->interleaved);
+    } else
+    {
+      decodeStreamBlock(block, parallel->fd, parallel->offsets[i], parallel->offsets[i + 1], parallel->interleaved);
+    }
+    return block;
+  }
+
+  pthread_mutex_lock(&parallel->lock);
+  while (!block->done)
+  {
+    pthread_cond_wait(&parallel->blockDone, &parallel->lock);
+  }
+  pthread_mutex_unlock(&parallel->lock);
+  return block;
+}
+
+// Function to tell the workers block i has been written, freeing its slot for a later block.
+void streamBlockWritten(ParallelStream* parallel, pthread_t* workers, size_t i)
+{
+  if (workers != NULL)
+  {
+    pthread_mutex_lock(&parallel->lock);
+    parallel->blocks[i % parallel->window].done = 0;
+    parallel->nextToWrite = i + 1;
+    pthread_cond_broadcast(&parallel->blockReady);
+    pthread_mutex_unlock(&parallel->lock);
+  }
+}
+
+// Function to stop the workers of a parallel stream, wait for them and free its blocks.
+void finishParallelStream(ParallelStream* parallel, pthread_t* workers, int threadCount)
+{
+  if (workers != NULL)
+  {
+    pthread_mutex_lock(&parallel->lock);
+    parallel->stopping = 1;
+    pthread_cond_broadcast(&parallel->blockReady);
+    pthread_mutex_unlock(&parallel->lock);
+
+    for (int t = 0; t < threadCount; t++)
+    {
+      pthread_join(workers[t], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&parallel->lock);
+    pthread_cond_destroy(&parallel->blockReady);
+    pthread_cond_destroy(&parallel->blockDone);
+  }
+
+  for (size_t i = 0; i < parallel->window; i++)
+  {
+    free(parallel->blocks[i].input);
+    free(parallel->blocks[i].output);
+  }
+  free(parallel->blocks);
+}
+
+// Function to encode a whole input as a stream, one block of blockSize bytes at a time, each with its own
+// codes, followed by the block index. Every byte is encoded, newlines included, and the output is written in
+// one pass, so either side can be a pipe. With more than one thread the main thread reads blocks ahead and
+// a worker pool builds the codes and encodes them, while the main thread writes each block in order as soon
+// as it is done. With `interleaved`, every block is split into INTERLEAVED_STREAMS parts, and codes are kept
+// to DECODE_TABLE_BITS bits unless maxCodeLength says otherwise, so the parts can be decoded together.
+// The statistics go to stderr, since the stream may be going to stdout. Returns 0 on success.
+int streamEncode(FILE* inputFile, FILE* outputFile, size_t blockSize, int maxCodeLength, int interleaved, int threadCount)
+{
+  ParallelStream parallel;
+  parallel.encoding = 1;
+  parallel.interleaved = interleaved;
+  parallel.maxCodeLength = interleaved && maxCodeLength == 0 ? DECODE_TABLE_BITS : maxCodeLength;
+  parallel.blocksReady = 0;
+  parallel.inputDone = 0;
+  pthread_t* workers = startParallelStream(&parallel, threadCount);
+
+  uint64_t* offsets = malloc(sizeof(uint64_t) * 64);
+  size_t offsetCapacity = 64;
+  uint64_t offset = CONTAINER_HEADER_SIZE;
+  uint64_t totalCharacters = 0, totalBits = 0;
+  int result = 0;
+
+  writeHeader(outputFile, interleaved ? INTERLEAVED_STREAM_VERSION : STREAM_VERSION, blockSize);
+
+  size_t i;
+  for (i = 0; ; i++)
+  {
+    // Read blocks ahead for as long as there are free slots.
+    while (!parallel.inputDone && parallel.blocksReady < i + parallel.window)
+    {
+      StreamBlock* block = &parallel.blocks[parallel.blocksReady % parallel.window];
+      if (block->inputCapacity < blockSize)
+      {
+        block->input = malloc(blockSize);
+        block->inputCapacity = blockSize;
+      }
+      block->inputSize = fread(block->input, 1, blockSize, inputFile);
+
+      if (workers != NULL)
+      {
+        pthread_mutex_lock(&parallel.lock);
+      }
+      if (block->inputSize == 0)
+      {
+        parallel.inputDone = 1;
+      } else
+      {
+        parallel.blocksReady++;
+      }
+      if (workers != NULL)
+      {
+        pthread_cond_broadcast(&parallel.blockReady);
+        pthread_mutex_unlock(&parallel.lock);
+      }
+    }
+    if (i == parallel.blocksReady)
+    {
+      break;
+    }
+
+    StreamBlock* block = waitForStreamBlock(&parallel, workers, i);
+    if (block->failed)
+    {
+      fprintf(stderr, "The characters of block %zu do not fit in codes of %d bits\n", i, parallel.maxCodeLength);
+      result = -1;
+      break;
+    }
+
+    if (i == offsetCapacity)
+    {
+      offsetCapacity *= 2;
+      offsets = realloc(offsets, sizeof(uint64_t) * offsetCapacity);
+    }
+    offsets[i] = offset;
+    fwrite(block->output, 1, block->outputSize, outputFile);
+    offset += block->outputSize;
+    totalCharacters += block->inputSize;
+    totalBits += block->bitCount;
+
+    streamBlockWritten(&parallel, workers, i);
+  }
+  finishParallelStream(&parallel, workers, threadCount);
+
+  // The end block, then the index: the offset of every block and of the end block, and the block count.
+  unsigned char end[STREAM_BLOCK_HEADER_SIZE] = {0};
+  fwrite(end, 1, STREAM_BLOCK_HEADER_SIZE, outputFile);
+  if (result == 0)
+  {
+    unsigned char entry[8];
+    for (size_t j = 0; j < i; j++)
+    {
+      writeLittleEndian(entry, offsets[j], 8);
+      fwrite(entry, 1, 8, outputFile);
+    }
+    writeLittleEndian(entry, offset, 8);
+    fwrite(entry, 1, 8, outputFile);
+    writeLittleEndian(entry, i, 8);
+    fwrite(entry, 1, 8, outputFile);
+    fwrite(STREAM_INDEX_MAGIC, 1, 4, outputFile);
+  }
+  fflush(outputFile);
+  free(offsets);
+
+  if (result == 0 && (ferror(inputFile) || ferror(outputFile)))
+  {
+    fprintf(stderr, "Could not read the input or write the stream\n");
+    result = -1;
+  }
+  if (result == 0)
+  {
+    fprintf(stderr, "Blocks: %zu\n", i);
+    fprintf(stderr, "Original: %llu bits\n", (unsigned long long)totalCharacters * 8);
+    fprintf(stderr, "Compressed: %llu bits\n", (unsigned long long)totalBits);
+    fprintf(stderr, "Compression Ratio: %.2f%%\n", totalCharacters > 0 ? (double)totalBits / ((double)totalCharacters * 8) * 100 : 0);
+  }
+
+  return result;
+}
+
+// Function to read the block index at the end of a stream file. Returns the number of blocks and the offsets
+// of the blocks and of the end block, or -1 if the file cannot seek or has no index.
+long long readStreamIndex(FILE* file, uint64_t** offsetsOut)
+{
+  unsigned char footer[STREAM_INDEX_FOOTER_SIZE];
+  if (fseeko(file, -STREAM_INDEX_FOOTER_SIZE, SEEK_END) != 0 || fread(footer, 1, STREAM_INDEX_FOOTER_SIZE, file) != STREAM_INDEX_FOOTER_SIZE ||
+      memcmp(footer + 8, STREAM_INDEX_MAGIC, 4) != 0)
+  {
+    return -1;
+  }
+
+  // Every block takes more than 8 bytes, so a count past the file size cannot be right.
+  uint64_t blockCount = readLittleEndian(footer, 8);
+  off_t indexSize = (off_t)(blockCount + 1) * 8;
+  off_t fileSize = ftello(file);
+  if (blockCount > (uint64_t)fileSize / 8 || fseeko(file, -(STREAM_INDEX_FOOTER_SIZE + indexSize), SEEK_END) != 0)
+  {
+    return -1;
+  }
+
+  uint64_t* offsets = malloc(indexSize);
+  unsigned char entry[8];
+  for (uint64_t i = 0; i <= blockCount; i++)
+  {
+    if (fread(entry, 1, 8, file) != 8)
+    {
+      free(offsets);
+      return -1;
+    }
+    offsets[i] = readLittleEndian(entry, 8);
+    if ((i == 0 && offsets[i] != CONTAINER_HEADER_SIZE) || (i > 0 && offsets[i] <= offsets[i - 1]) || offsets[i] > (uint64_t)fileSize)
+    {
+      free(offsets);
+      return -1;
+    }
+  }
+
+  *offsetsOut = offsets;
+  return (long long)blockCount;
+}
+
+// Function to decode a stream file through its block index with threadCount threads: the workers read and
+// decode the blocks they take at their offsets, and the main thread writes them in order.
+// Returns 0 on success, -1 for a damaged block and 1 if the file has no index (or is not a file).
+int parallelStreamDecode(FILE* encodedFile, FILE* decodedFile, int interleaved, int threadCount)
+{
+  uint64_t* offsets;
+  long long blockCount = readStreamIndex(encodedFile, &offsets);
+  if (blockCount < 0)
+  {
+    return 1;
+  }
+
+  ParallelStream parallel;
+  parallel.encoding = 0;
+  parallel.interleaved = interleaved;
+  parallel.fd = fileno(encodedFile);
+  parallel.offsets = offsets;
+  parallel.blocksReady = (size_t)blockCount;
+  parallel.inputDone = 1;
+  pthread_t* workers = startParallelStream(&parallel, threadCount);
+
+  int result = 0;
+  for (size_t i = 0; i < (size_t)blockCount; i++)
+  {
+    StreamBlock* block = waitForStreamBlock(&parallel, workers, i);
+    if (block->failed)
+    {
+      fprintf(stderr, "Damaged block %zu\n", i);
+      result = -1;
+      break;
+    }
+    fwrite(block->output, 1, block->outputSize, decodedFile);
+    streamBlockWritten(&parallel, workers, i);
+  }
+  finishParallelStream(&parallel, workers, threadCount);
+
+  fflush(decodedFile);
+  free(offsets);
+  return result;
+}
+
+// Function to decode the blocks of a stream whose header the reader has just passed, up to the end block.
+// Each block is decoded with a table built from its own code lengths; the parts of an interleaved block are
+// read into memory whole and decoded together. Returns 0 on success.
+int streamDecode(BitReader* reader, FILE* decodedFile, int interleaved)
+{
+  CodeBook* book = malloc(sizeof(CodeBook));
+  StreamBlock block = {0};
+  int result = -1;
+
+  for (uint64_t blockCount = 0; ; blockCount++)
+  {
+    unsigned char header[STREAM_BLOCK_HEADER_SIZE];
+    if (!readAlignedBytes(reader, header, STREAM_BLOCK_HEADER_SIZE))
+    {
+      fprintf(stderr, "The stream ends before its end block\n");
+      break;
+    }
+    uint64_t characters = readLittleEndian(header, 4);
+    uint64_t bitCount = readLittleEndian(header + 4, 8);
+    if (characters == 0)
+    {
+      result = 0;
+      break;
+    }
+
+    if (!readCodeLengths(reader, book))
+    {
+      fprintf(stderr, "Damaged code lengths in block %llu\n", (unsigned long long)blockCount);
+      break;
+    }
+
+    if (interleaved)
+    {
+      // Gather the block again, header and code lengths included, and decode it like a worker would.
+      unsigned char counts[8 * INTERLEAVED_STREAMS];
+      if (!readAlignedBytes(reader, counts, sizeof(counts)) || characters > MAX_BLOCK_SIZE)
+      {
+        fprintf(stderr, "Damaged block %llu\n", (unsigned long long)blockCount);
+        break;
+      }
+      unsigned char runs[512];
+      size_t runSize = codeLengthRuns(book, runs);
+      size_t payloadSize = 0;
+      for (int s = 0; s < INTERLEAVED_STREAMS; s++)
+      {
+        payloadSize += (readLittleEndian(counts + 8 * s, 8) + 7) / 8;
+      }
+      size_t size = STREAM_BLOCK_HEADER_SIZE + runSize + sizeof(counts) + payloadSize;
+      if (payloadSize > bitCount / 8 + INTERLEAVED_STREAMS)
+      {
+        fprintf(stderr, "Damaged block %llu\n", (unsigned long long)blockCount);
+        break;
+      }
+      if (size > block.inputCapacity)
+      {
+        free(block.input);
+        block.input = malloc(size);
+        block.inputCapacity = size;
+      }
+      memcpy(block.input, header, STREAM_BLOCK_HEADER_SIZE);
+      memcpy(block.input + STREAM_BLOCK_HEADER_SIZE, runs, runSize);
+      memcpy(block.input + STREAM_BLOCK_HEADER_SIZE + runSize, counts, sizeof(counts));
+      block.inputSize = size;
+      if (!readAlignedBytes(reader, block.input + size - payloadSize, payloadSize))
+      {
+        fprintf(stderr, "The stream ends inside block %llu\n", (unsigned long long)blockCount);
+        break;
+      }
+
+      decodeStreamBlockBytes(&block, 1);
+      if (block.failed)
+      {
+        fprintf(stderr, "Damaged block %llu\n", (unsigned long long)blockCount);
+        break;
+      }
+      fwrite(block.output, 1, block.outputSize, decodedFile);
+      continue;
+    }
+
+    DecodeTable* table = buildDecodeTable(book);
+    reader->bitsLeft = bitCount;
+    uint64_t written = decodeWithTable(reader, table, decodedFile);
+    freeDecodeTable(table);
+
+    if (written != characters)
+    {
+      fprintf(stderr, "Damaged block %llu: %llu of %llu characters\n", (unsigned long long)blockCount,
+              (unsigned long long)written, (unsigned long long)characters);
+      break;
+    }
+    alignBitReader(reader);
+  }
+
+  fflush(decodedFile);
+  free(block.input);
+  free(block.output);
+  free(book);
+  return result;
+}
+
+// Function to open a file for the stream modes, where "-" is stdin or stdout.
+FILE* openStreamFile(char* path, char* mode, FILE* standardFile)
+{
+  if (strcmp(path, "-") == 0)
+  {
+    return standardFile;
+  }
+
+  FILE* file = fopen(path, mode);
+  if (file == NULL)
+  {
+    fprintf(stderr, "Could not open file: %s\n", path);
+  }
+  return file;
+}
+
+// Function to read the options from argv[first] on: --max-code-length=L, --block-size=N with an optional K or
+// M suffix, and --threads=N (0 for one per CPU). An option whose pointer is NULL is not taken by the mode.
+// Returns 0 and says why for an option it cannot use.
+int parseOptions(int argc, char** argv, int first, int* maxCodeLength, size_t* blockSize, int* threadCount,
+                 int* interleaved)
+{
+  for (int i = first; i < argc; i++)
+  {
+    if (interleaved != NULL && strcmp(argv[i], "--interleave") == 0)
+    {
+      *interleaved = 1;
+    } else if (threadCount != NULL && strncmp(argv[i], "--threads=", 10) == 0)
+    {
+      *threadCount = atoi(argv[i] + 10);
+      if (*threadCount < 0)
+      {
+        fprintf(stderr, "The number of threads cannot be negative\n");
+        return 0;
+      }
+      if (*threadCount == 0)
+      {
+        *threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+      }
+    } else if (maxCodeLength != NULL && strncmp(argv[i], "--max-code-length=", 18) == 0)
+    {
+      *maxCodeLength = atoi(argv[i] + 18);
+      if (*maxCodeLength < 1 || *maxCodeLength > MAX_CODE_LENGTH)
+      {
+        fprintf(stderr, "The maximum code length must be between 1 and %d bits\n", MAX_CODE_LENGTH);
+        return 0;
+      }
+    } else if (blockSize != NULL && strncmp(argv[i], "--block-size=", 13) == 0)
+    {
+      char* end;
+      unsigned long size = strtoul(argv[i] + 13, &end, 10);
+      if (*end == 'K' || *end == 'k')
+      {
+        size *= 1024;
+        end++;
+      } else if (*end == 'M' || *end == 'm')
+      {
+        size *= 1024 * 1024;
+        end++;
+      }
+      if (*end != '\0' || size < 1 || size > MAX_BLOCK_SIZE)
+      {
+        fprintf(stderr, "The block size must be between 1 byte and %d MiB\n", MAX_BLOCK_SIZE / (1024 * 1024));
+        return 0;
+      }
+      *blockSize = size;
+    } else
+    {
+      fprintf(stderr, "Unknown option: %s\n", argv[i]);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+// Function to get the code book of a container whose header the reader has just passed: a version 2 container carries
+// its code lengths, a version 1 container is decoded with the codes from the code table file. Returns 0 and
+// says why if there is no usable code book.
+int loadCodeBook(BitReader* reader, int version, char* encodedTextFilePath, char* codeTableFilePath, CodeBook* book)
+{
+  if (version >= 2)
+  {
+    if (!readCodeLengths(reader, book))
+    {
+      printf("Damaged code lengths in %s\n", encodedTextFilePath);
+      return 0;
+    }
+    return 1;
+  }
+
+  CodeTable* codeTable;
+  Node** nodeArray;
+  Heap* heap = readCodeTableFile(codeTableFilePath, &codeTable, &nodeArray);
+  if (heap == NULL)
+  {
+    return 0;
+  }
+  codeBookFromCodeTable(codeTable, book);
+  freeMemory(heap, codeTable, nodeArray);
+  return 1;
+}
+
+// Function to decode the encoded file and write to decode file. Only for decode mode.
+// A binary container is decoded through the decoding table, built from its code book without a tree; a file
+// without the container header is the old '0'/'1' text, which is walked through the tree from the code table.
+void traverseAndDecode(char* encodedTextFilePath, char* decodedTextFilePath, char* codeTableFilePath)
+{
+  FILE* encodedFile = fopen(encodedTextFilePath, "rb");
+  if (encodedFile == NULL)
+  {
+    printf("Could not open file to write: %s\n",encodedTextFilePath);
+    return;
+  }
+
+  FILE* decodedFile = fopen(decodedTextFilePath, "w");
+  if (decodedFile == NULL)
+  {
+    printf("Could not open file to write: %s\n",decodedTextFilePath);
+    return;
+  }
+
+  uint64_t bitCount;
+  int version = readContainerHeader(encodedFile, &bitCount);
+  if (version == -1)
+  {
+    printf("Unsupported container version in %s\n", encodedTextFilePath);
+    fclose(encodedFile);
+    fclose(decodedFile);
+    return;
+  }
+
+  if (version == STREAM_VERSION || version == INTERLEAVED_STREAM_VERSION)
+  {
+    BitReader reader;
+    initBitReader(&reader, encodedFile, 0);
+    streamDecode(&reader, decodedFile, version == INTERLEAVED_STREAM_VERSION);
+    freeBitReader(&reader);
+    fclose(encodedFile);
+    fclose(decodedFile);
+    return;
+  }
+
+  if (version > 0)
+  {
+    BitReader reader;
+    initBitReader(&reader, encodedFile, bitCount);
+    CodeBook* book = malloc(sizeof(CodeBook));
+    if (loadCodeBook(&reader, version, encodedTextFilePath, codeTableFilePath, book))
+    {
+      DecodeTable* table = buildDecodeTable(book);
+
+      decodeWithTable(&reader, table, decodedFile);
+
+      freeDecodeTable(table);
+    }
+
+    free(book);
+    freeBitReader(&reader);
+    fclose(encodedFile);
+    fclose(decodedFile);
+    return;
+  }
+
+  // Rebuild the huffman tree from the frequencies in the code table file.
+  CodeTable* codeTable;
+  Node** nodeArray;
+  Heap* heap = readCodeTableFile(codeTableFilePath, &codeTable, &nodeArray);
+  Node* node = heap != NULL ? heap->array[0] : NULL;
+  if (node == NULL)
+  {
+    // No code table, or an empty one for an empty text.
+    if (heap != NULL)
+    {
+      freeMemory(heap, codeTable, nodeArray);
+    }
+    fclose(encodedFile);
+    fclose(decodedFile);
+    return;
+  }
+
+  rewind(encodedFile);
+
+  char bit;
+  Node* currentNode = node;
+  while ((bit = fgetc(encodedFile)) != EOF)
+  {    
+    if (bit == '0')
+    {
+      currentNode = currentNode->left;
+
+    } else if (bit == '1')
+    {
+      currentNode = currentNode->right;
+    }
+
+    // We've hit the leaf node. Write the character in the current node to decodedFile.
+    if (currentNode->left == NULL && currentNode->right == NULL)
+    {
+      fprintf(decodedFile, "%c", currentNode->character);
+      currentNode = node;
+    }
+  }
+
+  freeMemory(heap, codeTable, nodeArray);
+  fclose(encodedFile);
+  fclose(decodedFile);
+}
+
+// Function to build a huffman tree with the codes of a code book, for the tree walk in bench mode.
+Node* buildTreeFromCodeBook(CodeBook* book)
+{
+  Node* root = calloc(1, sizeof(Node));
+  for (int i = 0; i < 256; i++)
+  {
+    Node* node = root;
+    for (int j = book->lengths[i] - 1; j >= 0; j--)
+    {
+      Node** child = (book->codes[i] >> j) & 1 ? &node->right : &node->left;
+      if (*child == NULL)
+      {
+        *child = calloc(1, sizeof(Node));
+      }
+      node = *child;
+    }
+    if (book->lengths[i] > 0)
+    {
+      node->character = (unsigned char)i;
+    }
+  }
+
+  return root;
+}
+
+// Function to get the time in seconds, for bench mode.
+double currentSeconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Function to time the decoding of a stream file held in memory, block after block on one thread, into
+// memory. The best of BENCH_RUNS runs is reported in MB/s of decoded text.
+int benchStream(FILE* encodedFile, char* encodedTextFilePath, int interleaved)
+{
+  uint64_t* offsets;
+  long long blockCount = readStreamIndex(encodedFile, &offsets);
+  if (blockCount < 0)
+  {
+    printf("%s has no block index\n", encodedTextFilePath);
+    return -1;
+  }
+
+  size_t encodedSize = offsets[blockCount] - offsets[0];
+  unsigned char* encoded = malloc(encodedSize > 0 ? encodedSize : 1);
+  if (fseeko(encodedFile, offsets[0], SEEK_SET) != 0 || fread(encoded, 1, encodedSize, encodedFile) != encodedSize)
+  {
+    printf("Could not read the blocks of %s\n", encodedTextFilePath);
+    free(encoded);
+    free(offsets);
+    return -1;
+  }
+
+  StreamBlock block = {0};
+  double best = 0;
+  uint64_t characters = 0;
+  int failed = 0;
+  for (int run = 0; run < BENCH_RUNS && !failed; run++)
+  {
+    characters = 0;
+    double start = currentSeconds();
+    for (long long i = 0; i < blockCount && !failed; i++)
+    {
+      // The block is decoded in place, so its input only points into the encoded bytes.
+      block.input = encoded + (offsets[i] - offsets[0]);
+      block.inputSize = offsets[i + 1] - offsets[i];
+      decodeStreamBlockBytes(&block, interleaved);
+      failed = block.failed;
+      characters += block.outputSize;
+    }
+    double elapsed = currentSeconds() - start;
+    if (run == 0 || elapsed < best)
+    {
+      best = elapsed;
+    }
+  }
+
+  printf("Encoded: %zu bytes in %lld blocks, decoded: %llu characters\n", encodedSize, blockCount,
+         (unsigned long long)characters);
+  if (failed)
+  {
+    printf("Damaged block in %s\n", encodedTextFilePath);
+  } else
+  {
+    printf("%s: %8.1f MB/s\n", interleaved ? "Interleaved blocks" : "Stream blocks", best > 0 ? characters / 1e6 / best : 0);
+  }
+
+  free(block.output);
+  free(encoded);
+  free(offsets);
+  return failed ? -1 : 0;
+}
+
+// Function to compare the tree walk and the decoding table on an encoded file held in memory. Each decoder
+// runs BENCH_RUNS times, writing to /dev/null, and the best run is reported in MB/s of decoded text.
+int benchDecoders(char* encodedTextFilePath, char* codeTableFilePath)
+{
+  FILE* encodedFile = fopen(encodedTextFilePath, "rb");
+  if (encodedFile == NULL)
+  {
+    printf("Could not open file to read: %s\n",encodedTextFilePath);
+    return -1;
+  }
+
+  uint64_t bitCount;
+  int version = readContainerHeader(encodedFile, &bitCount);
+  if (version == STREAM_VERSION || version == INTERLEAVED_STREAM_VERSION)
+  {
+    int result = benchStream(encodedFile, encodedTextFilePath, version == INTERLEAVED_STREAM_VERSION);
+    fclose(encodedFile);
+    return result;
+  }
+  if (version < 1)
+  {
+    printf("%s is not a binary container\n", encodedTextFilePath);
+    fclose(encodedFile);
+    return -1;
+  }
+
+  BitReader fileReader;
+  initBitReader(&fileReader, encodedFile, bitCount);
+  CodeBook* book = malloc(sizeof(CodeBook));
+  if (!loadCodeBook(&fileReader, version, encodedTextFilePath, codeTableFilePath, book))
+  {
+    free(book);
+    freeBitReader(&fileReader);
+    fclose(encodedFile);
+    return -1;
+  }
+
+  // Read the payload in whole bytes, as far as the file holds it.
+  size_t payloadSize = (bitCount + 7) / 8;
+  unsigned char* payload = malloc(payloadSize > 0 ? payloadSize : 1);
+  size_t readSize = 0;
+  while (readSize < payloadSize && readAlignedBytes(&fileReader, payload + readSize, 1))
+  {
+    readSize++;
+  }
+  payloadSize = readSize;
+  freeBitReader(&fileReader);
+  fclose(encodedFile);
+
+  FILE* sink = fopen("/dev/null", "wb");
+  if (sink == NULL)
+  {
+    printf("Could not open file to write: /dev/null\n");
+    free(payload);
+    return -1;
+  }
+
+  double start = currentSeconds();
+  DecodeTable* table = buildDecodeTable(book);
+  double buildTime = currentSeconds() - start;
+  Node* root = buildTreeFromCodeBook(book);
+
+  double bestTree = 0, bestTable = 0;
+  uint64_t treeCharacters = 0, tableCharacters = 0;
+  for (int run = 0; run < BENCH_RUNS; run++)
+  {
+    BitReader reader;
+
+    initMemoryBitReader(&reader, payload, payloadSize, bitCount);
+    start = currentSeconds();
+    treeCharacters = decodeWithTree(&reader, root, sink);
+    fflush(sink);
+    double elapsed = currentSeconds() - start;
+    if (run == 0 || elapsed < bestTree)
+    {
+      bestTree = elapsed;
+    }
+
+    initMemoryBitReader(&reader, payload, payloadSize, bitCount);
+    start = currentSeconds();
+    tableCharacters = decodeWithTable(&reader, table, sink);
+    fflush(sink);
+    elapsed = currentSeconds() - start;
+    if (run == 0 || elapsed < bestTable)
+    {
+      bestTable = elapsed;
+    }
+  }
+
+  double megabytes = treeCharacters / 1e6;
+  printf("Encoded: %zu bytes, decoded: %llu characters\n", payloadSize, (unsigned long long)treeCharacters);
+  printf("Decoding table: %u entries (%u in subtables), built in %.3f ms\n", table->size,
+         table->size - (1u << DECODE_TABLE_BITS), buildTime * 1e3);
+  printf("Tree walk:      %8.1f MB/s\n", bestTree > 0 ? megabytes / bestTree : 0);
+  printf("Decoding table: %8.1f MB/s\n", bestTable > 0 ? megabytes / bestTable : 0);
+  if (treeCharacters != tableCharacters)
+  {
+    printf("Decoders disagree: %llu vs %llu characters\n", (unsigned long long)treeCharacters,
+           (unsigned long long)tableCharacters);
+  }
+
+  freeDecodeTable(table);
+  freeHuffmanTree(root);
+  free(book);
+  fclose(sink);
+  free(payload);
+  return treeCharacters == tableCharacters ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+  char* mode = argv[1];
+  char* inputTextFilePath;
+  char* codeTableFilePath;
+  char* encodedTextFilePath;
+  char* decodedTextFilePath;
+
+  //argv[1] will be "encode" or "decode" signifying the mode of the program, "bench" to time the decoders,
+  //or "stream-encode" / "stream-decode" for block streams of any size.
+  if (strcmp(mode, "encode") == 0)
+  {
+    /*----------------ENCODER-----------------------*/
+
+    inputTextFilePath = argv[2];
+    codeTableFilePath = argv[3];
+    encodedTextFilePath = argv[4];
+
+    // --max-code-length=L keeps every code to at most L bits, at some cost in compression.
+    int maxCodeLength = 0;
+    if (!parseOptions(argc, argv, 5, &maxCodeLength, NULL, NULL, NULL))
+    {
+      return -1;
+    }
+
+    // Read the input text file
+    FILE *inputFile = fopen(inputTextFilePath, "r");
+
+    if (inputFile == NULL)
+    {
+      printf("Could not open file to read: %s\n",inputTextFilePath);
+      return -1;
+    }
+
+    // Initialize the code table, which will store the frequency of each character, and eventually the binary code. We are allocating a space of 256 in the table.
+    // The character's ASCII code will serve as hashing the index for that character.
+    CodeTable *codeTable = malloc(sizeof(CodeTable)*256);
+
+    //set frequency to zero and binary_codes to NULL initially.
+    for(int i = 0; i < 256; i++)
+    {
+      codeTable[i].frequency = 0;
+      codeTable[i].binary_code = NULL;
+    }
+
+    int totalNumOfCharacters=0;
+    char c;
+
+    // read the file character by character
+    while ((c = fgetc(inputFile)) != EOF && c!='\n')
+    {
+      //increase the frequency of the character by one
+      codeTable[c].frequency++;
+      //increase the total character count
+      totalNumOfCharacters++;
+    }
+    fclose(inputFile);
+
+    // We will create a NodeArray that will store all the characters we have in the CodeTable with frequency > 0 and then generate a min heap (priority queue)
+    // nodeArray is basically codeTable, but only contains characters with frequency > 0. That way, we don't have to deal with characters with frequcny < 0 while sorting.
+    // Also, since we make nodes for each character, it's easier to make a heap as well.
+    Node** nodeArray = intializeNodeArray(totalNumOfCharacters);
+    int nodeCount = insertToNodeArray(nodeArray, codeTable, 256);
+
+    // We will build the min heap. An empty text leaves it without a root, which is NULL.
+    Heap* heap = initializeHeap(nodeCount > 0 ? nodeCount : 1);
+    heap->array[0] = NULL;
+
+    // We will insert to heap.
+    for (int i = 0; i < nodeCount; i++)
+    {
+      insertToHeap(heap, nodeArray[i]);
     }
 
     // We will now build Huffman Tree
@@ -423,6 +2493,37 @@ int main(int argc, char **argv)
     char binaryArray[256];
     labelHuffmanEdges(root, codeTable, binaryArray, 0);
 
+    // Only the code lengths are kept from the tree: the codes written are the canonical codes of those lengths,
+    // so the decoder can rebuild them from the lengths alone. A lone character gets a 1-bit code, not an
+    // empty one, so the number of times it appears is still in the encoded file.
+    CodeBook* book = malloc(sizeof(CodeBook));
+    codeBookFromCodeTable(codeTable, book);
+    if (nodeCount == 1)
+    {
+      book->lengths[root->character] = 1;
+    }
+
+    // If the tree has codes longer than the limit, the lengths come from package-merge instead.
+    int unlimitedSize = 0;
+    for (int i = 0; i < 256; i++)
+    {
+      unlimitedSize += book->lengths[i] * codeTable[i].frequency;
+    }
+    int limited = 0;
+    if (maxCodeLength > 0 && longestCode(book) > maxCodeLength)
+    {
+      if (!limitCodeLengths(codeTable, book, maxCodeLength))
+      {
+        printf("%d characters do not fit in codes of %d bits\n", nodeCount, maxCodeLength);
+        free(book);
+        freeMemory(heap, codeTable, nodeArray);
+        return -1;
+      }
+      limited = 1;
+    }
+    assignCanonicalCodes(book);
+    codeTableFromCodeBook(book, codeTable);
+
     // Now that the codeTable has binary_codes for each character with frequency > 0, we will write to the codeTableFile
     FILE *codeTableFile = fopen(codeTableFilePath, "w");
     if (codeTableFile == NULL)
@@ -447,11 +2548,19 @@ int main(int argc, char **argv)
     printf("Original: %d bits\n", totalNumOfCharacters*8);
     printf("Compressed: %d bits\n", compressed_size); // assuming that you store the number of bits (i.e., 0/1s) of encoded text in variable "compressed_size"
     printf("Compression Ratio: %.2f%%\n", (float)compressed_size/((float)totalNumOfCharacters*8)*100); // This line will print the compression ration in percentages, up to 2 decimals.
+    if (maxCodeLength > 0)
+    {
+      // What the length limit costs against the codes of the unlimited tree.
+      printf("Max Code Length: %d bits (longest code: %d bits%s)\n", maxCodeLength, longestCode(book), limited ? "" : ", no limiting needed");
+      printf("Length Limit Cost: %d bits (+%.2f%% over the unlimited codes)\n", compressed_size - unlimitedSize,
+             unlimitedSize > 0 ? (float)(compressed_size - unlimitedSize) / (float)unlimitedSize * 100 : 0);
+    }
     
     // Write encoded version of the text in 0/1 form into text file.
-    writeEncodedToFile(inputTextFilePath, encodedTextFilePath, codeTable);
+    writeEncodedToFile(inputTextFilePath, encodedTextFilePath, book);
 
     // Time to free all the memory
+    free(book);
     freeMemory(heap, codeTable, nodeArray);
 
   } else if (strcmp(mode, "decode") == 0)
@@ -462,68 +2571,87 @@ int main(int argc, char **argv)
     encodedTextFilePath = argv[3];
     decodedTextFilePath = argv[4];
 
-    FILE* codeTableFile = fopen(codeTableFilePath, "r");
-
-    if (codeTableFile == NULL)
-    {
-      printf("Could not open file to write: %s\n",codeTableFilePath);
-      return -1;
-    }
+    // Decode the encoded file and write to decodedTextFilePath. The code table file is only read for
+    // files written before the code lengths moved into the container.
+    traverseAndDecode(encodedTextFilePath, decodedTextFilePath, codeTableFilePath);
+  } else if (strcmp(mode, "bench") == 0)
+  {
+    /*----------------DECODER BENCHMARK-------------*/
 
-    // Read the codeTableFile and store each character and its frequency and binary_code to codeTable
-    char c;
-    char line[256];
-    char binary_code[256];
-    unsigned int frequency;
-    int totalNumOfCharacters = 0;
-    CodeTable* codeTable = malloc(sizeof(CodeTable) * 256);
+    codeTableFilePath = argv[2];
+    encodedTextFilePath = argv[3];
 
-    // Set frequency to zero and binary_codes to NULL initially.
-    for(int i = 0; i < 256; i++)
+    return benchDecoders(encodedTextFilePath, codeTableFilePath);
+  } else if (strcmp(mode, "stream-encode") == 0)
+  {
+    /*----------------STREAM ENCODER----------------*/
+
+    // Either path can be "-" for stdin / stdout. The input is read in blocks, so it can be of any size.
+    // --interleave splits each block into parts that are decoded together, for faster decoding.
+    int maxCodeLength = 0;
+    size_t blockSize = DEFAULT_BLOCK_SIZE;
+    int threadCount = 1;
+    int interleaved = 0;
+    if (!parseOptions(argc, argv, 4, &maxCodeLength, &blockSize, &threadCount, &interleaved))
     {
-      codeTable[i].frequency = 0;
-      codeTable[i].binary_code = NULL;
+      return -1;
     }
 
-    while (fgets(line, sizeof(line), codeTableFile))
+    FILE* inputFile = openStreamFile(argv[2], "rb", stdin);
+    FILE* encodedFile = inputFile != NULL ? openStreamFile(argv[3], "wb", stdout) : NULL;
+    if (encodedFile == NULL)
     {
-      if ((sscanf(line, "%c\t%s\t%u", &c, binary_code, &frequency)) != 3)
-      {
-        continue;
-      }
-      
-      codeTable[c].frequency = frequency;
-      codeTable[c].binary_code = malloc(strlen(binary_code) + 1);
-      strcpy(codeTable[c].binary_code, binary_code);
-
-      totalNumOfCharacters++;
+      return -1;
     }
-    fclose(codeTableFile);
 
-    // Initialize nodeArray.
-    Node** nodeArray = intializeNodeArray(totalNumOfCharacters);
+    int result = streamEncode(inputFile, encodedFile, blockSize, maxCodeLength, interleaved, threadCount);
 
-    // Insert each character from codeTable to nodeArray.
-    int nodeCount = insertToNodeArray(nodeArray, codeTable, 256);
+    fclose(inputFile);
+    fclose(encodedFile);
+    return result;
+  } else if (strcmp(mode, "stream-decode") == 0)
+  {
+    /*----------------STREAM DECODER----------------*/
 
-    // Initialize Heap.
-    Heap* heap = initializeHeap(nodeCount);
+    // With --threads the blocks are decoded in parallel through the block index, if the stream is a file that
+    // has one; a pipe is decoded block after block.
+    int threadCount = 1;
+    if (!parseOptions(argc, argv, 4, NULL, NULL, &threadCount, NULL))
+    {
+      return -1;
+    }
 
-    // Build the min heap by inserting each node from nodeArray to Heap.
-    for (int i = 0; i < nodeCount; i++)
+    FILE* encodedFile = openStreamFile(argv[2], "rb", stdin);
+    FILE* decodedFile = encodedFile != NULL ? openStreamFile(argv[3], "wb", stdout) : NULL;
+    if (decodedFile == NULL)
     {
-      insertToHeap(heap, nodeArray[i]);
+      return -1;
     }
-    
-    // Build the huffman tree.
-    buildHuffmanTree(heap);
 
-    // Traverse the huffman Tree and decode the encoded file and write to decodedTextFilePath.
-    Node* root = heap->array[0];
-    traverseAndDecode(encodedTextFilePath, decodedTextFilePath, root);
+    uint64_t blockSize;
+    int result = -1;
+    int version = readContainerHeader(encodedFile, &blockSize);
+    if (version == STREAM_VERSION || version == INTERLEAVED_STREAM_VERSION)
+    {
+      int interleaved = version == INTERLEAVED_STREAM_VERSION;
+      result = threadCount > 1 ? parallelStreamDecode(encodedFile, decodedFile, interleaved, threadCount) : 1;
+      if (result == 1)
+      {
+        // No index to work from. Looking for it only moved a file that can seek, so a pipe is still in place.
+        fseeko(encodedFile, CONTAINER_HEADER_SIZE, SEEK_SET);
+        BitReader reader;
+        initBitReader(&reader, encodedFile, 0);
+        result = streamDecode(&reader, decodedFile, interleaved);
+        freeBitReader(&reader);
+      }
+    } else
+    {
+      fprintf(stderr, "%s is not a stream\n", argv[2]);
+    }
 
-    // Free all the memory
-    freeMemory(heap, codeTable, nodeArray);
+    fclose(encodedFile);
+    fclose(decodedFile);
+    return result;
   }
 
   return 0;